@@ -0,0 +1,3447 @@
+// Core of the database shared by the server and its tools: the statement
+// parsers, the string helpers and the Database table with its scan kernels.
+#pragma once
+
+#include <mpi.h>
+#include <iostream>
+#include <climits>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <filesystem>
+
+// Define constants
+const int MAX_ATTR_LENGTH = 100;
+const int MAX_TUPLES = 20000000;
+const int MAX_RESULT_LENGTH = 20000;
+const int MAX_COMMAND_LENGTH = 20000;
+const int MAX_COLUMNS = 10;  
+const int MAX_COLUMN_NAME = 20;
+const int MAX_TABLES = 8;
+const int MAX_TABLE_NAME = 32;
+const int MAX_TABLE_TUPLES = 1000000;       // Capacity of tables created with CREATE TABLE
+const int MAX_VIEWS = 8;
+const int MAX_VIEW_COLUMNS = 3;
+const int BROADCAST_JOIN_THRESHOLD = 10000; // Join sides up to this many rows are broadcast
+
+
+struct WorkItem {
+    char command;  // 'I' for Insert, 'S' for Select, etc.
+    char attr1[MAX_ATTR_LENGTH];
+    char attr2[MAX_ATTR_LENGTH];
+    int attr3;
+    char setAttr1[MAX_ATTR_LENGTH];
+    char setAttr2[MAX_ATTR_LENGTH];
+    int setAttr3;
+};
+
+// Custom string length function
+inline int safeStringLength(const char* str, int maxLen) {
+    int len = 0;
+    while (str[len] != '\0' && len < maxLen) {
+        len++;
+    }
+    return len;
+}
+
+// Custom string comparison function
+inline bool safeCompareStrings(const char* str1, const char* str2, int maxLen) {
+    int i = 0;
+    while (i < maxLen - 1 && str1[i] != '\0' && str2[i] != '\0') {
+        if (str1[i] != str2[i]) return false;
+        i++;
+    }
+    return str1[i] == str2[i];
+}
+
+// Custom string copy function
+inline void safeCopyString(char* dest, const char* src, int maxLen) {
+    int i = 0;
+    while (src[i] != '\0' && i < maxLen - 1) {
+        dest[i] = src[i];
+        i++;
+    }
+    dest[i] = '\0';
+}
+
+// Custom string matching function with wildcard support
+inline bool matchesPattern(const char* str, const char* pattern, int maxLen) {
+    // Wildcard matching
+    if (pattern[0] == '*' && pattern[1] == '\0') return true;
+
+    int strLen = safeStringLength(str, maxLen);
+    int patternLen = safeStringLength(pattern, maxLen);
+
+    // Check for prefix wildcard
+    if (pattern[patternLen - 1] == '*') {
+        if (patternLen - 1 > strLen) return false;
+        for (int i = 0; i < patternLen - 1; i++) {
+            if (str[i] != pattern[i]) return false;
+        }
+        return true;
+    }
+
+    // Check for exact match
+    return safeCompareStrings(str, pattern, maxLen);
+}
+
+// Custom lexicographic string ordering (negative, zero or positive like strcmp)
+inline int safeOrderStrings(const char* str1, const char* str2, int maxLen) {
+    int i = 0;
+    while (i < maxLen - 1 && str1[i] != '\0' && str1[i] == str2[i]) {
+        i++;
+    }
+    return (unsigned char)str1[i] - (unsigned char)str2[i];
+}
+
+// Custom substring search, returns the position of keyword in line or -1
+inline int findKeyword(const char* line, const char* keyword) {
+    int keywordLen = safeStringLength(keyword, MAX_COMMAND_LENGTH);
+    for (int pos = 0; line[pos] != '\0'; ++pos) {
+        int i = 0;
+        while (i < keywordLen && line[pos + i] == keyword[i]) i++;
+        if (i == keywordLen) return pos;
+    }
+    return -1;
+}
+
+class SelectQuery {
+public:
+    char selectedColumns[MAX_COLUMNS][MAX_COLUMN_NAME];
+    int selectedColumnCount;
+    char attr1Condition[MAX_ATTR_LENGTH];
+    char attr2Condition[MAX_ATTR_LENGTH];
+    int attr3Condition;
+    int attr3Low;          // Range on attr3, INT_MIN / INT_MAX when unbounded
+    int attr3High;
+    int orderByColumn;     // 0 for storage order, 1-3 for attr1-attr3
+    bool orderDescending;
+    int limit;             // -1 for no LIMIT
+
+    SelectQuery() {
+        selectedColumnCount = 0;
+        attr1Condition[0] = '\0';
+        attr2Condition[0] = '\0';
+        attr3Condition = -1;
+        attr3Low = INT_MIN;
+        attr3High = INT_MAX;
+        orderByColumn = 0;
+        orderDescending = false;
+        limit = -1;
+    }
+
+    bool isOrdered() const {
+        return orderByColumn != 0 || limit >= 0;
+    }
+
+    bool hasRange() const {
+        return attr3Low != INT_MIN || attr3High != INT_MAX;
+    }
+
+    void addSelectedColumn(const char* columnName) {
+        if (selectedColumnCount < MAX_COLUMNS) {
+            safeCopyString(selectedColumns[selectedColumnCount], columnName, MAX_COLUMN_NAME);
+            selectedColumnCount++;
+        }
+    }
+
+    bool isColumnSelected(const char* columnName) const {
+        if (selectedColumnCount == 0) return true;  // If no specific columns, return all
+
+        for (int i = 0; i < selectedColumnCount; ++i) {
+            if (safeCompareStrings(selectedColumns[i], columnName, MAX_COLUMN_NAME)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+inline bool sameSelectQuery(const SelectQuery& a, const SelectQuery& b) {
+    if (a.selectedColumnCount != b.selectedColumnCount) return false;
+    for (int i = 0; i < a.selectedColumnCount; ++i) {
+        if (!safeCompareStrings(a.selectedColumns[i], b.selectedColumns[i], MAX_COLUMN_NAME)) return false;
+    }
+    return safeCompareStrings(a.attr1Condition, b.attr1Condition, MAX_ATTR_LENGTH) &&
+        safeCompareStrings(a.attr2Condition, b.attr2Condition, MAX_ATTR_LENGTH) &&
+        a.attr3Condition == b.attr3Condition &&
+        a.attr3Low == b.attr3Low &&
+        a.attr3High == b.attr3High &&
+        a.orderByColumn == b.orderByColumn &&
+        a.orderDescending == b.orderDescending &&
+        a.limit == b.limit;
+}
+
+inline void parseSelectQuery(const char* line, SelectQuery& query) {
+    int pos = 0;
+    // Reset query
+    query.selectedColumnCount = 0;
+    query.attr1Condition[0] = '\0';
+    query.attr2Condition[0] = '\0';
+    query.attr3Condition = -1;
+    query.attr3Low = INT_MIN;
+    query.attr3High = INT_MAX;
+    query.orderByColumn = 0;
+    query.orderDescending = false;
+    query.limit = -1;
+
+    // Parse selected columns
+    while (line[pos] != '\0' && line[pos] != 'F' && line[pos] != 'W') {
+        if (safeCompareStrings(line + pos, "attr1", 5)) {
+            query.addSelectedColumn("attr1");
+            pos += 5;
+        }
+        else if (safeCompareStrings(line + pos, "attr2", 5)) {
+            query.addSelectedColumn("attr2");
+            pos += 5;
+        }
+        else if (safeCompareStrings(line + pos, "attr3", 5)) {
+            query.addSelectedColumn("attr3");
+            pos += 5;
+        }
+        pos++;
+    }
+
+    // Parse WHERE conditions
+    while (line[pos] != '\0') {
+        // Check for attr1 condition
+        if (safeCompareStrings(line + pos, "attr1=", 6)) {
+            pos += 6;
+            int attrPos = 0;
+            query.attr1Condition[0] = '\0';
+            while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
+                query.attr1Condition[attrPos++] = line[pos++];
+            }
+            query.attr1Condition[attrPos] = '\0';
+        }
+        // Check for attr2 condition
+        else if (safeCompareStrings(line + pos, "attr2=", 6)) {
+            pos += 6;
+            int attrPos = 0;
+            query.attr2Condition[0] = '\0';
+            while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
+                query.attr2Condition[attrPos++] = line[pos++];
+            }
+            query.attr2Condition[attrPos] = '\0';
+        }
+        // Check for attr3 condition
+        else if (safeCompareStrings(line + pos, "attr3=", 6)) {
+            pos += 6;
+            query.attr3Condition = 0;
+            while (line[pos] >= '0' && line[pos] <= '9') {
+                query.attr3Condition = query.attr3Condition * 10 + (line[pos] - '0');
+                pos++;
+            }
+        }
+        // Check for an attr3 range bound: attr3>=n, attr3>n, attr3<=n or attr3<n
+        else if (safeCompareStrings(line + pos, "attr3>", 6) || safeCompareStrings(line + pos, "attr3<", 6)) {
+            bool lower = line[pos + 5] == '>';
+            bool inclusive = line[pos + 6] == '=';
+            pos += inclusive ? 7 : 6;
+            int bound = 0;
+            while (line[pos] >= '0' && line[pos] <= '9') {
+                bound = bound * 10 + (line[pos] - '0');
+                pos++;
+            }
+            if (lower) query.attr3Low = inclusive ? bound : bound + 1;
+            else query.attr3High = inclusive ? bound : bound - 1;
+        }
+        else {
+            pos++;
+        }
+    }
+
+    // Parse ORDER BY attrN [ASC|DESC]
+    int orderPos = findKeyword(line, "ORDER BY ");
+    if (orderPos >= 0) {
+        pos = orderPos + 9;
+        while (line[pos] == ' ') pos++;
+        if (safeCompareStrings(line + pos, "attr", 4) && line[pos + 4] >= '1' && line[pos + 4] <= '3') {
+            query.orderByColumn = line[pos + 4] - '0';
+            pos += 5;
+        }
+        while (line[pos] == ' ') pos++;
+        if (safeCompareStrings(line + pos, "DESC", 4)) {
+            query.orderDescending = true;
+        }
+    }
+
+    // Parse LIMIT n
+    int limitPos = findKeyword(line, "LIMIT ");
+    if (limitPos >= 0) {
+        pos = limitPos + 6;
+        while (line[pos] == ' ') pos++;
+        if (line[pos] >= '0' && line[pos] <= '9') {
+            query.limit = 0;
+            while (line[pos] >= '0' && line[pos] <= '9') {
+                query.limit = query.limit * 10 + (line[pos] - '0');
+                pos++;
+            }
+        }
+    }
+}
+
+// A table schema names the three Tuple slots: two text columns (attr1, attr2)
+// and one integer column (attr3), which is also the partition key
+struct TableSchema {
+    char name[MAX_TABLE_NAME];
+    char columns[3][MAX_COLUMN_NAME];
+};
+
+// What each column of a materialized view holds
+const int VIEW_GROUP = 0;  // The value grouped on
+const int VIEW_COUNT = 1;  // COUNT(*)
+const int VIEW_SUM = 2;    // SUM of the integer column
+
+// A materialized view: grouped aggregates over the live rows of a table, which
+// every worker keeps up to date for its partition as rows are written
+struct ViewSchema {
+    char name[MAX_TABLE_NAME];
+    int table;
+    int groupColumn;  // Tuple slot grouped on, 1 or 2
+    int tableView;    // Position among the views of its table
+    int columns[MAX_VIEW_COLUMNS];
+    int columnCount;
+};
+
+inline bool isIdentifierChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Copy the identifier starting at line[pos] into word and advance pos past it
+inline void readIdentifier(const char* line, int& pos, char* word, int maxLen) {
+    int wordPos = 0;
+    while (isIdentifierChar(line[pos])) {
+        if (wordPos < maxLen - 1) word[wordPos++] = line[pos];
+        pos++;
+    }
+    word[wordPos] = '\0';
+}
+
+class Catalog {
+private:
+    TableSchema tables[MAX_TABLES];
+    int tableCount;
+    ViewSchema views[MAX_VIEWS];
+    int viewCount;
+
+public:
+    Catalog() : tableCount(1), viewCount(0) {
+        // The implicit table every statement used before named tables existed
+        safeCopyString(tables[0].name, "table", MAX_TABLE_NAME);
+        safeCopyString(tables[0].columns[0], "attr1", MAX_COLUMN_NAME);
+        safeCopyString(tables[0].columns[1], "attr2", MAX_COLUMN_NAME);
+        safeCopyString(tables[0].columns[2], "attr3", MAX_COLUMN_NAME);
+    }
+
+    int getTableCount() const {
+        return tableCount;
+    }
+
+    const TableSchema& getSchema(int table) const {
+        return tables[table];
+    }
+
+    int findTable(const char* name) const {
+        for (int i = 0; i < tableCount; ++i) {
+            if (safeCompareStrings(tables[i].name, name, MAX_TABLE_NAME)) return i;
+        }
+        return -1;
+    }
+
+    // Returns the new table's index, or -1 if the name is taken or the catalog is full
+    int createTable(const TableSchema& schema) {
+        if (tableCount >= MAX_TABLES || findTable(schema.name) >= 0 || findView(schema.name) >= 0) return -1;
+        tables[tableCount] = schema;
+        return tableCount++;
+    }
+
+    const ViewSchema& getView(int view) const {
+        return views[view];
+    }
+
+    int findView(const char* name) const {
+        for (int i = 0; i < viewCount; ++i) {
+            if (safeCompareStrings(views[i].name, name, MAX_TABLE_NAME)) return i;
+        }
+        return -1;
+    }
+
+    // Returns the new view's index, or -1 if the name is taken or the catalog
+    // is full. Numbers the view among those of its table.
+    int createView(ViewSchema& schema) {
+        if (viewCount >= MAX_VIEWS || findTable(schema.name) >= 0 || findView(schema.name) >= 0) return -1;
+        schema.tableView = 0;
+        for (int i = 0; i < viewCount; ++i) {
+            if (views[i].table == schema.table) schema.tableView++;
+        }
+        views[viewCount] = schema;
+        return viewCount++;
+    }
+
+    // Map a column name to its Tuple slot (1-3), or 0 if the table has no such column
+    int resolveColumn(int table, const char* name) const {
+        for (int i = 0; i < 3; ++i) {
+            if (safeCompareStrings(tables[table].columns[i], name, MAX_COLUMN_NAME)) return i + 1;
+        }
+        return 0;
+    }
+};
+
+// Parse "CREATE TABLE name (col1 [type], col2 [type], col3 [type])"
+inline bool parseCreateTable(const char* line, TableSchema& schema) {
+    int pos = findKeyword(line, "TABLE ");
+    if (pos < 0) return false;
+    pos += 6;
+    while (line[pos] == ' ') pos++;
+    readIdentifier(line, pos, schema.name, MAX_TABLE_NAME);
+    if (schema.name[0] == '\0') return false;
+
+    while (line[pos] != '\0' && line[pos] != '(') pos++;
+    int columnCount = 0;
+    while (line[pos] != '\0' && line[pos] != ')') {
+        pos++;  // Skip '(' or ','
+        while (line[pos] == ' ') pos++;
+        if (columnCount == 3) return false;
+        readIdentifier(line, pos, schema.columns[columnCount], MAX_COLUMN_NAME);
+        if (schema.columns[columnCount][0] == '\0') return false;
+        columnCount++;
+        // Column types are implied by position, skip anything up to the next column
+        while (line[pos] != '\0' && line[pos] != ',' && line[pos] != ')') pos++;
+    }
+    return columnCount == 3;
+}
+
+// Parse "CREATE MATERIALIZED VIEW name AS SELECT col, COUNT(*), SUM(col3) FROM
+// table GROUP BY col", where col is a text column of the table. The select
+// list takes the grouped column and the aggregates in any order.
+inline bool parseCreateView(const char* line, const Catalog& catalog, ViewSchema& schema) {
+    int pos = findKeyword(line, "VIEW ");
+    if (pos < 0) return false;
+    pos += 5;
+    while (line[pos] == ' ') pos++;
+    readIdentifier(line, pos, schema.name, MAX_TABLE_NAME);
+    if (schema.name[0] == '\0') return false;
+
+    int selectPos = findKeyword(line, "SELECT ");
+    int fromPos = findKeyword(line, " FROM ");
+    int groupPos = findKeyword(line, " GROUP BY ");
+    if (selectPos < 0 || fromPos < selectPos || groupPos < fromPos || findKeyword(line, " WHERE ") >= 0) return false;
+
+    char tableName[MAX_TABLE_NAME];
+    pos = fromPos + 6;
+    while (line[pos] == ' ') pos++;
+    readIdentifier(line, pos, tableName, MAX_TABLE_NAME);
+    schema.table = catalog.findTable(tableName);
+    if (schema.table < 0) return false;
+
+    char word[MAX_COLUMN_NAME];
+    pos = groupPos + 10;
+    while (line[pos] == ' ') pos++;
+    readIdentifier(line, pos, word, MAX_COLUMN_NAME);
+    schema.groupColumn = catalog.resolveColumn(schema.table, word);
+    if (schema.groupColumn != 1 && schema.groupColumn != 2) return false;
+
+    schema.columnCount = 0;
+    pos = selectPos + 7;
+    while (true) {
+        while (line[pos] == ' ' || line[pos] == ',') pos++;
+        if (pos >= fromPos) break;
+        if (schema.columnCount == MAX_VIEW_COLUMNS) return false;
+
+        readIdentifier(line, pos, word, MAX_COLUMN_NAME);
+        int& column = schema.columns[schema.columnCount++];
+        if (safeCompareStrings(word, "COUNT", MAX_COLUMN_NAME)) {
+            if (!safeCompareStrings(line + pos, "(*)", 3)) return false;
+            pos += 3;
+            column = VIEW_COUNT;
+        }
+        else if (safeCompareStrings(word, "SUM", MAX_COLUMN_NAME)) {
+            if (line[pos] != '(') return false;
+            pos++;
+            readIdentifier(line, pos, word, MAX_COLUMN_NAME);
+            if (catalog.resolveColumn(schema.table, word) != 3 || line[pos] != ')') return false;
+            pos++;
+            column = VIEW_SUM;
+        }
+        else if (word[0] != '\0' && catalog.resolveColumn(schema.table, word) == schema.groupColumn) {
+            column = VIEW_GROUP;
+        }
+        else {
+            return false;
+        }
+    }
+    return schema.columnCount > 0;
+}
+
+// The view a SELECT reads, or -1 if it reads a table
+inline int findStatementView(const char* command, const Catalog& catalog) {
+    int pos = findKeyword(command, "FROM ");
+    if (command[0] != 'S' || pos < 0) return -1;
+    pos += 5;
+    while (command[pos] == ' ') pos++;
+    char name[MAX_TABLE_NAME];
+    readIdentifier(command, pos, name, MAX_TABLE_NAME);
+    return catalog.findView(name);
+}
+
+// Find the table a statement targets and rewrite its column names into the
+// canonical attr1-attr3 names the statement parsers understand. Values
+// (anything right after '=') and INSERT value lists are left untouched.
+// Returns the table index, or -1 if the table does not exist.
+inline int normalizeStatement(char* command, const Catalog& catalog) {
+    const char* keyword = "FROM ";
+    if (command[0] == 'I') keyword = "INTO ";
+    else if (command[0] == 'U') keyword = "UPDATE ";
+
+    char tableName[MAX_TABLE_NAME];
+    safeCopyString(tableName, "table", MAX_TABLE_NAME);
+    int pos = findKeyword(command, keyword);
+    if (pos >= 0) {
+        pos += safeStringLength(keyword, MAX_COMMAND_LENGTH);
+        while (command[pos] == ' ') pos++;
+        readIdentifier(command, pos, tableName, MAX_TABLE_NAME);
+    }
+
+    int table = catalog.findTable(tableName);
+    if (table <= 0 || command[0] == 'I') return table;
+
+    char normalized[MAX_COMMAND_LENGTH];
+    char word[MAX_COMMAND_LENGTH];
+    int outPos = 0;
+    pos = 0;
+    bool afterEquals = false;
+    while (command[pos] != '\0' && outPos < MAX_COMMAND_LENGTH - 6) {
+        if (!isIdentifierChar(command[pos])) {
+            if (command[pos] != ' ') afterEquals = command[pos] == '=';
+            normalized[outPos++] = command[pos++];
+            continue;
+        }
+
+        readIdentifier(command, pos, word, MAX_COMMAND_LENGTH);
+        int column = afterEquals ? 0 : catalog.resolveColumn(table, word);
+        if (!afterEquals && command[pos] == '.' && safeCompareStrings(word, tableName, MAX_TABLE_NAME)) {
+            pos++;  // Drop the table qualifier
+            continue;
+        }
+        const char* replacement = word;
+        if (column == 1) replacement = "attr1";
+        else if (column == 2) replacement = "attr2";
+        else if (column == 3) replacement = "attr3";
+        for (int i = 0; replacement[i] != '\0' && outPos < MAX_COMMAND_LENGTH - 1; ++i) {
+            normalized[outPos++] = replacement[i];
+        }
+        afterEquals = false;
+    }
+    normalized[outPos] = '\0';
+    safeCopyString(command, normalized, MAX_COMMAND_LENGTH);
+    return table;
+}
+
+struct Tuple {
+    char attr1[MAX_ATTR_LENGTH];
+    char attr2[MAX_ATTR_LENGTH];
+    int attr3;
+
+    Tuple() {
+        attr1[0] = '\0';
+        attr2[0] = '\0';
+        attr3 = 0;
+    }
+
+    Tuple(const Tuple& other) {
+        safeCopyString(attr1, other.attr1, MAX_ATTR_LENGTH);
+        safeCopyString(attr2, other.attr2, MAX_ATTR_LENGTH);
+        attr3 = other.attr3;
+    }
+
+    Tuple& operator=(const Tuple& other) {
+        if (this != &other) {
+            safeCopyString(attr1, other.attr1, MAX_ATTR_LENGTH);
+            safeCopyString(attr2, other.attr2, MAX_ATTR_LENGTH);
+            attr3 = other.attr3;
+        }
+        return *this;
+    }
+};
+
+// Compare two tuples on one column (1-3 for attr1-attr3)
+inline int compareTuplesOn(const Tuple& a, const Tuple& b, int column) {
+    if (column == 1) return safeOrderStrings(a.attr1, b.attr1, MAX_ATTR_LENGTH);
+    if (column == 2) return safeOrderStrings(a.attr2, b.attr2, MAX_ATTR_LENGTH);
+    if (column == 3) return (a.attr3 > b.attr3) - (a.attr3 < b.attr3);
+    return 0;
+}
+
+// True if row a comes before row b in the query's ORDER BY order.
+// Ties fall back to the given positions so results stay deterministic.
+inline bool precedesInOrder(const Tuple& a, int aPos, const Tuple& b, int bPos, const SelectQuery& query) {
+    int cmp = compareTuplesOn(a, b, query.orderByColumn);
+    if (query.orderDescending) cmp = -cmp;
+    if (cmp != 0) return cmp < 0;
+    return aPos < bPos;
+}
+
+// Whether a tuple satisfies a SELECT's WHERE conditions
+inline bool tupleMatchesQuery(const Tuple& tuple, const SelectQuery& query) {
+    bool attr1Match = (safeStringLength(query.attr1Condition, MAX_ATTR_LENGTH) == 0) ||
+        (query.attr1Condition[0] == '*') ||
+        matchesPattern(tuple.attr1, query.attr1Condition, MAX_ATTR_LENGTH);
+
+    bool attr2Match = (safeStringLength(query.attr2Condition, MAX_ATTR_LENGTH) == 0) ||
+        (query.attr2Condition[0] == '*') ||
+        matchesPattern(tuple.attr2, query.attr2Condition, MAX_ATTR_LENGTH);
+
+    bool attr3Match = (query.attr3Condition == -1) || (tuple.attr3 == query.attr3Condition);
+
+    bool rangeMatch = tuple.attr3 >= query.attr3Low && tuple.attr3 <= query.attr3High;
+
+    return attr1Match && attr2Match && attr3Match && rangeMatch;
+}
+
+// Longest text one row can format to: both strings, attr3, separators and newline
+const int MAX_ROW_TEXT = 2 * MAX_ATTR_LENGTH + 20;
+
+// Growable text buffer that scans format their rows straight into. A row that
+// would take it past its limit is dropped whole, which is how a worker's SELECT
+// reply stays within MAX_RESULT_LENGTH.
+class ResultBuffer {
+private:
+    char* data;
+    int length;
+    int capacity;
+    int limit;
+
+    void reserve(int extra) {
+        if (length + extra <= capacity) return;
+        int newCapacity = capacity * 2;
+        while (newCapacity < length + extra) newCapacity *= 2;
+        char* newData = new char[newCapacity];
+        for (int i = 0; i < length; ++i) {
+            newData[i] = data[i];
+        }
+        delete[] data;
+        data = newData;
+        capacity = newCapacity;
+    }
+
+public:
+    explicit ResultBuffer(int limit = MAX_RESULT_LENGTH - 1) : length(0), capacity(256), limit(limit) {
+        data = new char[capacity];
+    }
+
+    ~ResultBuffer() {
+        delete[] data;
+    }
+
+    ResultBuffer(const ResultBuffer&) = delete;
+    ResultBuffer& operator=(const ResultBuffer&) = delete;
+
+    // Space for one row of up to maxRowLength bytes at the end of the text
+    char* beginRow(int maxRowLength) {
+        reserve(maxRowLength);
+        return data + length;
+    }
+
+    // Keep the row written at beginRow unless it goes past the limit
+    bool endRow(int rowLength) {
+        if (length + rowLength > limit) return false;
+        length += rowLength;
+        return true;
+    }
+
+    void clear() {
+        length = 0;
+    }
+
+    const char* getData() const {
+        return data;
+    }
+
+    int getLength() const {
+        return length;
+    }
+};
+
+// Write a number's decimal text to out, returning its length
+inline int formatInt(int value, char* out) {
+    char digits[12];
+    int count = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    int length = 0;
+    if (value < 0) out[length++] = '-';
+    while (count > 0) {
+        out[length++] = digits[--count];
+    }
+    return length;
+}
+
+// A SELECT's projection resolved once per query. Rows are printed as
+// "attr1, attr2, attr3" restricted to the selected columns, always in that
+// order, so formatting a row needs no column name compares.
+class RowFormat {
+private:
+    bool attr1;
+    bool attr2;
+    bool attr3;
+
+    static int copyAttr(const char* value, char* out) {
+        int j = 0;
+        while (j < MAX_ATTR_LENGTH && value[j] != '\0') {
+            out[j] = value[j];
+            j++;
+        }
+        return j;
+    }
+
+public:
+    RowFormat() : attr1(true), attr2(true), attr3(true) {}
+
+    explicit RowFormat(const SelectQuery& query)
+        : attr1(query.isColumnSelected("attr1")), attr2(query.isColumnSelected("attr2")),
+          attr3(query.isColumnSelected("attr3")) {}
+
+    // Append the row's text line; false if the buffer's limit dropped it
+    bool append(const Tuple& tuple, ResultBuffer& buffer) const {
+        char* out = buffer.beginRow(MAX_ROW_TEXT);
+        int pos = 0;
+
+        if (attr1) {
+            pos += copyAttr(tuple.attr1, out + pos);
+        }
+        if (attr2) {
+            if (attr1) {
+                out[pos++] = ',';
+                out[pos++] = ' ';
+            }
+            pos += copyAttr(tuple.attr2, out + pos);
+        }
+        if (attr3) {
+            if (attr1 || attr2) {
+                out[pos++] = ',';
+                out[pos++] = ' ';
+            }
+            pos += formatInt(tuple.attr3, out + pos);
+        }
+        out[pos++] = '\n';
+
+        return buffer.endRow(pos);
+    }
+};
+
+// Custom vector implementation
+template <typename T>
+class MyVector {
+private:
+    T* data;
+    int capacity;
+    int size;
+
+    void resize() {
+        int newCapacity = capacity * 2;
+        T* newData = new T[newCapacity];
+        for (int i = 0; i < size; ++i) {
+            newData[i] = data[i];
+        }
+        delete[] data;
+        data = newData;
+        capacity = newCapacity;
+    }
+
+public:
+    MyVector() : capacity(10), size(0) {
+        data = new T[capacity];
+    }
+
+    ~MyVector() {
+        delete[] data;
+    }
+
+    void push_back(const T& value) {
+        if (size == capacity) {
+            resize();
+        }
+        data[size++] = value;
+    }
+
+    T& operator[](int index) {
+        return data[index];
+    }
+
+    const T& operator[](int index) const {
+        return data[index];
+    }
+
+    int getSize() const {
+        return size;
+    }
+
+    T* getData() {
+        return data;
+    }
+
+    const T* getData() const {
+        return data;
+    }
+
+    // Grow or shrink to exactly newSize elements, e.g. before receiving into getData()
+    void setSize(int newSize) {
+        while (capacity < newSize) {
+            resize();
+        }
+        size = newSize;
+    }
+
+    void clear() {
+        size = 0;
+    }
+
+    void pop_back() {
+        if (size > 0) size--;
+    }
+};
+
+// Partition (worker index) that owns an attr3 value, or -1 if there is none
+inline int partitionOf(int attr3, int numWorkers) {
+    return attr3 >= 0 ? attr3 % numWorkers : -1;
+}
+
+// Work done by a table's scans, for the per-rank report
+struct ScanCounters {
+    long long rowsScanned;
+    long long rowsMatched;
+    long long blocksSkipped;  // Blocks passed over on their zone maps
+    long long spillReads;     // Reads of spilled segments back from disk
+    double formatSeconds;  // Part of the scan time spent formatting result text
+};
+
+// Value summaries: Bloom filters over the attr1 and attr2 values of a table's
+// live rows, which let the master skip partitions that cannot match an
+// equality predicate. A value sets SUMMARY_HASHES of the SUMMARY_BITS bits.
+// Workers count the live rows behind every bit so bits clear again as rows
+// go, and report the bits that flip on their UPDATE and DELETE replies.
+const int SUMMARY_BITS = 1 << 13;
+const int SUMMARY_HASHES = 3;
+
+// FNV-1a hash of a column's value
+inline unsigned int hashValue(int column, const char* value) {
+    unsigned int hash = 2166136261u ^ (unsigned int)column;
+    int length = safeStringLength(value, MAX_ATTR_LENGTH);
+    for (int i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char)value[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// The bits a column's value sets
+inline void summaryBitsOf(int column, const char* value, int* bits) {
+    unsigned int hash = hashValue(column, value);
+    unsigned int step = (hash >> 16 | hash << 16) | 1;
+    for (int i = 0; i < SUMMARY_HASHES; ++i) {
+        bits[i] = (int)((hash + i * step) % SUMMARY_BITS);
+    }
+}
+
+// A condition only one value can satisfy, so a summary can rule it out
+inline bool isExactCondition(const char* condition) {
+    int length = safeStringLength(condition, MAX_ATTR_LENGTH);
+    return length > 0 && condition[0] != '*' && condition[length - 1] != '*';
+}
+
+// The master's copy of a partition's summary
+class ValueSummary {
+private:
+    unsigned char bits[SUMMARY_BITS / 8];
+
+public:
+    ValueSummary() {
+        for (int i = 0; i < SUMMARY_BITS / 8; ++i) bits[i] = 0;
+    }
+
+    void add(int column, const char* value) {
+        int positions[SUMMARY_HASHES];
+        summaryBitsOf(column, value, positions);
+        for (int i = 0; i < SUMMARY_HASHES; ++i) bits[positions[i] / 8] |= 1 << (positions[i] % 8);
+    }
+
+    void addRow(const Tuple& row) {
+        add(1, row.attr1);
+        add(2, row.attr2);
+    }
+
+    // A change reported by a worker: bit + 1 when it was set, -(bit + 1) when cleared
+    void apply(int change) {
+        int bit = (change > 0 ? change : -change) - 1;
+        if (change > 0) bits[bit / 8] |= 1 << (bit % 8);
+        else bits[bit / 8] &= ~(1 << (bit % 8));
+    }
+
+    // False only if no live row can hold the value
+    bool mayContain(int column, const char* value) const {
+        int positions[SUMMARY_HASHES];
+        summaryBitsOf(column, value, positions);
+        for (int i = 0; i < SUMMARY_HASHES; ++i) {
+            if (!(bits[positions[i] / 8] & (1 << (positions[i] % 8)))) return false;
+        }
+        return true;
+    }
+
+    // False if the partition has no row matching both conditions' values
+    bool mayMatch(const char* attr1Condition, const char* attr2Condition) const {
+        if (isExactCondition(attr1Condition) && !mayContain(1, attr1Condition)) return false;
+        if (isExactCondition(attr2Condition) && !mayContain(2, attr2Condition)) return false;
+        return true;
+    }
+};
+
+// A worker's summary of one table: live rows per bit, and the bits that
+// flipped since the master last heard
+class CountingSummary {
+private:
+    int* counts;
+    MyVector<int> changes;
+
+    void count(int column, const char* value, int delta) {
+        int positions[SUMMARY_HASHES];
+        summaryBitsOf(column, value, positions);
+        for (int i = 0; i < SUMMARY_HASHES; ++i) {
+            int bit = positions[i];
+            counts[bit] += delta;
+            if (delta > 0 && counts[bit] == 1) changes.push_back(bit + 1);
+            else if (delta < 0 && counts[bit] == 0) changes.push_back(-(bit + 1));
+        }
+    }
+
+public:
+    CountingSummary() {
+        counts = new int[SUMMARY_BITS]();
+    }
+
+    ~CountingSummary() {
+        delete[] counts;
+    }
+
+    CountingSummary(const CountingSummary&) = delete;
+    CountingSummary& operator=(const CountingSummary&) = delete;
+
+    void addRow(const Tuple& row) {
+        count(1, row.attr1, 1);
+        count(2, row.attr2, 1);
+    }
+
+    void removeRow(const Tuple& row) {
+        count(1, row.attr1, -1);
+        count(2, row.attr2, -1);
+    }
+
+    const MyVector<int>& getChanges() const {
+        return changes;
+    }
+
+    void clearChanges() {
+        changes.clear();
+    }
+};
+
+const int LATEST_SNAPSHOT = -1;        // Read everything committed so far
+const int NO_VERSION = INT_MAX;        // End stamp of a row version nothing has replaced
+const int GC_MIN_DEAD_ROWS = 1 << 14;  // Dead versions worth a compaction, if also a quarter of the rows
+
+// Zone maps: stored rows are grouped into blocks of ZONE_ROWS, each with a
+// synopsis of the row versions in it. A scan passes over a block whose attr3
+// range, attr1/attr2 bitmaps or live count show it cannot hold a match.
+// Synopses only widen as rows are added; collectGarbage rebuilds them tight.
+const int ZONE_ROWS = 4096;
+
+struct ZoneMap {
+    int minAttr3;
+    int maxAttr3;
+    unsigned long long attr1Bits;  // One hashed bit per attr1 value in the block
+    unsigned long long attr2Bits;
+    int liveRows;
+    int lastEnd;  // Latest version a row of the block was ended in
+};
+
+// The bitmap bit a value sets in a zone map
+inline unsigned long long zoneBitOf(int column, const char* value) {
+    int bits[SUMMARY_HASHES];
+    summaryBitsOf(column, value, bits);
+    return 1ull << (bits[0] % 64);
+}
+
+// What a scan's conditions need from a block, resolved once per scan
+struct ZoneFilter {
+    unsigned long long attr1Bit;  // 0 unless attr1 has an exact condition
+    unsigned long long attr2Bit;
+    int attr3Low;
+    int attr3High;
+
+    // Only passes over fully deleted blocks
+    ZoneFilter() : attr1Bit(0), attr2Bit(0), attr3Low(INT_MIN), attr3High(INT_MAX) {}
+
+    ZoneFilter(const char* attr1Condition, const char* attr2Condition, int attr3Condition)
+        : attr1Bit(0), attr2Bit(0), attr3Low(INT_MIN), attr3High(INT_MAX) {
+        if (isExactCondition(attr1Condition)) attr1Bit = zoneBitOf(1, attr1Condition);
+        if (isExactCondition(attr2Condition)) attr2Bit = zoneBitOf(2, attr2Condition);
+        if (attr3Condition != -1) {
+            attr3Low = attr3Condition;
+            attr3High = attr3Condition;
+        }
+    }
+
+    explicit ZoneFilter(const SelectQuery& query)
+        : ZoneFilter(query.attr1Condition, query.attr2Condition, query.attr3Condition) {
+        if (query.attr3Low > attr3Low) attr3Low = query.attr3Low;
+        if (query.attr3High < attr3High) attr3High = query.attr3High;
+    }
+};
+
+// Compressed segments: once a block of ZONE_ROWS rows is full it can be sealed
+// into a Segment, which frees its Tuple array. Row data never changes after it
+// is written (UPDATE appends a new version), so a sealed block only goes back
+// to plain rows when collectGarbage compacts it. attr1 and attr2 are dictionary
+// coded and attr3 is coded as its offset from the block's minimum; each column
+// of codes is then bit-packed or, when that is smaller, run-length coded.
+const int RUN_END_BITS = 13;  // Holds a run's end position, at most ZONE_ROWS
+
+// Bits needed to store codes up to maxCode
+inline int bitWidth(unsigned int maxCode) {
+    int width = 0;
+    while (width < 32 && (maxCode >> width) != 0) width++;
+    return width;
+}
+
+inline unsigned int readBits(const unsigned long long* words, long long bit, int width) {
+    if (width == 0) return 0;
+    long long word = bit / 64;
+    int offset = (int)(bit % 64);
+    unsigned long long value = words[word] >> offset;
+    if (offset + width > 64) value |= words[word + 1] << (64 - offset);
+    return (unsigned int)(value & ((1ull << width) - 1));
+}
+
+// Store value at bit in zeroed words
+inline void writeBits(unsigned long long* words, long long bit, int width, unsigned int value) {
+    if (width == 0) return;
+    long long word = bit / 64;
+    int offset = (int)(bit % 64);
+    words[word] |= (unsigned long long)value << offset;
+    if (offset + width > 64) words[word + 1] |= (unsigned long long)value >> (64 - offset);
+}
+
+// Spilled segments are stored as their fields' bytes in memory layout; the
+// file is read back only by the process that wrote it
+template <typename T>
+inline void appendRaw(std::string& record, const T* values, int count) {
+    record.append((const char*)values, (size_t)count * sizeof(T));
+}
+
+// Read count values saved by appendRaw; returns the position just past them
+template <typename T>
+inline const char* readRaw(const char* record, T* values, int count) {
+    memcpy(values, record, (size_t)count * sizeof(T));
+    return record + (size_t)count * sizeof(T);
+}
+
+// A column of unsigned codes. Bit-packed, code i is at bit i * width;
+// run-length coded, the run values come first and then their end positions.
+class PackedColumn {
+private:
+    unsigned long long* words;
+    int wordCount;
+    int count;
+    int width;     // Bits per code
+    int runCount;  // 0 when bit-packed
+
+    // Position just past the last code of a run
+    int runEnd(int run) const {
+        return (int)readBits(words, (long long)runCount * width + (long long)run * RUN_END_BITS, RUN_END_BITS);
+    }
+
+public:
+    PackedColumn() : words(nullptr), wordCount(0), count(0), width(0), runCount(0) {}
+
+    ~PackedColumn() {
+        delete[] words;
+    }
+
+    PackedColumn(const PackedColumn&) = delete;
+    PackedColumn& operator=(const PackedColumn&) = delete;
+
+    void encode(const unsigned int* codes, int codeCount) {
+        unsigned int maxCode = 0;
+        int runs = 0;
+        for (int i = 0; i < codeCount; ++i) {
+            if (codes[i] > maxCode) maxCode = codes[i];
+            if (i == 0 || codes[i] != codes[i - 1]) runs++;
+        }
+        count = codeCount;
+        width = bitWidth(maxCode);
+        long long packedBits = (long long)count * width;
+        long long runBits = (long long)runs * (width + RUN_END_BITS);
+        runCount = runBits < packedBits ? runs : 0;
+
+        delete[] words;
+        wordCount = (int)((runCount > 0 ? runBits : packedBits) / 64 + 1);
+        words = new unsigned long long[wordCount]();
+        if (runCount == 0) {
+            for (int i = 0; i < count; ++i) {
+                writeBits(words, (long long)i * width, width, codes[i]);
+            }
+            return;
+        }
+
+        int run = 0;
+        for (int i = 0; i < count; ++i) {
+            if (i + 1 < count && codes[i + 1] == codes[i]) continue;
+            writeBits(words, (long long)run * width, width, codes[i]);
+            writeBits(words, (long long)runCount * width + (long long)run * RUN_END_BITS, RUN_END_BITS, i + 1);
+            run++;
+        }
+    }
+
+    unsigned int get(int pos) const {
+        if (runCount == 0) return readBits(words, (long long)pos * width, width);
+
+        // The first run that ends after pos
+        int low = 0;
+        int high = runCount - 1;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (runEnd(middle) > pos) high = middle;
+            else low = middle + 1;
+        }
+        return readBits(words, (long long)low * width, width);
+    }
+
+    // Unpack every code into codes
+    void decode(unsigned int* codes) const {
+        if (runCount == 0) {
+            for (int i = 0; i < count; ++i) {
+                codes[i] = readBits(words, (long long)i * width, width);
+            }
+            return;
+        }
+
+        int pos = 0;
+        for (int run = 0; run < runCount; ++run) {
+            unsigned int code = readBits(words, (long long)run * width, width);
+            int end = runEnd(run);
+            while (pos < end) codes[pos++] = code;
+        }
+    }
+
+    long long getBytes() const {
+        return (long long)wordCount * sizeof(unsigned long long);
+    }
+
+    void save(std::string& record) const {
+        int fields[4] = { wordCount, count, width, runCount };
+        appendRaw(record, fields, 4);
+        appendRaw(record, words, wordCount);
+    }
+
+    // Read a column saved by save; returns the position just past it
+    const char* load(const char* record) {
+        int fields[4];
+        record = readRaw(record, fields, 4);
+        wordCount = fields[0];
+        count = fields[1];
+        width = fields[2];
+        runCount = fields[3];
+        delete[] words;
+        words = new unsigned long long[wordCount];
+        return readRaw(record, words, wordCount);
+    }
+};
+
+inline const char* columnText(const Tuple& row, int column) {
+    return column == 1 ? row.attr1 : row.attr2;
+}
+
+// The distinct values of a segment's string column, numbered in order of first use
+class StringDictionary {
+private:
+    char* chars;
+    int* starts;
+    int count;
+    int length;  // Of chars, terminators included
+
+public:
+    StringDictionary() : chars(nullptr), starts(nullptr), count(0), length(0) {}
+
+    ~StringDictionary() {
+        delete[] chars;
+        delete[] starts;
+    }
+
+    StringDictionary(const StringDictionary&) = delete;
+    StringDictionary& operator=(const StringDictionary&) = delete;
+
+    // Take value number c from the column of rows[firstRows[c]]
+    void build(const Tuple* rows, const MyVector<int>& firstRows, int column) {
+        count = firstRows.getSize();
+        starts = new int[count];
+        length = 0;
+        for (int c = 0; c < count; ++c) {
+            starts[c] = length;
+            length += safeStringLength(columnText(rows[firstRows[c]], column), MAX_ATTR_LENGTH) + 1;
+        }
+        chars = new char[length];
+        for (int c = 0; c < count; ++c) {
+            safeCopyString(chars + starts[c], columnText(rows[firstRows[c]], column), MAX_ATTR_LENGTH);
+        }
+    }
+
+    const char* get(int code) const {
+        return chars + starts[code];
+    }
+
+    int getSize() const {
+        return count;
+    }
+
+    long long getBytes() const {
+        return length + (long long)count * sizeof(int);
+    }
+
+    void save(std::string& record) const {
+        int fields[2] = { count, length };
+        appendRaw(record, fields, 2);
+        appendRaw(record, starts, count);
+        appendRaw(record, chars, length);
+    }
+
+    // Read a dictionary saved by save; returns the position just past it
+    const char* load(const char* record) {
+        int fields[2];
+        record = readRaw(record, fields, 2);
+        count = fields[0];
+        length = fields[1];
+        starts = new int[count];
+        chars = new char[length];
+        record = readRaw(record, starts, count);
+        return readRaw(record, chars, length);
+    }
+};
+
+// Out-of-core storage: under a memory budget the segments scans read least
+// recently are written to the table's spill file and freed. A scan reads a
+// spilled segment back into its scratch, taking SPILL_READ_AHEAD bytes of the
+// file at a time; segments of one scan go out in block order, so that usually
+// holds the blocks it reads next.
+const int SPILL_READ_AHEAD = 1 << 20;
+
+class Segment;
+
+// Working space of a scan over sealed blocks
+struct SegmentScratch {
+    unsigned int codes[ZONE_ROWS];
+    bool accept[ZONE_ROWS];  // Whether each dictionary code meets a condition
+    Tuple row;               // The sealed row last decoded
+    long long startTime;     // Stamped on the resident segments the scan reads
+    Segment* loaded;         // The spilled segment of block loadedBlock, read back
+    int loadedBlock;
+    std::ifstream spillFile;
+    std::string readAhead;     // Spill file bytes from readAheadStart on
+    long long readAheadStart;
+
+    SegmentScratch()
+        : startTime(std::chrono::steady_clock::now().time_since_epoch().count()), loaded(nullptr), loadedBlock(-1),
+          readAheadStart(0) {}
+
+    ~SegmentScratch();
+
+    SegmentScratch(const SegmentScratch&) = delete;
+    SegmentScratch& operator=(const SegmentScratch&) = delete;
+};
+
+// The rows of a sealed block
+class Segment {
+private:
+    StringDictionary attr1Values;
+    StringDictionary attr2Values;
+    int attr3Base;  // attr3 is stored as its offset from this
+    PackedColumn attr1Codes;
+    PackedColumn attr2Codes;
+    PackedColumn attr3Codes;
+
+    // Give each distinct value of a string column a code and store the rows' codes
+    static void encodeStrings(const Tuple* rows, int count, int column, StringDictionary& values, PackedColumn& codes,
+        unsigned int* rowCodes) {
+        // Open addressing over the codes given out so far
+        int slotCount = 2 * count;
+        int* slots = new int[slotCount];
+        for (int s = 0; s < slotCount; ++s) slots[s] = -1;
+        MyVector<int> firstRows;
+
+        for (int i = 0; i < count; ++i) {
+            const char* value = columnText(rows[i], column);
+            int slot = (int)(hashValue(column, value) % (unsigned int)slotCount);
+            while (slots[slot] >= 0 &&
+                !safeCompareStrings(columnText(rows[firstRows[slots[slot]]], column), value, MAX_ATTR_LENGTH)) {
+                slot = (slot + 1) % slotCount;
+            }
+            if (slots[slot] < 0) {
+                slots[slot] = firstRows.getSize();
+                firstRows.push_back(i);
+            }
+            rowCodes[i] = slots[slot];
+        }
+
+        values.build(rows, firstRows, column);
+        codes.encode(rowCodes, count);
+        delete[] slots;
+    }
+
+    // Keep the positions whose code the condition accepts. The condition is
+    // tested once per distinct value, the rows only by their codes.
+    static void keepStrings(const char* condition, const StringDictionary& values, const PackedColumn& codes,
+        MyVector<int>& positions, SegmentScratch& scratch) {
+        if (safeStringLength(condition, MAX_ATTR_LENGTH) == 0 || condition[0] == '*') return;
+
+        bool anyAccepted = false;
+        for (int code = 0; code < values.getSize(); ++code) {
+            scratch.accept[code] = matchesPattern(values.get(code), condition, MAX_ATTR_LENGTH);
+            anyAccepted = anyAccepted || scratch.accept[code];
+        }
+        if (!anyAccepted) {
+            positions.clear();
+            return;
+        }
+
+        codes.decode(scratch.codes);
+        int kept = 0;
+        for (int p = 0; p < positions.getSize(); ++p) {
+            if (scratch.accept[scratch.codes[positions[p]]]) positions[kept++] = positions[p];
+        }
+        positions.setSize(kept);
+    }
+
+public:
+    Segment(const Tuple* rows, int count) {
+        unsigned int* rowCodes = new unsigned int[count];
+        encodeStrings(rows, count, 1, attr1Values, attr1Codes, rowCodes);
+        encodeStrings(rows, count, 2, attr2Values, attr2Codes, rowCodes);
+
+        attr3Base = rows[0].attr3;
+        for (int i = 1; i < count; ++i) {
+            if (rows[i].attr3 < attr3Base) attr3Base = rows[i].attr3;
+        }
+        for (int i = 0; i < count; ++i) {
+            rowCodes[i] = (unsigned int)rows[i].attr3 - (unsigned int)attr3Base;
+        }
+        attr3Codes.encode(rowCodes, count);
+        delete[] rowCodes;
+    }
+
+    // Read a segment saved by save
+    explicit Segment(const char* record) {
+        record = attr1Values.load(record);
+        record = attr2Values.load(record);
+        record = readRaw(record, &attr3Base, 1);
+        record = attr1Codes.load(record);
+        record = attr2Codes.load(record);
+        attr3Codes.load(record);
+    }
+
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    void save(std::string& record) const {
+        attr1Values.save(record);
+        attr2Values.save(record);
+        appendRaw(record, &attr3Base, 1);
+        attr1Codes.save(record);
+        attr2Codes.save(record);
+        attr3Codes.save(record);
+    }
+
+    // Decode one column (1-3 for attr1-attr3) of the row at pos
+    void decodeColumn(int pos, int column, Tuple& row) const {
+        if (column == 1) safeCopyString(row.attr1, attr1Values.get(attr1Codes.get(pos)), MAX_ATTR_LENGTH);
+        else if (column == 2) safeCopyString(row.attr2, attr2Values.get(attr2Codes.get(pos)), MAX_ATTR_LENGTH);
+        else row.attr3 = (int)((unsigned int)attr3Base + attr3Codes.get(pos));
+    }
+
+    void decodeRow(int pos, Tuple& row) const {
+        decodeColumn(pos, 1, row);
+        decodeColumn(pos, 2, row);
+        decodeColumn(pos, 3, row);
+    }
+
+    // Keep the positions whose row meets the query's conditions; filter holds
+    // its attr3 conditions as one range
+    void filter(const SelectQuery& query, const ZoneFilter& filter, MyVector<int>& positions, SegmentScratch& scratch) const {
+        keepStrings(query.attr1Condition, attr1Values, attr1Codes, positions, scratch);
+        keepStrings(query.attr2Condition, attr2Values, attr2Codes, positions, scratch);
+        if (positions.getSize() == 0 || (filter.attr3Low == INT_MIN && filter.attr3High == INT_MAX)) return;
+
+        // The range as offsets from the base
+        long long low = (long long)filter.attr3Low - attr3Base;
+        long long high = (long long)filter.attr3High - attr3Base;
+        if (low < 0) low = 0;
+        if (high < low) {
+            positions.clear();
+            return;
+        }
+        attr3Codes.decode(scratch.codes);
+        int kept = 0;
+        for (int p = 0; p < positions.getSize(); ++p) {
+            long long code = scratch.codes[positions[p]];
+            if (code >= low && code <= high) positions[kept++] = positions[p];
+        }
+        positions.setSize(kept);
+    }
+
+    long long getBytes() const {
+        return (long long)sizeof(Segment) + attr1Values.getBytes() + attr2Values.getBytes() +
+            attr1Codes.getBytes() + attr2Codes.getBytes() + attr3Codes.getBytes();
+    }
+};
+
+inline SegmentScratch::~SegmentScratch() {
+    delete loaded;
+}
+
+// One group of a materialized view: the live rows holding a value and the sum of their attr3
+struct GroupRow {
+    char value[MAX_ATTR_LENGTH];
+    long long count;
+    long long sum;
+};
+
+// A partition's part of a materialized view: the live rows per value of one
+// text column, updated as rows are added and removed. A group stays once it
+// has been created; empty ones are not reported.
+class GroupedCounts {
+private:
+    int column;  // 1 or 2
+    MyVector<GroupRow> groups;
+    int* slots;  // Open addressing over groups, -1 when free
+    int slotCount;
+
+    // The slot holding value, or the free slot it would go in
+    int findSlot(const char* value) const {
+        int slot = (int)(hashValue(column, value) % (unsigned int)slotCount);
+        while (slots[slot] >= 0 && !safeCompareStrings(groups[slots[slot]].value, value, MAX_ATTR_LENGTH)) {
+            slot = (slot + 1) % slotCount;
+        }
+        return slot;
+    }
+
+    void rehash(int newSlotCount) {
+        delete[] slots;
+        slotCount = newSlotCount;
+        slots = new int[slotCount];
+        for (int s = 0; s < slotCount; ++s) slots[s] = -1;
+        for (int g = 0; g < groups.getSize(); ++g) {
+            slots[findSlot(groups[g].value)] = g;
+        }
+    }
+
+    GroupRow& groupOf(const char* value) {
+        int slot = findSlot(value);
+        if (slots[slot] >= 0) return groups[slots[slot]];
+
+        // Kept at most half full
+        if (2 * (groups.getSize() + 1) > slotCount) {
+            rehash(2 * slotCount);
+            slot = findSlot(value);
+        }
+        GroupRow group;
+        safeCopyString(group.value, value, MAX_ATTR_LENGTH);
+        group.count = 0;
+        group.sum = 0;
+        slots[slot] = groups.getSize();
+        groups.push_back(group);
+        return groups[groups.getSize() - 1];
+    }
+
+public:
+    explicit GroupedCounts(int groupColumn) : column(groupColumn), slots(nullptr) {
+        rehash(64);
+    }
+
+    ~GroupedCounts() {
+        delete[] slots;
+    }
+
+    GroupedCounts(const GroupedCounts&) = delete;
+    GroupedCounts& operator=(const GroupedCounts&) = delete;
+
+    void addRow(const Tuple& row) {
+        GroupRow& group = groupOf(columnText(row, column));
+        group.count++;
+        group.sum += row.attr3;
+    }
+
+    void removeRow(const Tuple& row) {
+        GroupRow& group = groupOf(columnText(row, column));
+        group.count--;
+        group.sum -= row.attr3;
+    }
+
+    // Append the groups that hold rows
+    void collect(MyVector<GroupRow>& result) const {
+        for (int g = 0; g < groups.getSize(); ++g) {
+            if (groups[g].count > 0) result.push_back(groups[g]);
+        }
+    }
+};
+
+// Rows kept by an ORDER BY / LIMIT scan. They are copied in, so a sealed row
+// is decoded once however often the heap compares it.
+struct RowHeap {
+    MyVector<int> order;   // Slots in heap order, the row that comes last in ORDER BY order on top
+    MyVector<Tuple> rows;  // Kept rows by slot
+    MyVector<int> rowIds;  // Record number of each slot, which breaks ties
+
+    bool precedes(int a, int b, const SelectQuery& query) const {
+        return precedesInOrder(rows[a], rowIds[a], rows[b], rowIds[b], query);
+    }
+};
+
+// Rows are versioned: every write statement commits a new version number, and
+// each stored row version carries the version that created it and the one that
+// deleted or replaced it. A scan reads the rows visible at a snapshot version,
+// so it can run on one thread while writes are applied on another. UPDATE
+// appends a new version of the row instead of overwriting it, which keeps the
+// bytes a running scan reads stable. Dead versions are reclaimed by
+// collectGarbage once no scan is running.
+class Database {
+private:
+    Tuple** blocks;     // Rows of each unsealed block, allocated as it fills
+    Segment** segments; // Rows of each sealed block held in memory
+    int blockCount;
+    int sealedBlocks;   // Blocks below this are sealed; changed only while no scan runs
+    long long* lastScanned;   // When a scan last read each resident segment, in steady clock ticks
+    long long* spillOffsets;  // Where each spilled segment starts in the spill file, -1 if not spilled
+    int* spillLengths;
+    int spilledBlocks;
+    long long spilledBytes;
+    long long spillEnd;       // Bytes of the spill file in use
+    std::string spillPath;    // Segments are only spilled once the table has a file
+    std::fstream spillFile;
+    long long residentBytes;  // Row data in memory, sealed or not
+    int* rowIds;        // Record number shown in UPDATE/DELETE output, kept across versions
+    int* beginVersion;  // First version the row is visible in
+    int* endVersion;    // First version it is no longer visible in; read while being written
+    int capacity;
+    std::atomic<int> size;  // Published after a new row is complete
+    int version;            // Last committed write
+    int nextRowId;
+    int liveRows;
+    int deadRows;           // Ended versions not yet reclaimed
+    ZoneMap* zones;         // One per block of ZONE_ROWS stored rows; read while being written
+    CountingSummary summary;  // attr1/attr2 values of the live rows
+    MyVector<GroupedCounts*> views;  // Materialized views over the table, kept as rows come and go
+    mutable std::mutex countersLock;
+    mutable ScanCounters counters;
+
+    // Read spilled block's segment into scratch, from the bytes read ahead
+    // when it is among them
+    void loadSpilled(int block, SegmentScratch& scratch) const {
+        delete scratch.loaded;
+        scratch.loaded = nullptr;
+        long long offset = spillOffsets[block];
+        int length = spillLengths[block];
+        if (offset < scratch.readAheadStart || offset + length > scratch.readAheadStart + (long long)scratch.readAhead.size()) {
+            long long wanted = length > SPILL_READ_AHEAD ? length : SPILL_READ_AHEAD;
+            if (wanted > spillEnd - offset) wanted = spillEnd - offset;
+            if (!scratch.spillFile.is_open()) scratch.spillFile.open(spillPath, std::ios::in | std::ios::binary);
+            scratch.readAhead.resize(wanted);
+            scratch.spillFile.clear();
+            scratch.spillFile.seekg(offset);
+            scratch.spillFile.read(&scratch.readAhead[0], wanted);
+            if (scratch.spillFile.gcount() != wanted) {
+                // The rows exist nowhere else
+                std::cerr << "Error: could not read spilled rows from " << spillPath << "\n";
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            scratch.readAheadStart = offset;
+            std::lock_guard<std::mutex> lock(countersLock);
+            counters.spillReads++;
+        }
+        scratch.loaded = new Segment(scratch.readAhead.data() + (offset - scratch.readAheadStart));
+        scratch.loadedBlock = block;
+    }
+
+    // The segment of a sealed block, read back into scratch if it is spilled
+    const Segment* segmentFor(int block, SegmentScratch& scratch) const {
+        if (segments[block] == nullptr) {
+            if (scratch.loadedBlock != block) loadSpilled(block, scratch);
+            return scratch.loaded;
+        }
+        std::atomic_ref<long long> used(lastScanned[block]);
+        if (used.load(std::memory_order_relaxed) < scratch.startTime) used.store(scratch.startTime, std::memory_order_relaxed);
+        return segments[block];
+    }
+
+    // Row i, decoded into scratch if its block is sealed
+    const Tuple& rowAt(int i, SegmentScratch& scratch) const {
+        int block = i / ZONE_ROWS;
+        if (block < sealedBlocks) {
+            segmentFor(block, scratch)->decodeRow(i % ZONE_ROWS, scratch.row);
+            return scratch.row;
+        }
+        return blocks[block][i % ZONE_ROWS];
+    }
+
+    int endOf(int i) const {
+        return std::atomic_ref<int>(endVersion[i]).load(std::memory_order_relaxed);
+    }
+
+    bool isVisible(int i, int snapshot) const {
+        return beginVersion[i] <= snapshot && endOf(i) > snapshot;
+    }
+
+    int resolve(int snapshot) const {
+        return snapshot == LATEST_SNAPSHOT ? version : snapshot;
+    }
+
+    // Rows a scan has to look at: everything published when it starts
+    int storedRows() const {
+        return size.load(std::memory_order_acquire);
+    }
+
+    void resetZone(int block) {
+        ZoneMap& zone = zones[block];
+        zone.minAttr3 = INT_MAX;
+        zone.maxAttr3 = INT_MIN;
+        zone.attr1Bits = 0;
+        zone.attr2Bits = 0;
+        zone.liveRows = 0;
+        zone.lastEnd = 0;
+    }
+
+    // Widen row i's block to cover it. Scans of the block may be running, so
+    // every field is written atomically and before the row is published.
+    void addToZone(int i, const Tuple& row) {
+        ZoneMap& zone = zones[i / ZONE_ROWS];
+        if (i % ZONE_ROWS == 0) resetZone(i / ZONE_ROWS);
+        if (row.attr3 < zone.minAttr3) std::atomic_ref<int>(zone.minAttr3).store(row.attr3, std::memory_order_relaxed);
+        if (row.attr3 > zone.maxAttr3) std::atomic_ref<int>(zone.maxAttr3).store(row.attr3, std::memory_order_relaxed);
+        std::atomic_ref<unsigned long long>(zone.attr1Bits).store(zone.attr1Bits | zoneBitOf(1, row.attr1), std::memory_order_relaxed);
+        std::atomic_ref<unsigned long long>(zone.attr2Bits).store(zone.attr2Bits | zoneBitOf(2, row.attr2), std::memory_order_relaxed);
+        std::atomic_ref<int>(zone.liveRows).store(zone.liveRows + 1, std::memory_order_relaxed);
+    }
+
+    // The last end stamp is stored before the live count it empties, so a
+    // scan that sees no live rows also sees when the last one went
+    void removeFromZone(int i, int writeVersion) {
+        ZoneMap& zone = zones[i / ZONE_ROWS];
+        if (writeVersion > zone.lastEnd) std::atomic_ref<int>(zone.lastEnd).store(writeVersion, std::memory_order_relaxed);
+        std::atomic_ref<int>(zone.liveRows).store(zone.liveRows - 1, std::memory_order_release);
+    }
+
+    // False if no row of the block can be visible at the snapshot and pass the filter
+    bool blockMayMatch(int block, const ZoneFilter& filter, int snapshot) const {
+        ZoneMap& zone = zones[block];
+        if (std::atomic_ref<int>(zone.liveRows).load(std::memory_order_acquire) == 0 &&
+            std::atomic_ref<int>(zone.lastEnd).load(std::memory_order_relaxed) <= snapshot) return false;
+        if (filter.attr3High < std::atomic_ref<int>(zone.minAttr3).load(std::memory_order_relaxed) ||
+            filter.attr3Low > std::atomic_ref<int>(zone.maxAttr3).load(std::memory_order_relaxed)) return false;
+        if (filter.attr1Bit != 0 &&
+            !(std::atomic_ref<unsigned long long>(zone.attr1Bits).load(std::memory_order_relaxed) & filter.attr1Bit)) return false;
+        if (filter.attr2Bit != 0 &&
+            !(std::atomic_ref<unsigned long long>(zone.attr2Bits).load(std::memory_order_relaxed) & filter.attr2Bit)) return false;
+        return true;
+    }
+
+    // Positions within a block of its rows visible at the snapshot
+    void visibleRows(int block, int rows, int snapshot, MyVector<int>& positions, ScanCounters& work) const {
+        positions.clear();
+        int first = block * ZONE_ROWS;
+        int last = rows - first < ZONE_ROWS ? rows : first + ZONE_ROWS;
+        for (int i = first; i < last; ++i) {
+            if (isVisible(i, snapshot)) positions.push_back(i - first);
+        }
+        work.rowsScanned += positions.getSize();
+    }
+
+    // Positions within a block of its rows visible at the snapshot that match
+    // the query; none if the block's zone map rules it out. Sealed rows are
+    // matched on their codes without being decoded.
+    void findMatches(int block, int rows, const SelectQuery& query, const ZoneFilter& filter, int snapshot,
+        MyVector<int>& matches, SegmentScratch& scratch, ScanCounters& work) const {
+        matches.clear();
+        if (!blockMayMatch(block, filter, snapshot)) {
+            work.blocksSkipped++;
+            return;
+        }
+        if (block < sealedBlocks) {
+            visibleRows(block, rows, snapshot, matches, work);
+            if (matches.getSize() > 0) segmentFor(block, scratch)->filter(query, filter, matches, scratch);
+            return;
+        }
+
+        const Tuple* blockRows = blocks[block];
+        int first = block * ZONE_ROWS;
+        int last = rows - first < ZONE_ROWS ? rows : first + ZONE_ROWS;
+        for (int i = first; i < last; ++i) {
+            if (!isVisible(i, snapshot)) continue;
+            work.rowsScanned++;
+            if (tupleMatchesQuery(blockRows[i - first], query)) matches.push_back(i - first);
+        }
+    }
+
+    // The WHERE conditions of an UPDATE or DELETE as a query
+    static void whereQuery(const char* attr1, const char* attr2, int attr3, SelectQuery& where) {
+        safeCopyString(where.attr1Condition, attr1, MAX_ATTR_LENGTH);
+        safeCopyString(where.attr2Condition, attr2, MAX_ATTR_LENGTH);
+        where.attr3Condition = attr3;
+    }
+
+    // Append a row version created by writeVersion; false if the table is full
+    bool appendRow(const char* attr1, const char* attr2, int attr3, int rowId, int writeVersion) {
+        int n = size.load(std::memory_order_relaxed);
+        if (n >= capacity) return false;
+
+        int block = n / ZONE_ROWS;
+        if (blocks[block] == nullptr) {
+            blocks[block] = new Tuple[ZONE_ROWS];
+            residentBytes += (long long)ZONE_ROWS * sizeof(Tuple);
+        }
+        Tuple& row = blocks[block][n % ZONE_ROWS];
+        safeCopyString(row.attr1, attr1, MAX_ATTR_LENGTH);
+        safeCopyString(row.attr2, attr2, MAX_ATTR_LENGTH);
+        row.attr3 = attr3;
+        rowIds[n] = rowId;
+        beginVersion[n] = writeVersion;
+        endVersion[n] = NO_VERSION;
+        addToZone(n, row);
+        size.store(n + 1, std::memory_order_release);
+        liveRows++;
+        summary.addRow(row);
+        for (int v = 0; v < views.getSize(); ++v) views[v]->addRow(row);
+        return true;
+    }
+
+    // Delete or replace row version i as of writeVersion
+    void endRow(int i, const Tuple& row, int writeVersion) {
+        std::atomic_ref<int>(endVersion[i]).store(writeVersion, std::memory_order_relaxed);
+        removeFromZone(i, writeVersion);
+        liveRows--;
+        deadRows++;
+        summary.removeRow(row);
+        for (int v = 0; v < views.getSize(); ++v) views[v]->removeRow(row);
+    }
+
+    // Free a block's rows, sealed, spilled or not
+    void releaseBlock(int block) {
+        if (blocks[block] != nullptr) residentBytes -= (long long)ZONE_ROWS * sizeof(Tuple);
+        if (segments[block] != nullptr) residentBytes -= segments[block]->getBytes();
+        if (spillOffsets[block] >= 0) {
+            spilledBlocks--;
+            spilledBytes -= spillLengths[block];
+            spillOffsets[block] = -1;
+        }
+        delete[] blocks[block];
+        blocks[block] = nullptr;
+        delete segments[block];
+        segments[block] = nullptr;
+    }
+
+    // Give back the end of the spill file past the segments still spilled
+    void trimSpillFile() {
+        long long end = 0;
+        for (int block = 0; block < sealedBlocks; ++block) {
+            if (spillOffsets[block] >= 0 && spillOffsets[block] + spillLengths[block] > end) {
+                end = spillOffsets[block] + spillLengths[block];
+            }
+        }
+        if (end == spillEnd) return;
+        spillFile.close();
+        std::error_code error;
+        std::filesystem::resize_file(spillPath, end, error);
+        if (!error) spillEnd = end;
+    }
+
+    void addCounters(const ScanCounters& work) const {
+        std::lock_guard<std::mutex> lock(countersLock);
+        counters.rowsScanned += work.rowsScanned;
+        counters.rowsMatched += work.rowsMatched;
+        counters.blocksSkipped += work.blocksSkipped;
+        counters.formatSeconds += work.formatSeconds;
+    }
+
+    // Restore the heap property below position pos; the top slot holds the row
+    // that comes last in ORDER BY order
+    static void siftDownRows(RowHeap& heap, int pos, int heapSize, const SelectQuery& query) {
+        while (true) {
+            int worst = pos;
+            int left = 2 * pos + 1;
+            int right = left + 1;
+            if (left < heapSize && heap.precedes(heap.order[worst], heap.order[left], query)) worst = left;
+            if (right < heapSize && heap.precedes(heap.order[worst], heap.order[right], query)) worst = right;
+            if (worst == pos) return;
+            int temp = heap.order[pos];
+            heap.order[pos] = heap.order[worst];
+            heap.order[worst] = temp;
+            pos = worst;
+        }
+    }
+
+    static void siftUpRows(RowHeap& heap, int pos, const SelectQuery& query) {
+        while (pos > 0) {
+            int parent = (pos - 1) / 2;
+            if (!heap.precedes(heap.order[parent], heap.order[pos], query)) return;
+            int temp = heap.order[pos];
+            heap.order[pos] = heap.order[parent];
+            heap.order[parent] = temp;
+            pos = parent;
+        }
+    }
+
+    // Format a matching row straight into a result buffer, which drops rows
+    // that no longer fit
+    void appendMatch(const Tuple& row, const RowFormat& format, ResultBuffer& result, ScanCounters& work) const {
+        std::chrono::steady_clock::time_point formatStart = std::chrono::steady_clock::now();
+        format.append(row, result);
+        work.formatSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - formatStart).count();
+    }
+
+    // Offer matching row i to an ORDER BY / LIMIT heap. Once the heap is full a
+    // sealed row is decoded in full only if its ORDER BY value gets it in.
+    bool offerStoredRow(RowHeap& heap, int i, const SelectQuery& query, SegmentScratch& scratch) const {
+        int block = i / ZONE_ROWS;
+        if (block < sealedBlocks && query.orderByColumn != 0 && query.limit >= 0 && heap.order.getSize() >= query.limit) {
+            segmentFor(block, scratch)->decodeColumn(i % ZONE_ROWS, query.orderByColumn, scratch.row);
+            if (!precedesInOrder(scratch.row, rowIds[i], heap.rows[heap.order[0]], heap.rowIds[heap.order[0]], query)) return true;
+        }
+        return offerRow(heap, rowAt(i, scratch), rowIds[i], query);
+    }
+
+    // Hand matching row i to one query of a shared scan; false once that query
+    // takes no more rows
+    bool takeMatch(const SelectQuery& query, const RowFormat& format, ResultBuffer& result, RowHeap& heap,
+        int i, SegmentScratch& scratch, ScanCounters& work) const {
+        work.rowsMatched++;
+        if (!query.isOrdered()) {
+            appendMatch(rowAt(i, scratch), format, result, work);
+            return true;
+        }
+        return offerStoredRow(heap, i, query, scratch);
+    }
+
+    // Offer a matching row to an ORDER BY / LIMIT heap. Returns false once no
+    // later row can get in, i.e. a storage-order LIMIT is already filled.
+    static bool offerRow(RowHeap& heap, const Tuple& row, int rowId, const SelectQuery& query) {
+        if (query.limit < 0 || heap.order.getSize() < query.limit) {
+            heap.order.push_back(heap.rows.getSize());
+            heap.rows.push_back(row);
+            heap.rowIds.push_back(rowId);
+            siftUpRows(heap, heap.order.getSize() - 1, query);
+        }
+        else if (query.orderByColumn == 0) {
+            return false;  // Storage order: the first K matches are the answer
+        }
+        else if (precedesInOrder(row, rowId, heap.rows[heap.order[0]], heap.rowIds[heap.order[0]], query)) {
+            heap.rows[heap.order[0]] = row;
+            heap.rowIds[heap.order[0]] = rowId;
+            siftDownRows(heap, 0, heap.order.getSize(), query);
+        }
+        return true;
+    }
+
+    // Heap sort the kept rows into ORDER BY order
+    static void drainHeap(RowHeap& heap, const SelectQuery& query, MyVector<Tuple>& rows) {
+        // Move the worst remaining row to the end each round
+        for (int end = heap.order.getSize() - 1; end > 0; --end) {
+            int temp = heap.order[0];
+            heap.order[0] = heap.order[end];
+            heap.order[end] = temp;
+            siftDownRows(heap, 0, end, query);
+        }
+
+        for (int i = 0; i < heap.order.getSize(); ++i) {
+            rows.push_back(heap.rows[heap.order[i]]);
+        }
+    }
+
+public:
+    explicit Database(int maxTuples = MAX_TUPLES)
+        : blockCount(maxTuples / ZONE_ROWS + 1), sealedBlocks(0), spilledBlocks(0), spilledBytes(0), spillEnd(0),
+          residentBytes(0), capacity(maxTuples), size(0), version(0), nextRowId(0), liveRows(0), deadRows(0) {
+        blocks = new Tuple*[blockCount]();
+        segments = new Segment*[blockCount]();
+        lastScanned = new long long[blockCount]();
+        spillOffsets = new long long[blockCount];
+        spillLengths = new int[blockCount]();
+        for (int block = 0; block < blockCount; ++block) spillOffsets[block] = -1;
+        rowIds = new int[capacity];
+        beginVersion = new int[capacity];
+        endVersion = new int[capacity];
+        zones = new ZoneMap[blockCount];
+        counters.rowsScanned = 0;
+        counters.rowsMatched = 0;
+        counters.blocksSkipped = 0;
+        counters.spillReads = 0;
+        counters.formatSeconds = 0.0;
+    }
+
+    ~Database() {
+        for (int block = 0; block < blockCount; ++block) {
+            releaseBlock(block);
+        }
+        if (!spillPath.empty()) {
+            spillFile.close();
+            std::error_code error;
+            std::filesystem::remove(spillPath, error);
+        }
+        delete[] blocks;
+        delete[] segments;
+        delete[] lastScanned;
+        delete[] spillOffsets;
+        delete[] spillLengths;
+        for (int v = 0; v < views.getSize(); ++v) delete views[v];
+        delete[] rowIds;
+        delete[] beginVersion;
+        delete[] endVersion;
+        delete[] zones;
+    }
+
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
+
+    ScanCounters getCounters() const {
+        std::lock_guard<std::mutex> lock(countersLock);
+        return counters;
+    }
+
+    // Live rows as of the last committed write
+    int getNumTuples() const {
+        return liveRows;
+    }
+
+    // Version a scan started now should read
+    int currentVersion() const {
+        return version;
+    }
+
+    // Bytes of row data held in memory, sealed or not
+    long long getStorageBytes() const {
+        return residentBytes;
+    }
+
+    // Bytes of row data in the spill file
+    long long getSpilledBytes() const {
+        return spilledBytes;
+    }
+
+    // Bits of the value summary that flipped since the last clearSummaryChanges
+    const MyVector<int>& getSummaryChanges() const {
+        return summary.getChanges();
+    }
+
+    void clearSummaryChanges() {
+        summary.clearChanges();
+    }
+
+    bool isFull() const {
+        return size.load(std::memory_order_relaxed) >= capacity;
+    }
+
+    // Start keeping a view grouped on a text column, from the rows live now.
+    // Returns its position among the table's views.
+    int addView(int groupColumn) {
+        GroupedCounts* view = new GroupedCounts(groupColumn);
+        SegmentScratch* scratch = new SegmentScratch;
+        int rows = storedRows();
+        for (int i = 0; i < rows; ++i) {
+            if (isVisible(i, version)) view->addRow(rowAt(i, *scratch));
+        }
+        delete scratch;
+        views.push_back(view);
+        return views.getSize() - 1;
+    }
+
+    const GroupedCounts& getView(int view) const {
+        return *views[view];
+    }
+
+    bool needsGarbageCollection() const {
+        return deadRows >= GC_MIN_DEAD_ROWS && deadRows * 4 >= size.load(std::memory_order_relaxed);
+    }
+
+    bool hasGarbage() const {
+        return deadRows > 0;
+    }
+
+    // Full blocks not sealed yet
+    int getUnsealedBlocks() const {
+        return size.load(std::memory_order_relaxed) / ZONE_ROWS - sealedBlocks;
+    }
+
+    // Compress every full block that is not sealed yet. Frees their rows, so
+    // no scan may be running.
+    void sealBlocks() {
+        int fullBlocks = size.load(std::memory_order_relaxed) / ZONE_ROWS;
+        long long now = std::chrono::steady_clock::now().time_since_epoch().count();
+        for (int block = sealedBlocks; block < fullBlocks; ++block) {
+            segments[block] = new Segment(blocks[block], ZONE_ROWS);
+            residentBytes += segments[block]->getBytes() - (long long)ZONE_ROWS * sizeof(Tuple);
+            lastScanned[block] = now;
+            delete[] blocks[block];
+            blocks[block] = nullptr;
+        }
+        sealedBlocks = fullBlocks;
+    }
+
+    // Spill sealed segments to path from now on. The file is created empty
+    // and removed with the table.
+    void setSpillFile(const std::string& path) {
+        std::ofstream created(path, std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!created.is_open()) {
+            std::cerr << "Error: could not create spill file " << path << ", keeping every segment in memory\n";
+            return;
+        }
+        spillPath = path;
+    }
+
+    bool hasSpillFile() const {
+        return !spillPath.empty();
+    }
+
+    // Sealed segments held in memory that could be spilled
+    int getResidentSegments() const {
+        return spillPath.empty() ? 0 : sealedBlocks - spilledBlocks;
+    }
+
+    // The resident segment scans read least recently, -1 if there is none
+    int coldestSegment() const {
+        int coldest = -1;
+        for (int block = 0; block < sealedBlocks; ++block) {
+            if (segments[block] != nullptr && (coldest < 0 || lastScanned[block] < lastScanned[coldest])) coldest = block;
+        }
+        return coldest;
+    }
+
+    long long getLastScanned(int block) const {
+        return lastScanned[block];
+    }
+
+    // Write a resident segment to the spill file and free it; false if it
+    // could not be written. No scan may be running.
+    bool spillSegment(int block) {
+        std::string record;
+        segments[block]->save(record);
+        if (!spillFile.is_open()) spillFile.open(spillPath, std::ios::in | std::ios::out | std::ios::binary);
+        spillFile.seekp(spillEnd);
+        spillFile.write(record.data(), record.length());
+        spillFile.flush();
+        if (!spillFile) {
+            std::cerr << "Error: could not write to spill file " << spillPath << "\n";
+            spillFile.close();
+            spillFile.clear();
+            return false;
+        }
+
+        spillOffsets[block] = spillEnd;
+        spillLengths[block] = (int)record.length();
+        spillEnd += record.length();
+        spilledBlocks++;
+        spilledBytes += record.length();
+        residentBytes -= segments[block]->getBytes();
+        delete segments[block];
+        segments[block] = nullptr;
+        return true;
+    }
+
+    // Drop every ended row version, keeping the others in storage order. Moves
+    // rows, so no scan may be running; snapshots taken after it still see the
+    // same data since only versions invisible from now on are removed.
+    int collectGarbage() {
+        int rows = size.load(std::memory_order_relaxed);
+        Tuple** compacted = new Tuple*[blockCount]();
+        SegmentScratch* scratch = new SegmentScratch;
+
+        // Leading full blocks without dead rows stay as they are, sealed or not
+        int block = 0;
+        while (rows - block * ZONE_ROWS >= ZONE_ROWS && zones[block].liveRows == ZONE_ROWS) {
+            compacted[block] = blocks[block];
+            block++;
+        }
+
+        // Later rows are copied down into fresh blocks; an old block is freed
+        // once its last row has been read
+        int kept = block * ZONE_ROWS;
+        for (int i = kept; i < rows; ++i) {
+            if (endVersion[i] == NO_VERSION) {
+                if (kept % ZONE_ROWS == 0) {
+                    compacted[kept / ZONE_ROWS] = new Tuple[ZONE_ROWS];
+                    residentBytes += (long long)ZONE_ROWS * sizeof(Tuple);
+                }
+                Tuple& row = compacted[kept / ZONE_ROWS][kept % ZONE_ROWS];
+                row = rowAt(i, *scratch);
+                rowIds[kept] = rowIds[i];
+                beginVersion[kept] = beginVersion[i];
+                endVersion[kept] = NO_VERSION;
+                addToZone(kept, row);
+                kept++;
+            }
+            if (i % ZONE_ROWS == ZONE_ROWS - 1 || i == rows - 1) releaseBlock(i / ZONE_ROWS);
+        }
+
+        delete scratch;
+        delete[] blocks;
+        blocks = compacted;
+        if (sealedBlocks > block) sealedBlocks = block;
+        if (!spillPath.empty()) trimSpillFile();
+        size.store(kept, std::memory_order_release);
+        deadRows = 0;
+        return rows - kept;
+    }
+
+    void insert(const char* attr1, const char* attr2, int attr3) {
+        if (appendRow(attr1, attr2, attr3, nextRowId, version + 1)) {
+            nextRowId++;
+            version++;
+            std::cout << "Inserted: " << attr1 << ", " << attr2 << ", " << attr3 << std::endl;
+        }
+        else {
+            std::cerr << "Error: table full, " << attr1 << ", " << attr2 << ", " << attr3 << " not inserted\n";
+        }
+    }
+
+    int deleteRecords(const char* whereAttr1, const char* whereAttr2, int whereAttr3, std::ostream& outputFile) {
+        int deletedCount = 0;
+        int writeVersion = version + 1;
+        int rows = storedRows();
+        ScanCounters work = { 0, 0, 0, 0, 0.0 };
+        SelectQuery where;
+        whereQuery(whereAttr1, whereAttr2, whereAttr3, where);
+        ZoneFilter filter(where);
+        SegmentScratch* scratch = new SegmentScratch;
+        MyVector<int> matches;
+
+        for (int block = 0; block * ZONE_ROWS < rows; ++block) {
+            findMatches(block, rows, where, filter, version, matches, *scratch, work);
+            for (int m = 0; m < matches.getSize(); ++m) {
+                int i = block * ZONE_ROWS + matches[m];
+                const Tuple& row = rowAt(i, *scratch);
+                work.rowsMatched++;
+
+                // Log the deleted record
+                outputFile << "Deleted record " << rowIds[i] << ": "
+                    << row.attr1 << ", "
+                    << row.attr2 << ", "
+                    << row.attr3 << "\n";
+
+                endRow(i, row, writeVersion);
+                deletedCount++;
+            }
+        }
+
+        version = writeVersion;
+        delete scratch;
+        addCounters(work);
+        return deletedCount;
+    }
+
+    // Whether there is room for the new version of every row an UPDATE with
+    // this WHERE clause changes. Only counted when the live rows might not fit.
+    bool hasRoomToUpdate(const char* whereAttr1, const char* whereAttr2, int whereAttr3) const {
+        int rows = storedRows();
+        int room = capacity - rows;
+        if (liveRows <= room) return true;
+
+        ScanCounters work = { 0, 0, 0, 0, 0.0 };
+        SelectQuery where;
+        whereQuery(whereAttr1, whereAttr2, whereAttr3, where);
+        ZoneFilter filter(where);
+        SegmentScratch* scratch = new SegmentScratch;
+        MyVector<int> matches;
+        int matched = 0;
+        for (int block = 0; block * ZONE_ROWS < rows && matched <= room; ++block) {
+            findMatches(block, rows, where, filter, version, matches, *scratch, work);
+            matched += matches.getSize();
+        }
+        delete scratch;
+        addCounters(work);
+        return matched <= room;
+    }
+
+    // Returns the rows updated, or -1 without changing any if the table has
+    // no room for all their new versions
+    int update(const char* whereAttr1, const char* whereAttr2, int whereAttr3,
+        const char* setAttr1, const char* setAttr2, int setAttr3, std::ostream& outputFile) {
+        if (!hasRoomToUpdate(whereAttr1, whereAttr2, whereAttr3)) return -1;
+
+        int updatedCount = 0;
+        int writeVersion = version + 1;
+        int rows = storedRows();  // Versions appended below are not revisited
+        ScanCounters work = { 0, 0, 0, 0, 0.0 };
+        SelectQuery where;
+        whereQuery(whereAttr1, whereAttr2, whereAttr3, where);
+        ZoneFilter filter(where);
+        SegmentScratch* scratch = new SegmentScratch;
+        MyVector<int> matches;
+
+        for (int block = 0; block * ZONE_ROWS < rows; ++block) {
+            findMatches(block, rows, where, filter, version, matches, *scratch, work);
+            for (int m = 0; m < matches.getSize(); ++m) {
+                int i = block * ZONE_ROWS + matches[m];
+                const Tuple& row = rowAt(i, *scratch);
+                work.rowsMatched++;
+
+                // The new version goes at the end; running scans keep reading this one
+                const char* newAttr1 = safeStringLength(setAttr1, MAX_ATTR_LENGTH) > 0 ? setAttr1 : row.attr1;
+                const char* newAttr2 = safeStringLength(setAttr2, MAX_ATTR_LENGTH) > 0 ? setAttr2 : row.attr2;
+                int newAttr3 = setAttr3 != -1 ? setAttr3 : row.attr3;
+                int next = size.load(std::memory_order_relaxed);
+                if (!appendRow(newAttr1, newAttr2, newAttr3, rowIds[i], writeVersion)) {
+                    // hasRoomToUpdate counted a slot for every match; going on would apply the UPDATE in part
+                    std::cerr << "Error: table full partway through an UPDATE, at record " << rowIds[i] << "\n";
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+                endRow(i, row, writeVersion);
+                const Tuple& after = blocks[next / ZONE_ROWS][next % ZONE_ROWS];  // Appended rows are never sealed
+
+                // Output the before and after values
+                outputFile << "Updated record " << rowIds[i] << ":\n";
+                outputFile << "  Before: " << row.attr1 << ", " << row.attr2 << ", " << row.attr3 << "\n";
+                outputFile << "  After:  " << after.attr1 << ", " << after.attr2 << ", " << after.attr3 << "\n";
+
+                updatedCount++;
+            }
+        }
+
+        version = writeVersion;
+        delete scratch;
+        addCounters(work);
+        return updatedCount;
+    }
+
+
+    void query(const char* attr1, const char* attr2, int attr3, char* result) {
+        result[0] = '\0';
+        char tempResult[MAX_RESULT_LENGTH];
+        int resultPos = 0;
+        bool anyResultFound = false;
+
+        int rows = storedRows();
+        SegmentScratch* scratch = new SegmentScratch;
+        for (int i = 0; i < rows; ++i) {
+            if (!isVisible(i, version)) continue;  // Skip deleted records
+            const Tuple& row = rowAt(i, *scratch);
+            // More comprehensive matching logic
+            bool attr1Match = (safeStringLength(attr1, MAX_ATTR_LENGTH) == 0) ||
+                (attr1[0] == '*') ||
+                matchesPattern(row.attr1, attr1, MAX_ATTR_LENGTH);
+
+            bool attr2Match = (safeStringLength(attr2, MAX_ATTR_LENGTH) == 0) ||
+                (attr2[0] == '*') ||
+                matchesPattern(row.attr2, attr2, MAX_ATTR_LENGTH);
+
+            bool attr3Match = (attr3 == -1) || (row.attr3 == attr3);
+
+            if (attr1Match && attr2Match && attr3Match) {
+                // Construct result string
+                safeCopyString(tempResult, "Found: ", MAX_RESULT_LENGTH);
+                resultPos = 7;
+
+                // Copy attr1
+                int j = 0;
+                while (row.attr1[j] != '\0' && resultPos < MAX_RESULT_LENGTH - 3) {
+                    tempResult[resultPos++] = row.attr1[j++];
+                }
+                tempResult[resultPos++] = ',';
+                tempResult[resultPos++] = ' ';
+
+                // Copy attr2
+                j = 0;
+                while (row.attr2[j] != '\0' && resultPos < MAX_RESULT_LENGTH - 3) {
+                    tempResult[resultPos++] = row.attr2[j++];
+                }
+                tempResult[resultPos++] = ',';
+                tempResult[resultPos++] = ' ';
+
+                // Convert attr3 to string
+                int num = row.attr3;
+                char numStr[12];
+                int numLen = 0;
+
+                if (num == 0) {
+                    numStr[numLen++] = '0';
+                }
+                else {
+                    int temp = num;
+                    while (temp > 0) {
+                        numStr[numLen++] = '0' + (temp % 10);
+                        temp /= 10;
+                    }
+                }
+
+                // Reverse number string
+                for (int k = 0; k < numLen / 2; k++) {
+                    char temp = numStr[k];
+                    numStr[k] = numStr[numLen - 1 - k];
+                    numStr[numLen - 1 - k] = temp;
+                }
+
+                // Append number to result
+                for (int k = 0; k < numLen && resultPos < MAX_RESULT_LENGTH - 2; k++) {
+                    tempResult[resultPos++] = numStr[k];
+                }
+
+                tempResult[resultPos++] = '\n';
+                tempResult[resultPos] = '\0';
+
+                // Append to results if not already found
+                if (!anyResultFound) {
+                    safeCopyString(result, tempResult, MAX_RESULT_LENGTH);
+                    anyResultFound = true;
+                }
+                else {
+                    // If multiple results found, append to existing result
+                    int currentLen = safeStringLength(result, MAX_RESULT_LENGTH);
+                    if (currentLen + resultPos < MAX_RESULT_LENGTH) {
+                        safeCopyString(result + currentLen, tempResult, MAX_RESULT_LENGTH - currentLen);
+                    }
+                }
+
+                std::cout << "Found match: " << tempResult << std::endl;
+            }
+        }
+        delete scratch;
+    }
+    void enhancedQuery(const SelectQuery& query, ResultBuffer& result, int snapshot = LATEST_SNAPSHOT) const {
+        result.clear();
+        RowFormat format(query);
+        snapshot = resolve(snapshot);
+        int rows = storedRows();
+        ScanCounters work = { 0, 0, 0, 0, 0.0 };
+        ZoneFilter filter(query);
+        SegmentScratch* scratch = new SegmentScratch;
+        MyVector<int> matches;
+
+        for (int block = 0; block * ZONE_ROWS < rows; ++block) {
+            findMatches(block, rows, query, filter, snapshot, matches, *scratch, work);
+            work.rowsMatched += matches.getSize();
+            for (int m = 0; m < matches.getSize(); ++m) {
+                appendMatch(rowAt(block * ZONE_ROWS + matches[m], *scratch), format, result, work);
+            }
+        }
+        delete scratch;
+        addCounters(work);
+    }
+
+    // Evaluate a batch of queries in a single pass over the rows. Unordered
+    // queries get their text result in results[q], ordered ones their sorted
+    // run in rows[q], exactly as enhancedQuery and orderedQuery would give them.
+    void sharedScan(const SelectQuery* queries, int queryCount, ResultBuffer* results, MyVector<Tuple>* rows,
+        int snapshot = LATEST_SNAPSHOT) const {
+        snapshot = resolve(snapshot);
+        int storedCount = storedRows();
+        ScanCounters work = { 0, 0, 0, 0, 0.0 };
+        RowHeap* heaps = new RowHeap[queryCount];
+        RowFormat* formats = new RowFormat[queryCount];
+        ZoneFilter* filters = new ZoneFilter[queryCount];
+        bool* active = new bool[queryCount];
+        bool* blockActive = new bool[queryCount];  // Active and not ruled out for the current block
+        int activeCount = 0;
+        SegmentScratch* scratch = new SegmentScratch;
+        MyVector<int> visible;
+        MyVector<int> matches;
+
+        for (int q = 0; q < queryCount; ++q) {
+            results[q].clear();
+            formats[q] = RowFormat(queries[q]);
+            filters[q] = ZoneFilter(queries[q]);
+            rows[q].clear();
+            active[q] = !(queries[q].isOrdered() && queries[q].limit == 0);
+            if (active[q]) activeCount++;
+        }
+
+        for (int block = 0; block * ZONE_ROWS < storedCount && activeCount > 0; ++block) {
+            // A block is passed over when no active query can match in it
+            int blockQueries = 0;
+            for (int q = 0; q < queryCount; ++q) {
+                blockActive[q] = active[q] && blockMayMatch(block, filters[q], snapshot);
+                if (blockActive[q]) blockQueries++;
+            }
+            if (blockQueries == 0) {
+                work.blocksSkipped++;
+                continue;
+            }
+
+            int first = block * ZONE_ROWS;
+            if (block >= sealedBlocks) {
+                // Each row is read once and tried against every query
+                const Tuple* blockRows = blocks[block];
+                int last = storedCount - first < ZONE_ROWS ? storedCount : first + ZONE_ROWS;
+                for (int i = first; i < last && activeCount > 0; ++i) {
+                    if (!isVisible(i, snapshot)) continue;
+                    work.rowsScanned++;
+                    for (int q = 0; q < queryCount; ++q) {
+                        if (!blockActive[q] || !active[q] || !tupleMatchesQuery(blockRows[i - first], queries[q])) continue;
+                        if (!takeMatch(queries[q], formats[q], results[q], heaps[q], i, *scratch, work)) {
+                            active[q] = false;
+                            activeCount--;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // A sealed block is checked for visibility once, then each query
+            // matches the visible rows on their codes
+            visibleRows(block, storedCount, snapshot, visible, work);
+            for (int q = 0; q < queryCount; ++q) {
+                if (!blockActive[q]) continue;
+                matches.setSize(visible.getSize());
+                for (int v = 0; v < visible.getSize(); ++v) matches[v] = visible[v];
+                segmentFor(block, *scratch)->filter(queries[q], filters[q], matches, *scratch);
+
+                for (int m = 0; m < matches.getSize(); ++m) {
+                    int i = first + matches[m];
+                    if (!takeMatch(queries[q], formats[q], results[q], heaps[q], i, *scratch, work)) {
+                        active[q] = false;
+                        activeCount--;
+                        break;
+                    }
+                }
+            }
+        }
+
+        for (int q = 0; q < queryCount; ++q) {
+            if (queries[q].isOrdered()) {
+                drainHeap(heaps[q], queries[q], rows[q]);
+            }
+        }
+
+        delete[] heaps;
+        delete[] formats;
+        delete[] filters;
+        delete[] active;
+        delete[] blockActive;
+        delete scratch;
+        addCounters(work);
+    }
+
+    // Remove the live rows whose attr3 no longer maps to this worker's partition
+    void extractMisplaced(int numWorkers, int partition, MyVector<Tuple>& moved) {
+        int writeVersion = version + 1;
+        int rows = storedRows();
+        ScanCounters work = { 0, 0, 0, 0, 0.0 };
+        ZoneFilter filter;  // Only deleted blocks can be passed over
+        SegmentScratch* scratch = new SegmentScratch;
+        for (int i = 0; i < rows; ++i) {
+            if (i % ZONE_ROWS == 0 && !blockMayMatch(i / ZONE_ROWS, filter, version)) {
+                work.blocksSkipped++;
+                i += ZONE_ROWS - 1;
+                continue;
+            }
+            if (!isVisible(i, version)) continue;
+            const Tuple& row = rowAt(i, *scratch);
+            if (partitionOf(row.attr3, numWorkers) != partition) {
+                moved.push_back(row);
+                endRow(i, row, writeVersion);
+            }
+        }
+        version = writeVersion;
+        delete scratch;
+        addCounters(work);
+    }
+
+    // Collect every matching row in storage order
+    void collectMatches(const SelectQuery& query, MyVector<Tuple>& rows, int snapshot = LATEST_SNAPSHOT) const {
+        rows.clear();
+        snapshot = resolve(snapshot);
+        int storedCount = storedRows();
+        ScanCounters work = { 0, 0, 0, 0, 0.0 };
+        ZoneFilter filter(query);
+        SegmentScratch* scratch = new SegmentScratch;
+        MyVector<int> matches;
+        for (int block = 0; block * ZONE_ROWS < storedCount; ++block) {
+            findMatches(block, storedCount, query, filter, snapshot, matches, *scratch, work);
+            work.rowsMatched += matches.getSize();
+            for (int m = 0; m < matches.getSize(); ++m) {
+                rows.push_back(rowAt(block * ZONE_ROWS + matches[m], *scratch));
+            }
+        }
+        delete scratch;
+        addCounters(work);
+    }
+
+    // Collect the matching rows in ORDER BY order, keeping at most query.limit.
+    // With a LIMIT the rows are kept in a bounded heap with the worst row on top,
+    // so a worker never holds or ships more than K rows.
+    void orderedQuery(const SelectQuery& query, MyVector<Tuple>& rows, int snapshot = LATEST_SNAPSHOT) const {
+        RowHeap heap;
+        rows.clear();
+        if (query.limit == 0) return;
+
+        snapshot = resolve(snapshot);
+        int storedCount = storedRows();
+        ScanCounters work = { 0, 0, 0, 0, 0.0 };
+        ZoneFilter filter(query);
+        SegmentScratch* scratch = new SegmentScratch;
+        MyVector<int> matches;
+        bool filled = false;
+        for (int block = 0; block * ZONE_ROWS < storedCount && !filled; ++block) {
+            findMatches(block, storedCount, query, filter, snapshot, matches, *scratch, work);
+            for (int m = 0; m < matches.getSize(); ++m) {
+                int i = block * ZONE_ROWS + matches[m];
+                work.rowsMatched++;
+                if (!offerStoredRow(heap, i, query, *scratch)) {
+                    filled = true;
+                    break;
+                }
+            }
+        }
+
+        drainHeap(heap, query, rows);
+        delete scratch;
+        addCounters(work);
+    }
+};
+
+// Restore the merge heap below position pos. Runs are ranked by their current
+// head row; ties go to the lower run index, i.e. the lower worker rank.
+inline void siftDownRuns(MyVector<int>& heap, int pos, Tuple** runs, const int* cursor, const SelectQuery& query) {
+    while (true) {
+        int best = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+        if (left < heap.getSize() &&
+            precedesInOrder(runs[heap[left]][cursor[heap[left]]], heap[left], runs[heap[best]][cursor[heap[best]]], heap[best], query)) {
+            best = left;
+        }
+        if (right < heap.getSize() &&
+            precedesInOrder(runs[heap[right]][cursor[heap[right]]], heap[right], runs[heap[best]][cursor[heap[best]]], heap[best], query)) {
+            best = right;
+        }
+        if (best == pos) return;
+        int temp = heap[pos];
+        heap[pos] = heap[best];
+        heap[best] = temp;
+        pos = best;
+    }
+}
+
+const int MERGE_WRITE_CHUNK = 1 << 16;  // Merged text is written out in pieces of about this size
+
+// Streaming k-way merge of the sorted per-worker runs. Stops as soon as
+// query.limit rows have been written. Returns the number of rows written.
+inline int mergeOrderedRuns(Tuple** runs, const int* runSizes, int numRuns, const SelectQuery& query, std::ostream& outputFile) {
+    MyVector<int> heap;   // run indices, the run holding the next row on top
+    int* cursor = new int[numRuns]();
+    RowFormat format(query);
+    ResultBuffer text(INT_MAX);
+    int written = 0;
+
+    for (int run = 0; run < numRuns; ++run) {
+        if (runSizes[run] > 0) heap.push_back(run);
+    }
+    for (int pos = heap.getSize() / 2 - 1; pos >= 0; --pos) {
+        siftDownRuns(heap, pos, runs, cursor, query);
+    }
+
+    while (heap.getSize() > 0 && (query.limit < 0 || written < query.limit)) {
+        int run = heap[0];
+        format.append(runs[run][cursor[run]], text);
+        written++;
+        if (text.getLength() >= MERGE_WRITE_CHUNK) {
+            outputFile.write(text.getData(), text.getLength());
+            text.clear();
+        }
+
+        cursor[run]++;
+        if (cursor[run] == runSizes[run]) {
+            heap[0] = heap[heap.getSize() - 1];
+            heap.pop_back();
+        }
+        siftDownRuns(heap, 0, runs, cursor, query);
+    }
+
+    outputFile.write(text.getData(), text.getLength());
+    delete[] cursor;
+    return written;
+}
+
+// The merge of mergeOrderedRuns, fed each run a piece at a time as the pieces
+// arrive. Rows are written while every run still to come has one buffered, so
+// only the unwritten rows are held, and none once query.limit are written.
+class RunMerger {
+private:
+    int numRuns;
+    MyVector<Tuple>* buffered;  // Rows received and not yet written, from cursor on
+    Tuple** heads;              // buffered[run].getData(), as siftDownRuns takes them
+    int* cursor;
+    bool* waiting;              // More of the run is to come and none of it is buffered
+    bool* finished;             // The run's last piece is in
+    int waitingRuns;
+    SelectQuery query;
+    RowFormat format;
+    int written;
+
+    bool limitReached() const {
+        return query.limit >= 0 && written >= query.limit;
+    }
+
+    // Write rows until a run still to come has none buffered
+    void merge(std::ostream& outputFile) {
+        MyVector<int> heap;
+        for (int run = 0; run < numRuns; ++run) {
+            if (cursor[run] < buffered[run].getSize()) heap.push_back(run);
+        }
+        for (int pos = heap.getSize() / 2 - 1; pos >= 0; --pos) {
+            siftDownRuns(heap, pos, heads, cursor, query);
+        }
+
+        ResultBuffer text(INT_MAX);
+        while (heap.getSize() > 0 && !limitReached()) {
+            int run = heap[0];
+            format.append(heads[run][cursor[run]], text);
+            written++;
+            if (text.getLength() >= MERGE_WRITE_CHUNK) {
+                outputFile.write(text.getData(), text.getLength());
+                text.clear();
+            }
+
+            cursor[run]++;
+            if (cursor[run] == buffered[run].getSize()) {
+                buffered[run].clear();
+                cursor[run] = 0;
+                if (!finished[run]) {
+                    waiting[run] = true;
+                    waitingRuns++;
+                    break;
+                }
+                heap[0] = heap[heap.getSize() - 1];
+                heap.pop_back();
+            }
+            siftDownRuns(heap, 0, heads, cursor, query);
+        }
+        outputFile.write(text.getData(), text.getLength());
+    }
+
+public:
+    RunMerger() : numRuns(0), buffered(nullptr), heads(nullptr), cursor(nullptr), waiting(nullptr), finished(nullptr),
+          waitingRuns(0), written(0) {}
+
+    ~RunMerger() {
+        delete[] buffered;
+        delete[] heads;
+        delete[] cursor;
+        delete[] waiting;
+        delete[] finished;
+    }
+
+    RunMerger(const RunMerger&) = delete;
+    RunMerger& operator=(const RunMerger&) = delete;
+
+    // Start a merge of the runs marked expected
+    void begin(const bool* expected, int runCount, const SelectQuery& ordered) {
+        if (runCount != numRuns) {
+            delete[] buffered;
+            delete[] heads;
+            delete[] cursor;
+            delete[] waiting;
+            delete[] finished;
+            numRuns = runCount;
+            buffered = new MyVector<Tuple>[numRuns];
+            heads = new Tuple*[numRuns];
+            cursor = new int[numRuns];
+            waiting = new bool[numRuns];
+            finished = new bool[numRuns];
+        }
+        query = ordered;
+        format = RowFormat(query);
+        written = 0;
+        waitingRuns = 0;
+        for (int run = 0; run < numRuns; ++run) {
+            buffered[run].clear();
+            heads[run] = buffered[run].getData();
+            cursor[run] = 0;
+            waiting[run] = expected[run];
+            finished[run] = !expected[run];
+            if (expected[run]) waitingRuns++;
+        }
+    }
+
+    // Take in the next rows of a run, last if no more of it follow, and
+    // write out whatever can now be merged
+    void add(int run, const char* rows, int rowCount, bool last, std::ostream& outputFile) {
+        if (!limitReached() && rowCount > 0) {
+            int size = buffered[run].getSize();
+            buffered[run].setSize(size + rowCount);
+            memcpy((char*)(buffered[run].getData() + size), rows, (size_t)rowCount * sizeof(Tuple));
+            heads[run] = buffered[run].getData();
+        }
+        finished[run] = last;
+        if (waiting[run] && (last || buffered[run].getSize() > 0)) {
+            waiting[run] = false;
+            waitingRuns--;
+        }
+        if (waitingRuns == 0) merge(outputFile);
+    }
+
+    // Rows written so far; all of the result once every run is finished
+    int getWritten() const {
+        return written;
+    }
+};
+
+// Restore the heap property below position pos, the greatest value on top
+inline void siftDownGroups(MyVector<GroupRow>& groups, int pos, int heapSize) {
+    while (true) {
+        int largest = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+        if (left < heapSize && safeOrderStrings(groups[left].value, groups[largest].value, MAX_ATTR_LENGTH) > 0) largest = left;
+        if (right < heapSize && safeOrderStrings(groups[right].value, groups[largest].value, MAX_ATTR_LENGTH) > 0) largest = right;
+        if (largest == pos) return;
+        GroupRow temp = groups[pos];
+        groups[pos] = groups[largest];
+        groups[largest] = temp;
+        pos = largest;
+    }
+}
+
+// Write a materialized view from the partitions' groups, which may name a
+// value several times, in order of value. Sorts groups. Returns the number of
+// rows written.
+inline int writeViewGroups(MyVector<GroupRow>& groups, const ViewSchema& view, std::ostream& outputFile) {
+    int count = groups.getSize();
+    for (int pos = count / 2 - 1; pos >= 0; --pos) {
+        siftDownGroups(groups, pos, count);
+    }
+    for (int end = count - 1; end > 0; --end) {
+        GroupRow temp = groups[0];
+        groups[0] = groups[end];
+        groups[end] = temp;
+        siftDownGroups(groups, 0, end);
+    }
+
+    // Equal values are adjacent now and merge into one row
+    int written = 0;
+    int first = 0;
+    while (first < count) {
+        long long rows = 0;
+        long long sum = 0;
+        int last = first;
+        while (last < count && safeCompareStrings(groups[last].value, groups[first].value, MAX_ATTR_LENGTH)) {
+            rows += groups[last].count;
+            sum += groups[last].sum;
+            last++;
+        }
+        if (rows > 0) {
+            for (int c = 0; c < view.columnCount; ++c) {
+                if (c > 0) outputFile << ", ";
+                if (view.columns[c] == VIEW_GROUP) outputFile << groups[first].value;
+                else if (view.columns[c] == VIEW_COUNT) outputFile << rows;
+                else outputFile << sum;
+            }
+            outputFile << "\n";
+            written++;
+        }
+        first = last;
+    }
+    return written;
+}
+
+inline void extractValue(const char* input, char* output, int& pos, int maxLen) {
+    int outIdx = 0;
+    while (input[pos] == ' ' || input[pos] == '(') pos++;
+
+    while (input[pos] != '\0' && input[pos] != ',' && input[pos] != ')' && outIdx < maxLen - 1) {
+        if (input[pos] != ' ') {
+            output[outIdx++] = input[pos];
+        }
+        pos++;
+    }
+    output[outIdx] = '\0';
+    if (input[pos] == ',') pos++;
+}
+
+inline void parseInputLine(const char* line, char* attr1, char* attr2, int& attr3, char* setAttr1, char* setAttr2, int& setAttr3) {
+    int pos = 0;
+
+    // Reset everything to wildcard/empty state
+    attr1[0] = '\0';
+    attr2[0] = '\0';
+    attr3 = -1;
+    setAttr1[0] = '\0';
+    setAttr2[0] = '\0';
+    setAttr3 = -1;
+
+    if (line[0] == 'I') {
+        // INSERT parsing remains the same as before
+        while (line[pos] != '\0' && line[pos] != '(') pos++;
+        if (line[pos] == '\0') return;
+
+        extractValue(line, attr1, pos, MAX_ATTR_LENGTH);
+        extractValue(line, attr2, pos, MAX_ATTR_LENGTH);
+
+        while (line[pos] == ' ' || line[pos] == ',') pos++;
+        while (line[pos] >= '0' && line[pos] <= '9') {
+            attr3 = (attr3 == -1 ? 0 : attr3 * 10) + (line[pos] - '0');
+            pos++;
+        }
+    }
+    else if (line[0] == 'S') {
+        // More robust SELECT parsing
+        while (line[pos] != '\0' && (line[pos] != 'W' || line[pos + 1] != 'H')) pos++;
+        if (line[pos] == '\0') return;
+
+        pos += 6;  // Move past "WHERE"
+
+        // Default to wildcard if no conditions specified
+        safeCopyString(attr1, "*", MAX_ATTR_LENGTH);
+        safeCopyString(attr2, "*", MAX_ATTR_LENGTH);
+        attr3 = -1;
+
+        // Parse all possible conditions
+        bool hasCondition = false;
+        while (line[pos] != '\0') {
+            // Check for attr1 condition
+            if (safeCompareStrings(line + pos, "attr1=", 6)) {
+                pos += 6;
+                int attrPos = 0;
+                attr1[0] = '\0';  // Reset previous value
+                while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
+                    attr1[attrPos++] = line[pos++];
+                }
+                attr1[attrPos] = '\0';
+                hasCondition = true;
+            }
+            // Check for attr2 condition
+            else if (safeCompareStrings(line + pos, "attr2=", 6)) {
+                pos += 6;
+                int attrPos = 0;
+                attr2[0] = '\0';  // Reset previous value
+                while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
+                    attr2[attrPos++] = line[pos++];
+                }
+                attr2[attrPos] = '\0';
+                hasCondition = true;
+            }
+            // Check for attr3 condition
+            else if (safeCompareStrings(line + pos, "attr3=", 6)) {
+                pos += 6;
+                attr3 = 0;
+                while (line[pos] >= '0' && line[pos] <= '9') {
+                    attr3 = attr3 * 10 + (line[pos] - '0');
+                    pos++;
+                }
+                hasCondition = true;
+            }
+            else {
+                pos++;
+            }
+        }
+
+        // If no conditions were found, leave everything as wildcard
+        if (!hasCondition) {
+            safeCopyString(attr1, "*", MAX_ATTR_LENGTH);
+            safeCopyString(attr2, "*", MAX_ATTR_LENGTH);
+            attr3 = -1;
+        }
+    }
+    else if (line[0] == 'U') {  // UPDATE
+        // Skip "UPDATE"
+        while (line[pos] != '\0' && line[pos] != 'S') pos++;
+        if (line[pos] == '\0') return;
+
+        // Parse SET clause
+        pos += 3;  // Skip "SET"
+
+        // Parse SET values
+        while (line[pos] != '\0' && line[pos] != 'W') {
+            if (safeCompareStrings(line + pos, "attr1=", 6)) {
+                pos += 6;
+                int attrPos = 0;
+                while (line[pos] != '\0' && line[pos] != ',' && line[pos] != ' ' && attrPos < MAX_ATTR_LENGTH - 1) {
+                    setAttr1[attrPos++] = line[pos++];
+                }
+                setAttr1[attrPos] = '\0';
+            }
+            else if (safeCompareStrings(line + pos, "attr2=", 6)) {
+                pos += 6;
+                int attrPos = 0;
+                while (line[pos] != '\0' && line[pos] != ',' && line[pos] != ' ' && attrPos < MAX_ATTR_LENGTH - 1) {
+                    setAttr2[attrPos++] = line[pos++];
+                }
+                setAttr2[attrPos] = '\0';
+            }
+            else if (safeCompareStrings(line + pos, "attr3=", 6)) {
+                pos += 6;
+                setAttr3 = 0;
+                while (line[pos] >= '0' && line[pos] <= '9') {
+                    setAttr3 = setAttr3 * 10 + (line[pos] - '0');
+                    pos++;
+                }
+            }
+            pos++;
+        }
+
+        // Parse WHERE clause (similar to SELECT)
+        if (line[pos] == 'W') {
+            pos += 5;  // Skip "WHERE"
+            while (line[pos] != '\0') {
+                if (safeCompareStrings(line + pos, "attr1=", 6)) {
+                    pos += 6;
+                    int attrPos = 0;
+                    while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
+                        attr1[attrPos++] = line[pos++];
+                    }
+                    attr1[attrPos] = '\0';
+                }
+                else if (safeCompareStrings(line + pos, "attr2=", 6)) {
+                    pos += 6;
+                    int attrPos = 0;
+                    while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
+                        attr2[attrPos++] = line[pos++];
+                    }
+                    attr2[attrPos] = '\0';
+                }
+                else if (safeCompareStrings(line + pos, "attr3=", 6)) {
+                    pos += 6;
+                    attr3 = 0;
+                    while (line[pos] >= '0' && line[pos] <= '9') {
+                        attr3 = attr3 * 10 + (line[pos] - '0');
+                        pos++;
+                    }
+                }
+                else {
+                    pos++;
+                }
+            }
+        }
+    }
+    // Add DELETE parsing
+    if (line[0] == 'D') {  // DELETE
+        int pos = 0;
+        // Skip "DELETE FROM"
+        while (line[pos] != '\0' && line[pos] != 'W') pos++;
+        if (line[pos] == '\0') return;
+
+        pos += 5;  // Skip "WHERE"
+        while (line[pos] != '\0') {
+            if (safeCompareStrings(line + pos, "attr1=", 6)) {
+                pos += 6;
+                int attrPos = 0;
+                while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
+                    attr1[attrPos++] = line[pos++];
+                }
+                attr1[attrPos] = '\0';
+            }
+            else if (safeCompareStrings(line + pos, "attr2=", 6)) {
+                pos += 6;
+                int attrPos = 0;
+                while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
+                    attr2[attrPos++] = line[pos++];
+                }
+                attr2[attrPos] = '\0';
+            }
+            else if (safeCompareStrings(line + pos, "attr3=", 6)) {
+                pos += 6;
+                attr3 = 0;
+                while (line[pos] >= '0' && line[pos] <= '9') {
+                    attr3 = attr3 * 10 + (line[pos] - '0');
+                    pos++;
+                }
+            }
+            else {
+                pos++;
+            }
+        }
+    }
+}
+
+inline bool sameWorkItem(const WorkItem& a, const WorkItem& b) {
+    return safeCompareStrings(a.attr1, b.attr1, MAX_ATTR_LENGTH) &&
+        safeCompareStrings(a.attr2, b.attr2, MAX_ATTR_LENGTH) &&
+        a.attr3 == b.attr3 &&
+        safeCompareStrings(a.setAttr1, b.setAttr1, MAX_ATTR_LENGTH) &&
+        safeCompareStrings(a.setAttr2, b.setAttr2, MAX_ATTR_LENGTH) &&
+        a.setAttr3 == b.setAttr3;
+}
+
+// Parse a SELECT, INSERT, UPDATE or DELETE on its own. Returns its table, or
+// -1 if the table is unknown.
+inline int parseStatement(char* command, const Catalog& catalog, SelectQuery& query, WorkItem& item) {
+    int table = normalizeStatement(command, catalog);
+    if (table < 0) return -1;
+    if (command[0] == 'S') {
+        parseSelectQuery(command, query);
+    }
+    else {
+        item.command = command[0];
+        parseInputLine(command, item.attr1, item.attr2, item.attr3, item.setAttr1, item.setAttr2, item.setAttr3);
+    }
+    return table;
+}
+
+// Prepared statements. A template is a statement with parameters in place of
+// its literals: PREPARE names one, with $1, $2, ... as the parameters, and
+// any other SELECT, INSERT, UPDATE or DELETE is reduced to its template
+// automatically. A template is parsed once, with a marker number standing in
+// for each parameter, and the fields the markers land in are recorded.
+// Binding parameter values copies the parsed form and reads each value into
+// its field by the rule the parser would have read it with in place.
+const int MAX_NAMED_PREPARED = 64;        // Statements made with PREPARE
+const int MAX_AUTOMATIC_TEMPLATES = 64;   // Shapes seen, including those found unusable
+const int MAX_PREPARED = MAX_NAMED_PREPARED + MAX_AUTOMATIC_TEMPLATES;
+const int MAX_PARAMETERS = 16;
+const int PARAMETER_MARKER = 1000000000;  // Parameter k parses as PARAMETER_MARKER + k * MARKER_SPACING
+const int MARKER_SPACING = 1000;
+
+// The fields a parameter can fill. For a SELECT the attr fields are its
+// conditions, otherwise those of its WorkItem.
+const int FIELD_ATTR1 = 0;
+const int FIELD_ATTR2 = 1;
+const int FIELD_ATTR3 = 2;
+const int FIELD_SET_ATTR1 = 3;
+const int FIELD_SET_ATTR2 = 4;
+const int FIELD_SET_ATTR3 = 5;
+const int FIELD_ATTR3_LOW = 6;
+const int FIELD_ATTR3_HIGH = 7;
+const int FIELD_LIMIT = 8;
+const int FIELD_COUNT = 9;
+
+struct PreparedStatement {
+    char name[MAX_TABLE_NAME];   // Empty for an automatic template
+    char command;                // 'S', 'I', 'U' or 'D'; '\0' for a template that is parsed each time
+    int table;
+    int parameterCount;
+    SelectQuery query;           // The parsed form of a SELECT
+    WorkItem item;               // and of the others
+    int parameters[FIELD_COUNT]; // Parameter each field is read from, or -1
+    int offsets[FIELD_COUNT];    // Added to the number read, for exclusive attr3 bounds
+};
+
+// The text field of a parsed statement, or nullptr if the field is not text there
+inline char* textField(char command, int field, SelectQuery& query, WorkItem& item) {
+    if (command == 'S') {
+        if (field == FIELD_ATTR1) return query.attr1Condition;
+        if (field == FIELD_ATTR2) return query.attr2Condition;
+        return nullptr;
+    }
+    if (field == FIELD_ATTR1) return item.attr1;
+    if (field == FIELD_ATTR2) return item.attr2;
+    if (field == FIELD_SET_ATTR1) return item.setAttr1;
+    if (field == FIELD_SET_ATTR2) return item.setAttr2;
+    return nullptr;
+}
+
+// The number field of a parsed statement, or nullptr if the field is not a number there
+inline int* numberField(char command, int field, SelectQuery& query, WorkItem& item) {
+    if (command == 'S') {
+        if (field == FIELD_ATTR3) return &query.attr3Condition;
+        if (field == FIELD_ATTR3_LOW) return &query.attr3Low;
+        if (field == FIELD_ATTR3_HIGH) return &query.attr3High;
+        if (field == FIELD_LIMIT) return &query.limit;
+        return nullptr;
+    }
+    if (field == FIELD_ATTR3) return &item.attr3;
+    if (field == FIELD_SET_ATTR3) return &item.setAttr3;
+    return nullptr;
+}
+
+// The parameter whose marker a parsed number is, or -1. offset is what the
+// parser added to the marker.
+inline int markerParameter(long long value, int parameterCount, int& offset) {
+    for (int k = 0; k < parameterCount; ++k) {
+        long long difference = value - (PARAMETER_MARKER + (long long)k * MARKER_SPACING);
+        if (difference >= -1 && difference <= 1) {
+            offset = (int)difference;
+            return k;
+        }
+    }
+    offset = 0;
+    return -1;
+}
+
+// The parameter whose marker a parsed text is, or -1
+inline int textMarkerParameter(const char* text, int parameterCount) {
+    long long value = 0;
+    int length = 0;
+    while (text[length] >= '0' && text[length] <= '9' && length < 10) {
+        value = value * 10 + (text[length] - '0');
+        length++;
+    }
+    int offset;
+    int parameter = text[length] == '\0' ? markerParameter(value, parameterCount, offset) : -1;
+    return parameter >= 0 && offset == 0 ? parameter : -1;
+}
+
+inline void appendMarker(std::string& text, int parameter) {
+    text += std::to_string(PARAMETER_MARKER + parameter * MARKER_SPACING);
+}
+
+// Read a parameter value into a text field as the parser reads that field in place
+inline void readTextParameter(const char* value, char command, int field, char* text) {
+    int length = 0;
+    int pos = 0;
+    if (command == 'I') {
+        // As extractValue reads a VALUES entry
+        while (value[pos] == ' ' || value[pos] == '(') pos++;
+        while (value[pos] != '\0' && value[pos] != ',' && value[pos] != ')' && length < MAX_ATTR_LENGTH - 1) {
+            if (value[pos] != ' ') text[length++] = value[pos];
+            pos++;
+        }
+    }
+    else if (field == FIELD_SET_ATTR1 || field == FIELD_SET_ATTR2) {
+        while (value[pos] != '\0' && value[pos] != ',' && value[pos] != ' ' && length < MAX_ATTR_LENGTH - 1) {
+            text[length++] = value[pos++];
+        }
+    }
+    else {
+        // A condition ends at a space or an 'A'
+        while (value[pos] != '\0' && value[pos] != ' ' && value[pos] != 'A' && length < MAX_ATTR_LENGTH - 1) {
+            text[length++] = value[pos++];
+        }
+    }
+    text[length] = '\0';
+}
+
+// Read a parameter value into a number field as the parser reads that field in place
+inline int readNumberParameter(const char* value, char command, int field, int offset) {
+    int pos = 0;
+    if (command == 'I') {
+        // An INSERT's attr3 may follow spaces and is -1 without digits
+        int number = -1;
+        while (value[pos] == ' ' || value[pos] == ',') pos++;
+        while (value[pos] >= '0' && value[pos] <= '9') {
+            number = (number == -1 ? 0 : number * 10) + (value[pos] - '0');
+            pos++;
+        }
+        return number;
+    }
+    if (field == FIELD_LIMIT && (value[0] < '0' || value[0] > '9')) return -1;
+
+    int number = 0;
+    while (value[pos] >= '0' && value[pos] <= '9') {
+        number = number * 10 + (value[pos] - '0');
+        pos++;
+    }
+    return number + offset;
+}
+
+// Parse a template whose parameters are markers. False unless it is a
+// SELECT, INSERT, UPDATE or DELETE of a known table.
+inline bool parseTemplate(const std::string& text, int parameterCount, const Catalog& catalog, PreparedStatement& statement) {
+    char command[MAX_COMMAND_LENGTH];
+    safeCopyString(command, text.c_str(), MAX_COMMAND_LENGTH);
+    char kind = command[0];
+    if (kind != 'S' && kind != 'I' && kind != 'U' && kind != 'D') return false;
+    if (kind == 'S' && (findKeyword(command, " JOIN ") >= 0 || findStatementView(command, catalog) >= 0)) return false;
+
+    statement.name[0] = '\0';
+    statement.command = kind;
+    statement.parameterCount = parameterCount;
+    statement.table = parseStatement(command, catalog, statement.query, statement.item);
+    if (statement.table < 0) return false;
+
+    for (int field = 0; field < FIELD_COUNT; ++field) {
+        char* textValue = textField(kind, field, statement.query, statement.item);
+        int* numberValue = numberField(kind, field, statement.query, statement.item);
+        statement.offsets[field] = 0;
+        statement.parameters[field] = -1;
+        if (textValue != nullptr) {
+            statement.parameters[field] = textMarkerParameter(textValue, parameterCount);
+        }
+        else if (numberValue != nullptr) {
+            statement.parameters[field] = markerParameter(*numberValue, parameterCount, statement.offsets[field]);
+        }
+    }
+    return true;
+}
+
+// Fill a prepared statement's parsed form from its parameter values, each
+// followed by a '\0'
+inline void bindParameters(const PreparedStatement& statement, const char* values, SelectQuery& query, WorkItem& item) {
+    const char* value[MAX_PARAMETERS];
+    for (int k = 0; k < statement.parameterCount; ++k) {
+        value[k] = values;
+        values += safeStringLength(values, MAX_COMMAND_LENGTH) + 1;
+    }
+
+    if (statement.command == 'S') query = statement.query;
+    else item = statement.item;
+    for (int field = 0; field < FIELD_COUNT; ++field) {
+        int k = statement.parameters[field];
+        if (k < 0) continue;
+        char* textValue = textField(statement.command, field, query, item);
+        if (textValue != nullptr) {
+            readTextParameter(value[k], statement.command, field, textValue);
+        }
+        else {
+            *numberField(statement.command, field, query, item) = readNumberParameter(value[k], statement.command, field,
+                statement.offsets[field]);
+        }
+    }
+}
+
+// Add a literal to a template: a '?' in its shape and the text to its values.
+// False for one the template cannot stand for, as the parser would read
+// past it into the rest of the statement.
+inline bool addLiteral(char command, const char* literal, int length, std::string& shape, std::string& values, int& count) {
+    if (length == 0 || length >= MAX_ATTR_LENGTH - 1 || count == MAX_PARAMETERS) return false;
+    for (int i = 0; i < length; ++i) {
+        char c = literal[i];
+        if (c == '=' || c == '<' || c == '>' || c == '(' || (command == 'U' && c == 'W')) return false;
+        if (safeCompareStrings(literal + i, "attr", 4) || safeCompareStrings(literal + i, "ORDER", 5) ||
+            safeCompareStrings(literal + i, "LIMIT", 5)) {
+            return false;
+        }
+    }
+    shape += '?';
+    values.append(literal, length);
+    values += '\0';
+    count++;
+    return true;
+}
+
+// Reduce a statement to its template. Literals are the values of an INSERT,
+// what follows a comparison up to the next space, and numbers standing on
+// their own, like a LIMIT. False if the statement has a literal the template
+// cannot stand for.
+inline bool splitLiterals(const char* line, std::string& shape, std::string& values, int& count) {
+    shape.clear();
+    values.clear();
+    count = 0;
+    int pos = 0;
+    if (line[0] == 'I') {
+        while (line[pos] != '\0' && line[pos] != '(') shape += line[pos++];
+        bool open = line[pos] == '(';
+        if (open) shape += line[pos++];
+        while (open) {
+            int start = pos;
+            while (line[pos] != '\0' && line[pos] != ',' && line[pos] != ')') pos++;
+            if (!addLiteral(line[0], line + start, pos - start, shape, values, count)) return false;
+            open = line[pos] == ',';
+            if (line[pos] != '\0') shape += line[pos++];
+        }
+    }
+
+    while (line[pos] != '\0') {
+        char c = line[pos];
+        if (c == '?') return false;
+        char before = pos > 0 ? line[pos - 1] : ' ';
+        bool afterComparison = (before == '=' || before == '<' || before == '>') && c != '=' && c != '<' && c != '>' && c != ' ';
+        bool number = pos > 0 && before == ' ' && c >= '0' && c <= '9';
+        if (!afterComparison && !number) {
+            shape += line[pos++];
+            continue;
+        }
+
+        int start = pos;
+        while (line[pos] != '\0' && line[pos] != ' ') pos++;
+        bool digits = true;
+        for (int i = start; i < pos; ++i) {
+            if (line[i] < '0' || line[i] > '9') digits = false;
+        }
+        if (!afterComparison && !digits) {
+            shape.append(line + start, pos - start);
+        }
+        else if (!addLiteral(line[0], line + start, pos - start, shape, values, count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The prepared statements a process knows, by number. The master also keeps
+// the shape of each automatic template, to find it again.
+class StatementTemplates {
+private:
+    PreparedStatement* statements;
+    std::string* shapes;    // Empty for a named statement
+    unsigned int* hashes;
+    int count;
+    int namedCount;
+    int automaticCount;
+
+    static unsigned int hashShape(const std::string& shape) {
+        unsigned int hash = 2166136261u;
+        for (size_t i = 0; i < shape.length(); ++i) {
+            hash = (hash ^ (unsigned char)shape[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    int findShape(const std::string& shape, unsigned int hash) const {
+        for (int i = 0; i < count; ++i) {
+            if (hashes[i] == hash && shapes[i] == shape) return i;
+        }
+        return -1;
+    }
+
+    // Take a new automatic template from the first statement of its shape. It
+    // is only used if binding the statement's literals gives what parsing it
+    // does; otherwise statements of that shape are parsed each time.
+    int addShape(const std::string& shape, unsigned int hash, const std::string& values, int valueCount,
+        const char* command, const Catalog& catalog) {
+        std::string marked;
+        int parameter = 0;
+        for (size_t i = 0; i < shape.length(); ++i) {
+            if (shape[i] == '?') appendMarker(marked, parameter++);
+            else marked += shape[i];
+        }
+
+        PreparedStatement& statement = statements[count];
+        shapes[count] = shape;
+        hashes[count] = hash;
+        if (parseTemplate(marked, valueCount, catalog, statement)) {
+            char parsed[MAX_COMMAND_LENGTH];
+            safeCopyString(parsed, command, MAX_COMMAND_LENGTH);
+            SelectQuery query;
+            WorkItem item;
+            SelectQuery boundQuery;
+            WorkItem boundItem;
+            int table = parseStatement(parsed, catalog, query, item);
+            bindParameters(statement, values.data(), boundQuery, boundItem);
+            bool same = statement.command == 'S' ? sameSelectQuery(query, boundQuery) : sameWorkItem(item, boundItem);
+            if (table != statement.table || !same) statement.command = '\0';
+        }
+        else {
+            statement.command = '\0';
+        }
+        automaticCount++;
+        return count++;
+    }
+
+public:
+    StatementTemplates() : count(0), namedCount(0), automaticCount(0) {
+        statements = new PreparedStatement[MAX_PREPARED];
+        shapes = new std::string[MAX_PREPARED];
+        hashes = new unsigned int[MAX_PREPARED];
+    }
+
+    ~StatementTemplates() {
+        delete[] statements;
+        delete[] shapes;
+        delete[] hashes;
+    }
+
+    StatementTemplates(const StatementTemplates&) = delete;
+    StatementTemplates& operator=(const StatementTemplates&) = delete;
+
+    const PreparedStatement& get(int id) const {
+        return statements[id];
+    }
+
+    // Keep a statement under the master's number for it
+    void set(int id, const PreparedStatement& statement) {
+        statements[id] = statement;
+        if (id >= count) count = id + 1;
+    }
+
+    // PREPARE name AS statement, with $1, $2, ... for its parameters.
+    // Returns the statement's number, or -1.
+    int prepare(const char* line, const Catalog& catalog) {
+        int pos = 8;  // Past "PREPARE "
+        char name[MAX_TABLE_NAME];
+        while (line[pos] == ' ') pos++;
+        readIdentifier(line, pos, name, MAX_TABLE_NAME);
+        int as = findKeyword(line, " AS ");
+        if (name[0] == '\0' || as < 0 || namedCount == MAX_NAMED_PREPARED || findNamed(name) >= 0) return -1;
+
+        std::string marked;
+        int parameterCount = 0;
+        pos = as + 4;
+        while (line[pos] == ' ') pos++;
+        while (line[pos] != '\0') {
+            if (line[pos] != '$' || line[pos + 1] < '1' || line[pos + 1] > '9') {
+                marked += line[pos++];
+                continue;
+            }
+            int parameter = 0;
+            pos++;
+            while (line[pos] >= '0' && line[pos] <= '9' && parameter <= MAX_PARAMETERS) {
+                parameter = parameter * 10 + (line[pos++] - '0');
+            }
+            if (parameter > MAX_PARAMETERS) return -1;
+            appendMarker(marked, parameter - 1);
+            if (parameter > parameterCount) parameterCount = parameter;
+        }
+
+        PreparedStatement& statement = statements[count];
+        if (!parseTemplate(marked, parameterCount, catalog, statement)) return -1;
+        safeCopyString(statement.name, name, MAX_TABLE_NAME);
+        shapes[count].clear();
+        hashes[count] = 0;
+        namedCount++;
+        return count++;
+    }
+
+    int findNamed(const char* name) const {
+        for (int i = 0; i < count; ++i) {
+            if (shapes[i].empty() && safeCompareStrings(statements[i].name, name, MAX_TABLE_NAME)) return i;
+        }
+        return -1;
+    }
+
+    // EXECUTE name (value, ...): the statement's number, with the values
+    // packed for bindParameters, or -1 if there is no such statement or the
+    // values do not match its parameters
+    int execute(const char* line, std::string& values) const {
+        int pos = 8;  // Past "EXECUTE "
+        char name[MAX_TABLE_NAME];
+        while (line[pos] == ' ') pos++;
+        readIdentifier(line, pos, name, MAX_TABLE_NAME);
+        int id = findNamed(name);
+        if (id < 0) return -1;
+
+        values.clear();
+        int valueCount = 0;
+        while (line[pos] == ' ') pos++;
+        if (line[pos] == '(') {
+            pos++;
+            bool open = true;
+            while (open && line[pos] != '\0') {
+                while (line[pos] == ' ') pos++;
+                int start = pos;
+                while (line[pos] != '\0' && line[pos] != ',' && line[pos] != ')') pos++;
+                int end = pos;
+                while (end > start && line[end - 1] == ' ') end--;
+                bool emptyList = valueCount == 0 && end == start && line[pos] == ')';
+                if (!emptyList) {
+                    values.append(line + start, end - start);
+                    values += '\0';
+                    valueCount++;
+                }
+                open = line[pos] == ',';
+                if (line[pos] != '\0') pos++;
+            }
+        }
+        return valueCount == statements[id].parameterCount ? id : -1;
+    }
+
+    // The table and parsed form of a SELECT, INSERT, UPDATE or DELETE, bound
+    // from the template of its shape when there is one. prepared is the
+    // template's number, or -1 if the statement was parsed on its own, and
+    // values its literals. Once MAX_AUTOMATIC_TEMPLATES shapes are known, shapes
+    // not seen yet are parsed each time; PREPARE keeps its own share of the
+    // numbers. Returns -1 for an unknown table.
+    int resolve(char* command, const Catalog& catalog, SelectQuery& query, WorkItem& item, int& prepared, std::string& values) {
+        prepared = -1;
+        std::string shape;
+        int valueCount;
+        if (splitLiterals(command, shape, values, valueCount)) {
+            unsigned int hash = hashShape(shape);
+            int id = findShape(shape, hash);
+            if (id < 0 && automaticCount < MAX_AUTOMATIC_TEMPLATES) id = addShape(shape, hash, values, valueCount, command, catalog);
+            if (id >= 0 && statements[id].command != '\0') {
+                prepared = id;
+                bindParameters(statements[id], values.data(), query, item);
+                return statements[id].table;
+            }
+        }
+        return parseStatement(command, catalog, query, item);
+    }
+};
@@ -1,783 +1,1245 @@
 #include <mpi.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <new>
+#include "DatabaseCore.h"
+#include "ServerProtocol.h"
+#ifndef _WIN32
+#include <poll.h>
+#endif
 
 struct WorkRequest {
     int workerRank;
     int currentLoad;  // Number of tuples currently handled by worker
 };
 
-// Define constants
-const int MAX_ATTR_LENGTH = 100;
-const int MAX_TUPLES = 20000000;
-const int MAX_RESULT_LENGTH = 20000;
-const int MAX_COMMAND_LENGTH = 20000;
-const int MAX_COLUMNS = 10;  
-const int MAX_COLUMN_NAME = 20;
-
-
-struct WorkItem {
-    char command;  // 'I' for Insert, 'S' for Select, etc.
-    char attr1[MAX_ATTR_LENGTH];
-    char attr2[MAX_ATTR_LENGTH];
-    int attr3;
-    char setAttr1[MAX_ATTR_LENGTH];
-    char setAttr2[MAX_ATTR_LENGTH];
-    int setAttr3;
+// Join strategies, chosen by the master from its row count estimates
+const int JOIN_BROADCAST_RIGHT = 0;
+const int JOIN_BROADCAST_LEFT = 1;
+const int JOIN_SHUFFLE = 2;
+
+// An equi-join of two tables. Filters hold the WHERE conditions for each side,
+// output columns are (side, slot) pairs with side 0 = left and 1 = right.
+class JoinQuery {
+public:
+    int leftTable;
+    int rightTable;
+    int leftKey;    // Tuple slot 1-3
+    int rightKey;
+    SelectQuery leftFilter;
+    SelectQuery rightFilter;
+    int outputColumnCount;  // 0 selects every column of both tables
+    int outputSide[MAX_COLUMNS];
+    int outputColumn[MAX_COLUMNS];
+    int strategy;
+
+    JoinQuery() : leftTable(0), rightTable(0), leftKey(0), rightKey(0), outputColumnCount(0), strategy(JOIN_BROADCAST_RIGHT) {}
 };
 
-// Custom string length function
-int safeStringLength(const char* str, int maxLen) {
-    int len = 0;
-    while (str[len] != '\0' && len < maxLen) {
-        len++;
+// Resolve "qualifier.column" or a bare column name against the two join tables.
+// Returns the Tuple slot (1-3) and sets side, or 0 if the column is unknown.
+int resolveJoinColumn(const char* line, int& pos, const Catalog& catalog, const JoinQuery& join, int& side) {
+    char first[MAX_COLUMN_NAME];
+    char second[MAX_COLUMN_NAME];
+    readIdentifier(line, pos, first, MAX_COLUMN_NAME);
+    if (line[pos] == '.') {
+        pos++;
+        readIdentifier(line, pos, second, MAX_COLUMN_NAME);
+        int table = catalog.findTable(first);
+        if (table == join.leftTable) side = 0;
+        else if (table == join.rightTable) side = 1;
+        else return 0;
+        return catalog.resolveColumn(table, second);
     }
-    return len;
-}
 
-// Custom string comparison function
-bool safeCompareStrings(const char* str1, const char* str2, int maxLen) {
-    int i = 0;
-    while (i < maxLen - 1 && str1[i] != '\0' && str2[i] != '\0') {
-        if (str1[i] != str2[i]) return false;
-        i++;
+    side = 0;
+    int column = catalog.resolveColumn(join.leftTable, first);
+    if (column == 0) {
+        side = 1;
+        column = catalog.resolveColumn(join.rightTable, first);
     }
-    return str1[i] == str2[i];
+    return column;
 }
 
-// Custom string copy function
-void safeCopyString(char* dest, const char* src, int maxLen) {
-    int i = 0;
-    while (src[i] != '\0' && i < maxLen - 1) {
-        dest[i] = src[i];
-        i++;
+// Parse "SELECT cols FROM left JOIN right ON l.col = r.col [WHERE t.col=value [AND ...]]"
+bool parseJoinQuery(const char* line, const Catalog& catalog, JoinQuery& join) {
+    char name[MAX_TABLE_NAME];
+    int pos = findKeyword(line, "FROM ");
+    if (pos < 0) return false;
+    pos += 5;
+    while (line[pos] == ' ') pos++;
+    readIdentifier(line, pos, name, MAX_TABLE_NAME);
+    join.leftTable = catalog.findTable(name);
+
+    pos = findKeyword(line, " JOIN ");
+    if (pos < 0) return false;
+    pos += 6;
+    while (line[pos] == ' ') pos++;
+    readIdentifier(line, pos, name, MAX_TABLE_NAME);
+    join.rightTable = catalog.findTable(name);
+    if (join.leftTable < 0 || join.rightTable < 0) return false;
+
+    // ON clause: the two sides may be written in either order
+    pos = findKeyword(line, " ON ");
+    if (pos < 0) return false;
+    pos += 4;
+    int sides[2];
+    int keys[2];
+    for (int i = 0; i < 2; ++i) {
+        while (line[pos] == ' ' || line[pos] == '=') pos++;
+        keys[i] = resolveJoinColumn(line, pos, catalog, join, sides[i]);
+        if (keys[i] == 0) return false;
+    }
+    if (sides[0] == sides[1]) return false;
+    join.leftKey = sides[0] == 0 ? keys[0] : keys[1];
+    join.rightKey = sides[0] == 0 ? keys[1] : keys[0];
+    // Text columns only join with text columns, the integer column with itself
+    if ((join.leftKey == 3) != (join.rightKey == 3)) return false;
+
+    // Projection
+    join.outputColumnCount = 0;
+    int fromPos = findKeyword(line, "FROM ");
+    pos = 6;  // Skip "SELECT"
+    while (pos < fromPos) {
+        if (isIdentifierChar(line[pos]) && join.outputColumnCount < MAX_COLUMNS) {
+            int side;
+            int column = resolveJoinColumn(line, pos, catalog, join, side);
+            if (column == 0) return false;
+            join.outputSide[join.outputColumnCount] = side;
+            join.outputColumn[join.outputColumnCount] = column;
+            join.outputColumnCount++;
+        }
+        else {
+            pos++;
+        }
     }
-    dest[i] = '\0';
-}
 
-// Custom string matching function with wildcard support
-bool matchesPattern(const char* str, const char* pattern, int maxLen) {
-    // Wildcard matching
-    if (pattern[0] == '*' && pattern[1] == '\0') return true;
+    // WHERE conditions, each routed to the side its column belongs to
+    pos = findKeyword(line, " WHERE ");
+    if (pos < 0) return true;
+    pos += 7;
+    while (line[pos] != '\0') {
+        if (!isIdentifierChar(line[pos]) || safeCompareStrings(line + pos, "AND ", 4)) {
+            pos += line[pos] == 'A' ? 4 : 1;
+            continue;
+        }
+        int side;
+        int column = resolveJoinColumn(line, pos, catalog, join, side);
+        if (column == 0 || line[pos] != '=') return false;
+        pos++;
 
-    int strLen = safeStringLength(str, maxLen);
-    int patternLen = safeStringLength(pattern, maxLen);
+        SelectQuery& filter = side == 0 ? join.leftFilter : join.rightFilter;
+        char value[MAX_ATTR_LENGTH];
+        int valuePos = 0;
+        while (line[pos] != '\0' && line[pos] != ' ' && valuePos < MAX_ATTR_LENGTH - 1) {
+            value[valuePos++] = line[pos++];
+        }
+        value[valuePos] = '\0';
 
-    // Check for prefix wildcard
-    if (pattern[patternLen - 1] == '*') {
-        if (patternLen - 1 > strLen) return false;
-        for (int i = 0; i < patternLen - 1; i++) {
-            if (str[i] != pattern[i]) return false;
+        if (column == 1) safeCopyString(filter.attr1Condition, value, MAX_ATTR_LENGTH);
+        else if (column == 2) safeCopyString(filter.attr2Condition, value, MAX_ATTR_LENGTH);
+        else {
+            filter.attr3Condition = 0;
+            for (int i = 0; value[i] >= '0' && value[i] <= '9'; ++i) {
+                filter.attr3Condition = filter.attr3Condition * 10 + (value[i] - '0');
+            }
         }
-        return true;
     }
-
-    // Check for exact match
-    return safeCompareStrings(str, pattern, maxLen);
+    return true;
 }
 
-class SelectQuery {
-public:
-    char selectedColumns[MAX_COLUMNS][MAX_COLUMN_NAME];
-    int selectedColumnCount;
-    char attr1Condition[MAX_ATTR_LENGTH];
-    char attr2Condition[MAX_ATTR_LENGTH];
-    int attr3Condition;
-
-    SelectQuery() {
-        selectedColumnCount = 0;
-        attr1Condition[0] = '\0';
-        attr2Condition[0] = '\0';
-        attr3Condition = -1;
-    }
+int chooseJoinStrategy(int leftRows, int rightRows) {
+    if (rightRows <= BROADCAST_JOIN_THRESHOLD && rightRows <= leftRows) return JOIN_BROADCAST_RIGHT;
+    if (leftRows <= BROADCAST_JOIN_THRESHOLD) return JOIN_BROADCAST_LEFT;
+    return JOIN_SHUFFLE;
+}
 
-    void addSelectedColumn(const char* columnName) {
-        if (selectedColumnCount < MAX_COLUMNS) {
-            safeCopyString(selectedColumns[selectedColumnCount], columnName, MAX_COLUMN_NAME);
-            selectedColumnCount++;
+// FNV-1a hash of a tuple's join key
+unsigned int hashTupleKey(const Tuple& tuple, int column) {
+    unsigned int hash = 2166136261u;
+    if (column == 3) {
+        unsigned int value = (unsigned int)tuple.attr3;
+        for (int i = 0; i < 4; ++i) {
+            hash = (hash ^ (value & 0xFF)) * 16777619u;
+            value >>= 8;
         }
+        return hash;
     }
+    const char* key = column == 1 ? tuple.attr1 : tuple.attr2;
+    for (int i = 0; key[i] != '\0' && i < MAX_ATTR_LENGTH; ++i) {
+        hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return hash;
+}
 
-    bool isColumnSelected(const char* columnName) const {
-        if (selectedColumnCount == 0) return true;  // If no specific columns, return all
+bool tupleKeysEqual(const Tuple& a, int aColumn, const Tuple& b, int bColumn) {
+    if (aColumn == 3) return a.attr3 == b.attr3;
+    return safeCompareStrings(aColumn == 1 ? a.attr1 : a.attr2, bColumn == 1 ? b.attr1 : b.attr2, MAX_ATTR_LENGTH);
+}
 
-        for (int i = 0; i < selectedColumnCount; ++i) {
-            if (safeCompareStrings(selectedColumns[i], columnName, MAX_COLUMN_NAME)) {
-                return true;
-            }
+// Chained hash table over the build side of a join
+class JoinHashTable {
+private:
+    const MyVector<Tuple>& rows;
+    int keyColumn;
+    int bucketCount;
+    int* bucketHead;
+    int* nextRow;
+
+public:
+    JoinHashTable(const MyVector<Tuple>& buildRows, int buildKey) : rows(buildRows), keyColumn(buildKey) {
+        bucketCount = 16;
+        while (bucketCount < 2 * rows.getSize()) bucketCount *= 2;
+        bucketHead = new int[bucketCount];
+        nextRow = new int[rows.getSize() > 0 ? rows.getSize() : 1];
+        for (int i = 0; i < bucketCount; ++i) bucketHead[i] = -1;
+
+        // Insert in reverse so each chain lists rows in build order
+        for (int i = rows.getSize() - 1; i >= 0; --i) {
+            int bucket = hashTupleKey(rows[i], keyColumn) & (bucketCount - 1);
+            nextRow[i] = bucketHead[bucket];
+            bucketHead[bucket] = i;
         }
-        return false;
     }
-};
 
-void parseSelectQuery(const char* line, SelectQuery& query) {
-    int pos = 0;
-    // Reset query
-    query.selectedColumnCount = 0;
-    query.attr1Condition[0] = '\0';
-    query.attr2Condition[0] = '\0';
-    query.attr3Condition = -1;
+    ~JoinHashTable() {
+        delete[] bucketHead;
+        delete[] nextRow;
+    }
 
-    // Parse selected columns
-    while (line[pos] != '\0' && line[pos] != 'F' && line[pos] != 'W') {
-        if (safeCompareStrings(line + pos, "attr1", 5)) {
-            query.addSelectedColumn("attr1");
-            pos += 5;
-        }
-        else if (safeCompareStrings(line + pos, "attr2", 5)) {
-            query.addSelectedColumn("attr2");
-            pos += 5;
-        }
-        else if (safeCompareStrings(line + pos, "attr3", 5)) {
-            query.addSelectedColumn("attr3");
-            pos += 5;
-        }
-        pos++;
+    // First build row whose key equals the probe key, or -1
+    int findFirst(const Tuple& probe, int probeKey) const {
+        int i = bucketHead[hashTupleKey(probe, probeKey) & (bucketCount - 1)];
+        while (i >= 0 && !tupleKeysEqual(rows[i], keyColumn, probe, probeKey)) i = nextRow[i];
+        return i;
     }
 
-    // Parse WHERE conditions
-    while (line[pos] != '\0') {
-        // Check for attr1 condition
-        if (safeCompareStrings(line + pos, "attr1=", 6)) {
-            pos += 6;
-            int attrPos = 0;
-            query.attr1Condition[0] = '\0';
-            while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
-                query.attr1Condition[attrPos++] = line[pos++];
-            }
-            query.attr1Condition[attrPos] = '\0';
-        }
-        // Check for attr2 condition
-        else if (safeCompareStrings(line + pos, "attr2=", 6)) {
-            pos += 6;
-            int attrPos = 0;
-            query.attr2Condition[0] = '\0';
-            while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
-                query.attr2Condition[attrPos++] = line[pos++];
-            }
-            query.attr2Condition[attrPos] = '\0';
-        }
-        // Check for attr3 condition
-        else if (safeCompareStrings(line + pos, "attr3=", 6)) {
-            pos += 6;
-            query.attr3Condition = 0;
-            while (line[pos] >= '0' && line[pos] <= '9') {
-                query.attr3Condition = query.attr3Condition * 10 + (line[pos] - '0');
-                pos++;
-            }
-        }
+    int findNext(int previous, const Tuple& probe, int probeKey) const {
+        int i = nextRow[previous];
+        while (i >= 0 && !tupleKeysEqual(rows[i], keyColumn, probe, probeKey)) i = nextRow[i];
+        return i;
+    }
+};
+
+void appendJoinedRow(const Tuple& left, const Tuple& right, const JoinQuery& join, std::string& result) {
+    int columnCount = join.outputColumnCount > 0 ? join.outputColumnCount : 6;
+    for (int i = 0; i < columnCount; ++i) {
+        int side = join.outputColumnCount > 0 ? join.outputSide[i] : i / 3;
+        int column = join.outputColumnCount > 0 ? join.outputColumn[i] : i % 3 + 1;
+        const Tuple& tuple = side == 0 ? left : right;
+
+        if (i > 0) result += ", ";
+        if (column == 1) result += tuple.attr1;
+        else if (column == 2) result += tuple.attr2;
         else {
-            pos++;
+            char numStr[20];
+            snprintf(numStr, sizeof(numStr), "%d", tuple.attr3);
+            result += numStr;
         }
     }
+    result += '\n';
 }
 
-struct Tuple {
-    char attr1[MAX_ATTR_LENGTH];
-    char attr2[MAX_ATTR_LENGTH];
-    int attr3;
+// Probe every probe row against the build rows, appending joined rows in probe order
+void hashJoinRows(const MyVector<Tuple>& build, bool buildIsLeft, const MyVector<Tuple>& probe, const JoinQuery& join, std::string& result) {
+    int buildKey = buildIsLeft ? join.leftKey : join.rightKey;
+    int probeKey = buildIsLeft ? join.rightKey : join.leftKey;
+    JoinHashTable hashTable(build, buildKey);
 
-    Tuple() {
-        attr1[0] = '\0';
-        attr2[0] = '\0';
-        attr3 = 0;
+    for (int p = 0; p < probe.getSize(); ++p) {
+        for (int b = hashTable.findFirst(probe[p], probeKey); b >= 0; b = hashTable.findNext(b, probe[p], probeKey)) {
+            if (buildIsLeft) appendJoinedRow(build[b], probe[p], join, result);
+            else appendJoinedRow(probe[p], build[b], join, result);
+        }
     }
+}
 
-    Tuple(const Tuple& other) {
-        safeCopyString(attr1, other.attr1, MAX_ATTR_LENGTH);
-        safeCopyString(attr2, other.attr2, MAX_ATTR_LENGTH);
-        attr3 = other.attr3;
+// Give every worker a copy of all workers' rows
+void allgatherRows(const MyVector<Tuple>& rows, MyVector<Tuple>& gathered, MPI_Comm comm) {
+    int commSize;
+    MPI_Comm_size(comm, &commSize);
+    int* byteCounts = new int[commSize];
+    int* displacements = new int[commSize];
+
+    int localBytes = rows.getSize() * (int)sizeof(Tuple);
+    MPI_Allgather(&localBytes, 1, MPI_INT, byteCounts, 1, MPI_INT, comm);
+    int totalBytes = 0;
+    for (int i = 0; i < commSize; ++i) {
+        displacements[i] = totalBytes;
+        totalBytes += byteCounts[i];
     }
 
-    Tuple& operator=(const Tuple& other) {
-        if (this != &other) {
-            safeCopyString(attr1, other.attr1, MAX_ATTR_LENGTH);
-            safeCopyString(attr2, other.attr2, MAX_ATTR_LENGTH);
-            attr3 = other.attr3;
-        }
-        return *this;
-    }
-};
+    gathered.setSize(totalBytes / (int)sizeof(Tuple));
+    MPI_Allgatherv(rows.getData(), localBytes, MPI_BYTE, gathered.getData(), byteCounts, displacements, MPI_BYTE, comm);
 
-// Custom vector implementation
-template <typename T>
-class MyVector {
-private:
-    T* data;
-    int capacity;
-    int size;
+    delete[] byteCounts;
+    delete[] displacements;
+}
 
-    void resize() {
-        int newCapacity = capacity * 2;
-        T* newData = new T[newCapacity];
-        for (int i = 0; i < size; ++i) {
-            newData[i] = data[i];
-        }
-        delete[] data;
-        data = newData;
-        capacity = newCapacity;
+// Redistribute rows so each one lands on the worker owning hash(key) % workers
+void shuffleRows(const MyVector<Tuple>& rows, int keyColumn, MyVector<Tuple>& received, MPI_Comm comm) {
+    int commSize;
+    MPI_Comm_size(comm, &commSize);
+    int* sendCounts = new int[commSize]();
+    int* sendDisplacements = new int[commSize];
+    int* recvCounts = new int[commSize];
+    int* recvDisplacements = new int[commSize];
+    int* destination = new int[rows.getSize() > 0 ? rows.getSize() : 1];
+
+    for (int i = 0; i < rows.getSize(); ++i) {
+        destination[i] = hashTupleKey(rows[i], keyColumn) % commSize;
+        sendCounts[destination[i]]++;
     }
 
-public:
-    MyVector() : capacity(10), size(0) {
-        data = new T[capacity];
+    // Group the rows by destination worker
+    int offset = 0;
+    for (int i = 0; i < commSize; ++i) {
+        sendDisplacements[i] = offset;
+        offset += sendCounts[i];
     }
-
-    ~MyVector() {
-        delete[] data;
+    MyVector<Tuple> outgoing;
+    outgoing.setSize(rows.getSize());
+    int* fill = new int[commSize];
+    for (int i = 0; i < commSize; ++i) fill[i] = sendDisplacements[i];
+    for (int i = 0; i < rows.getSize(); ++i) {
+        outgoing[fill[destination[i]]++] = rows[i];
     }
 
-    void push_back(const T& value) {
-        if (size == capacity) {
-            resize();
-        }
-        data[size++] = value;
+    for (int i = 0; i < commSize; ++i) {
+        sendCounts[i] *= (int)sizeof(Tuple);
+        sendDisplacements[i] *= (int)sizeof(Tuple);
     }
-
-    T& operator[](int index) {
-        return data[index];
+    MPI_Alltoall(sendCounts, 1, MPI_INT, recvCounts, 1, MPI_INT, comm);
+    int totalBytes = 0;
+    for (int i = 0; i < commSize; ++i) {
+        recvDisplacements[i] = totalBytes;
+        totalBytes += recvCounts[i];
     }
 
-    const T& operator[](int index) const {
-        return data[index];
-    }
+    received.setSize(totalBytes / (int)sizeof(Tuple));
+    MPI_Alltoallv(outgoing.getData(), sendCounts, sendDisplacements, MPI_BYTE,
+        received.getData(), recvCounts, recvDisplacements, MPI_BYTE, comm);
 
-    int getSize() const {
-        return size;
+    delete[] sendCounts;
+    delete[] sendDisplacements;
+    delete[] recvCounts;
+    delete[] recvDisplacements;
+    delete[] destination;
+    delete[] fill;
+}
+
+// Run this worker's share of a join. Every worker in comm must call this for
+// the same join, the small side is broadcast or both sides are shuffled by key
+// so matching rows meet on one worker.
+void runDistributedJoin(const JoinQuery& join, Database** tables, MPI_Comm comm, std::string& result) {
+    MyVector<Tuple> leftRows;
+    MyVector<Tuple> rightRows;
+    tables[join.leftTable]->collectMatches(join.leftFilter, leftRows);
+    tables[join.rightTable]->collectMatches(join.rightFilter, rightRows);
+
+    if (join.strategy == JOIN_BROADCAST_RIGHT) {
+        MyVector<Tuple> allRight;
+        allgatherRows(rightRows, allRight, comm);
+        hashJoinRows(allRight, false, leftRows, join, result);
+    }
+    else if (join.strategy == JOIN_BROADCAST_LEFT) {
+        MyVector<Tuple> allLeft;
+        allgatherRows(leftRows, allLeft, comm);
+        hashJoinRows(allLeft, true, rightRows, join, result);
+    }
+    else {
+        MyVector<Tuple> shuffledLeft;
+        MyVector<Tuple> shuffledRight;
+        shuffleRows(leftRows, join.leftKey, shuffledLeft, comm);
+        shuffleRows(rightRows, join.rightKey, shuffledRight, comm);
+        hashJoinRows(shuffledRight, false, shuffledLeft, join, result);
     }
+}
+
+// Message tags of the pipelined protocol. Every command is a single message
+// from the master and every reply a single message back, both carrying the
+// statement's sequence number so several statements can be in flight at once.
+// A command for a partition the worker mirrors is tagged with its replica slot.
+// A reply left in shared memory is announced on SHARED_REPLY_TAG instead.
+const int COMMAND_TAG = 1;
+const int REPLY_TAG = 2;
+const int SHARED_REPLY_TAG = 3;
+const int REPLICA_TAG = 16;  // Plus the slot: partition (worker - slot) mod workers
+const int MAX_REPLICAS = 8;
+const int DEFAULT_PIPELINE_WINDOW = 32;
+const int DEFAULT_SCAN_BATCH = 32;  // Consecutive SELECTs answered by one shared scan
+
+// Leads every command message. The body that follows depends on the command:
+// a WorkItem for INSERT/UPDATE/DELETE, a SelectQuery, a JoinQuery, a
+// TableSchema, a ViewSchema, the int index of the view read, bodyCount Tuples
+// moved to this worker by an UPDATE, or bodyCount BatchEntries for a batch of
+// SELECTs. EXPLAIN ANALYZE sends its SelectQuery as an 'A'. An INSERT, UPDATE
+// or DELETE from a prepared statement sends only the statement's parameter
+// values, as an 'X', to a worker holding the statement; the first time it
+// goes to a worker it is a 'P', with the PreparedStatement before the values.
+struct CommandHeader {
+    char command;   // 'I', 'S', 'B' (batch of SELECTs), 'U', 'D', 'C' (create table), 'V' (create view), 'G' (read view),
+                    // 'J' (join), 'M' (move rows in), 'A' (EXPLAIN ANALYZE), 'P' and 'X' (prepared write), 'Q' (quit)
+    int seq;
+    int table;
+    int bodyCount;  // The prepared statement's number for a 'P' or 'X'
 };
 
-class Database {
-private:
-    Tuple* data;
-    int capacity;
-    int size;
-    bool* isDeleted;  // Track deleted records
-    void formatSelectResult(const Tuple& tuple, const SelectQuery& query, char* result, int& resultPos) {
-        // Reset resultPos
-        resultPos = 0;
-        bool firstColumn = true;
+// One SELECT of a batch, all on the table named in the CommandHeader
+struct BatchEntry {
+    int seq;
+    SelectQuery query;
+};
 
-        // Calculate maximum required space for the result
-        // Add extra space for commas, spaces, and newline
-        int maxRequiredSpace = 2 * MAX_ATTR_LENGTH + 20;  // Extra space for commas, spaces, number conversion
+// Leads every reply in a reply message. rowCount Tuples follow, then textLength
+// characters, then summaryCount ints of value summary changes (see
+// ValueSummary::apply). A batch is answered with one message holding a reply
+// per SELECT. The text of a view read holds the partition's GroupRows; that
+// of an EXPLAIN ANALYZE starts with a ScanReport. An ordered run of more than
+// MAX_REPLY_ROWS rows comes in several replies, each its own message but the
+// last, and only the last carries text.
+struct ReplyHeader {
+    int seq;
+    int worker;         // Rank whose partition was read or written; a replica answers for it
+    int affectedCount;  // Rows updated or deleted
+    int tupleCount;     // Live tuples in the statement's table afterwards
+    int rowCount;
+    int textLength;
+    int summaryCount;   // UPDATE and DELETE only
+    int rowsToFollow;   // Rows of the run still to come in later replies
+};
 
-        if (query.isColumnSelected("attr1")) {
-            if (!firstColumn && resultPos < MAX_RESULT_LENGTH - 2) {
-                result[resultPos++] = ',';
-                result[resultPos++] = ' ';
-            }
-            int j = 0;
-            while (tuple.attr1[j] != '\0' && resultPos < MAX_RESULT_LENGTH - 2) {
-                result[resultPos++] = tuple.attr1[j++];
-            }
-            firstColumn = false;
-        }
+const int MAX_REPLY_ROWS = 1 << 16;  // Tuples in one reply, about 13 MB of them
 
-        if (query.isColumnSelected("attr2")) {
-            if (!firstColumn && resultPos < MAX_RESULT_LENGTH - 2) {
-                result[resultPos++] = ',';
-                result[resultPos++] = ' ';
-            }
-            int j = 0;
-            while (tuple.attr2[j] != '\0' && resultPos < MAX_RESULT_LENGTH - 2) {
-                result[resultPos++] = tuple.attr2[j++];
-            }
-            firstColumn = false;
-        }
+// What one worker's scan of an EXPLAIN ANALYZE did
+struct ScanReport {
+    long long rowsScanned;
+    long long rowsMatched;
+    long long blocksSkipped;
+    long long spillReads;
+    double scanSeconds;
+};
 
-        if (query.isColumnSelected("attr3")) {
-            if (!firstColumn && resultPos < MAX_RESULT_LENGTH - 2) {
-                result[resultPos++] = ',';
-                result[resultPos++] = ' ';
-            }
+// Tag of a command for the copy of a partition in the given replica slot.
+// Slot 0 is the partition's own worker; slot k is the k-th worker after it.
+int commandTag(int slot) {
+    return slot == 0 ? COMMAND_TAG : REPLICA_TAG + slot;
+}
 
-            // Convert number to string with buffer safety
-            char numStr[20];  // More than enough for any integer
-            snprintf(numStr, sizeof(numStr), "%d", tuple.attr3);
+// Custom byte copy function
+void copyBytes(void* dest, const void* src, size_t count) {
+    char* destBytes = (char*)dest;
+    const char* srcBytes = (const char*)src;
+    for (size_t i = 0; i < count; ++i) {
+        destBytes[i] = srcBytes[i];
+    }
+}
 
-            // Copy number to result with bounds checking
-            int j = 0;
-            while (numStr[j] != '\0' && resultPos < MAX_RESULT_LENGTH - 2) {
-                result[resultPos++] = numStr[j++];
-            }
-        }
+void appendBytes(std::string& message, const void* data, size_t count) {
+    message.append((const char*)data, count);
+}
 
-        // Ensure space for newline and null terminator
-        if (resultPos < MAX_RESULT_LENGTH - 2) {
-            result[resultPos++] = '\n';
-            result[resultPos] = '\0';
-        }
-        else {
-            // If we're at the buffer limit, ensure proper termination
-            result[MAX_RESULT_LENGTH - 2] = '\n';
-            result[MAX_RESULT_LENGTH - 1] = '\0';
-            resultPos = MAX_RESULT_LENGTH - 1;
-        }
-    }
+// Statement latencies in buckets a quarter power of two wide, starting at one
+// microsecond, so percentiles cost no per-statement storage
+const int LATENCY_BUCKETS = 160;
 
+class LatencyHistogram {
+private:
+    long long counts[LATENCY_BUCKETS];
+    long long total;
+    double maxSeconds;
+
+    static int bucketOf(double seconds) {
+        double micros = seconds * 1e6;
+        if (micros < 1.0) return 0;
+        int bucket = (int)(4.0 * std::log2(micros)) + 1;
+        return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+    }
 
 public:
-    Database() : capacity(MAX_TUPLES), size(0) {
-        data = new Tuple[capacity];
-        isDeleted = new bool[capacity]();  // Initialize all to false
+    LatencyHistogram() : total(0), maxSeconds(0.0) {
+        for (int i = 0; i < LATENCY_BUCKETS; ++i) counts[i] = 0;
+    }
+
+    // Upper edge of a bucket in seconds
+    static double bucketLimit(int bucket) {
+        return std::pow(2.0, bucket / 4.0) * 1e-6;
+    }
+
+    void record(double seconds) {
+        counts[bucketOf(seconds)]++;
+        total++;
+        if (seconds > maxSeconds) maxSeconds = seconds;
     }
 
-    ~Database() {
-        delete[] data;
-        delete[] isDeleted;
+    long long getCount() const {
+        return total;
     }
 
-    int getNumTuples() const {
-        int activeTuples = 0;
-        for (int i = 0; i < size; i++) {
-            if (!isDeleted[i]) {
-                activeTuples++;
+    long long getBucketCount(int bucket) const {
+        return counts[bucket];
+    }
+
+    double getMax() const {
+        return maxSeconds;
+    }
+
+    // Upper edge of the bucket holding the given fraction of samples, capped at the maximum
+    double percentile(double fraction) const {
+        long long target = (long long)std::ceil(fraction * total);
+        if (target < 1) target = 1;
+        long long seen = 0;
+        for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= target) {
+                double limit = bucketLimit(i);
+                return limit < maxSeconds ? limit : maxSeconds;
             }
         }
-        return activeTuples;
+        return maxSeconds;
     }
+};
+
+const int STATEMENT_TYPES = 6;
+const char* const STATEMENT_TYPE_NAMES[STATEMENT_TYPES] = { "INSERT", "SELECT", "UPDATE", "DELETE", "JOIN", "OTHER" };
+
+int statementType(char command) {
+    switch (command) {
+    case 'I': return 0;
+    case 'S': return 1;
+    case 'G': return 1;
+    case 'U': return 2;
+    case 'D': return 3;
+    case 'J': return 4;
+    default: return 5;
+    }
+}
 
-    void insert(const char* attr1, const char* attr2, int attr3) {
-        if (size < capacity) {
-            safeCopyString(data[size].attr1, attr1, MAX_ATTR_LENGTH);
-            safeCopyString(data[size].attr2, attr2, MAX_ATTR_LENGTH);
-            data[size].attr3 = attr3;
-            size++;
-            isDeleted[size] = false;
-            std::cout << "Inserted: " << attr1 << ", " << attr2 << ", " << attr3 << std::endl;
+// Peak resident set size of this process in kB, or -1 where /proc is not available
+long long readPeakRssKb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::stoll(line.substr(6));
         }
     }
+    return -1;
+}
 
-    int deleteRecords(const char* whereAttr1, const char* whereAttr2, int whereAttr3, std::ofstream& outputFile) {
-        int deletedCount = 0;
+// Per-statement latencies by statement type, measured on the process that reads the input
+class StatementStats {
+private:
+    LatencyHistogram latencies[STATEMENT_TYPES];
+    double startTime;
+    double elapsedSeconds;
 
-        for (int i = 0; i < size; ++i) {
-            if (isDeleted[i]) continue;  // Skip already deleted records
+public:
+    StatementStats() : startTime(0.0), elapsedSeconds(0.0) {}
 
-            bool attr1Match = (safeStringLength(whereAttr1, MAX_ATTR_LENGTH) == 0) ||
-                (whereAttr1[0] == '*') ||
-                matchesPattern(data[i].attr1, whereAttr1, MAX_ATTR_LENGTH);
+    void start() {
+        startTime = MPI_Wtime();
+    }
 
-            bool attr2Match = (safeStringLength(whereAttr2, MAX_ATTR_LENGTH) == 0) ||
-                (whereAttr2[0] == '*') ||
-                matchesPattern(data[i].attr2, whereAttr2, MAX_ATTR_LENGTH);
+    void stop() {
+        elapsedSeconds = MPI_Wtime() - startTime;
+    }
 
-            bool attr3Match = (whereAttr3 == -1) || (data[i].attr3 == whereAttr3);
+    void record(char command, double seconds) {
+        latencies[statementType(command)].record(seconds);
+    }
 
-            if (attr1Match && attr2Match && attr3Match) {
-                // Log the deleted record
-                outputFile << "Deleted record " << i << ": "
-                    << data[i].attr1 << ", "
-                    << data[i].attr2 << ", "
-                    << data[i].attr3 << "\n";
+    // Write the run summary as JSON; peakRssKb holds one value per rank
+    void write(std::ostream& out, int ranks, const long long* peakRssKb) const {
+        long long statements = 0;
+        for (int t = 0; t < STATEMENT_TYPES; ++t) statements += latencies[t].getCount();
+
+        out << "{\n";
+        out << "  \"ranks\": " << ranks << ",\n";
+        out << "  \"statements\": " << statements << ",\n";
+        out << "  \"elapsedSeconds\": " << elapsedSeconds << ",\n";
+        out << "  \"statementsPerSecond\": " << (elapsedSeconds > 0 ? statements / elapsedSeconds : 0.0) << ",\n";
+        out << "  \"operations\": [";
+        bool first = true;
+        for (int t = 0; t < STATEMENT_TYPES; ++t) {
+            const LatencyHistogram& histogram = latencies[t];
+            if (histogram.getCount() == 0) continue;
+
+            out << (first ? "\n" : ",\n");
+            out << "    {\"type\": \"" << STATEMENT_TYPE_NAMES[t] << "\""
+                << ", \"count\": " << histogram.getCount()
+                << ", \"perSecond\": " << (elapsedSeconds > 0 ? histogram.getCount() / elapsedSeconds : 0.0)
+                << ", \"p50Ms\": " << histogram.percentile(0.50) * 1000.0
+                << ", \"p99Ms\": " << histogram.percentile(0.99) * 1000.0
+                << ", \"maxMs\": " << histogram.getMax() * 1000.0 << "}";
+            first = false;
+        }
+        out << "\n  ],\n";
+        out << "  \"peakRssKb\": [";
+        for (int r = 0; r < ranks; ++r) {
+            out << (r > 0 ? ", " : "") << peakRssKb[r];
+        }
+        out << "]\n";
+        out << "}\n";
+    }
 
-                isDeleted[i] = true;
-                deletedCount++;
+    // Write this rank's report: the latency histogram of every statement type,
+    // as the upper edge of each non-empty bucket and its count
+    void writeReport(std::ostream& out, int rank, const char* role) const {
+        out << "{\n";
+        out << "  \"rank\": " << rank << ",\n";
+        out << "  \"role\": \"" << role << "\",\n";
+        out << "  \"elapsedSeconds\": " << elapsedSeconds << ",\n";
+        out << "  \"latencies\": [";
+        bool first = true;
+        for (int t = 0; t < STATEMENT_TYPES; ++t) {
+            const LatencyHistogram& histogram = latencies[t];
+            if (histogram.getCount() == 0) continue;
+
+            out << (first ? "\n" : ",\n");
+            out << "    {\"type\": \"" << STATEMENT_TYPE_NAMES[t] << "\""
+                << ", \"count\": " << histogram.getCount()
+                << ", \"p50Ms\": " << histogram.percentile(0.50) * 1000.0
+                << ", \"p90Ms\": " << histogram.percentile(0.90) * 1000.0
+                << ", \"p99Ms\": " << histogram.percentile(0.99) * 1000.0
+                << ", \"maxMs\": " << histogram.getMax() * 1000.0
+                << ", \"buckets\": [";
+            bool firstBucket = true;
+            for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+                if (histogram.getBucketCount(b) == 0) continue;
+                out << (firstBucket ? "" : ", ") << "[" << LatencyHistogram::bucketLimit(b) * 1000.0
+                    << ", " << histogram.getBucketCount(b) << "]";
+                firstBucket = false;
             }
+            out << "]}";
+            first = false;
         }
-
-        return deletedCount;
+        out << "\n  ]\n";
+        out << "}\n";
     }
+};
 
-    int update(const char* whereAttr1, const char* whereAttr2, int whereAttr3,
-        const char* setAttr1, const char* setAttr2, int setAttr3, std::ofstream& outputFile) {
-        int updatedCount = 0;
-
-        for (int i = 0; i < size; ++i) {
-            if (isDeleted[i]) continue;  // Skip deleted records
-            bool attr1Match = (safeStringLength(whereAttr1, MAX_ATTR_LENGTH) == 0) ||
-                (whereAttr1[0] == '*') ||
-                matchesPattern(data[i].attr1, whereAttr1, MAX_ATTR_LENGTH);
-
-            bool attr2Match = (safeStringLength(whereAttr2, MAX_ATTR_LENGTH) == 0) ||
-                (whereAttr2[0] == '*') ||
-                matchesPattern(data[i].attr2, whereAttr2, MAX_ATTR_LENGTH);
+// Phases of a worker serving a statement
+const int PHASE_RECEIVE = 0;  // Waiting for and receiving the command, idle time included
+const int PHASE_DECODE = 1;
+const int PHASE_SCAN = 2;
+const int PHASE_FORMAT = 3;
+const int PHASE_SEND = 4;
+const int PHASE_COUNT = 5;
+const char* const PHASE_NAMES[PHASE_COUNT] = { "receive", "decode", "scan", "format", "send" };
+
+// Where a worker's time goes. All time is charged to the current phase until
+// the next enter(), so the receiving thread's phases add up to the worker's
+// run time; the executor threads' time is added on top.
+class WorkerProfile {
+private:
+    double phaseSeconds[PHASE_COUNT];
+    int phase;
+    double phaseStart;
 
-            bool attr3Match = (whereAttr3 == -1) || (data[i].attr3 == whereAttr3);
+public:
+    long long statements[STATEMENT_TYPES];
+    long long messagesReceived;
+    long long bytesReceived;
+    long long messagesSent;
+    long long bytesSent;
+    long long sharedReplies;  // Replies left in shared memory for the master, counted in messagesSent too
+    long long rowsScanned;
+    long long rowsMatched;
+    long long blocksSkipped;
+    long long spillReads;
+    long long storageBytes;  // Row data held in memory at the end, sealed or not
+    long long spilledBytes;  // Row data in spill files at the end
+
+    WorkerProfile() : phase(PHASE_RECEIVE), phaseStart(0.0), messagesReceived(0), bytesReceived(0),
+        messagesSent(0), bytesSent(0), sharedReplies(0), rowsScanned(0), rowsMatched(0), blocksSkipped(0), spillReads(0), storageBytes(0),
+        spilledBytes(0) {
+        for (int i = 0; i < PHASE_COUNT; ++i) phaseSeconds[i] = 0.0;
+        for (int i = 0; i < STATEMENT_TYPES; ++i) statements[i] = 0;
+    }
 
-            if (attr1Match && attr2Match && attr3Match) {
-                // Store old values for output
-                char oldAttr1[MAX_ATTR_LENGTH], oldAttr2[MAX_ATTR_LENGTH];
-                int oldAttr3;
+    void start() {
+        phase = PHASE_RECEIVE;
+        phaseStart = MPI_Wtime();
+    }
 
-                safeCopyString(oldAttr1, data[i].attr1, MAX_ATTR_LENGTH);
-                safeCopyString(oldAttr2, data[i].attr2, MAX_ATTR_LENGTH);
-                oldAttr3 = data[i].attr3;
+    void enter(int nextPhase) {
+        double now = MPI_Wtime();
+        phaseSeconds[phase] += now - phaseStart;
+        phase = nextPhase;
+        phaseStart = now;
+    }
 
-                // Perform the update
-                if (safeStringLength(setAttr1, MAX_ATTR_LENGTH) > 0) {
-                    safeCopyString(data[i].attr1, setAttr1, MAX_ATTR_LENGTH);
-                }
-                if (safeStringLength(setAttr2, MAX_ATTR_LENGTH) > 0) {
-                    safeCopyString(data[i].attr2, setAttr2, MAX_ATTR_LENGTH);
-                }
-                if (setAttr3 != -1) {
-                    data[i].attr3 = setAttr3;
-                }
+    // Charge time spent off the receiving thread, e.g. by the executors
+    void addSeconds(int timedPhase, double seconds) {
+        phaseSeconds[timedPhase] += seconds;
+    }
 
-                // Output the before and after values
-                outputFile << "Updated record " << i << ":\n";
-                outputFile << "  Before: " << oldAttr1 << ", " << oldAttr2 << ", " << oldAttr3 << "\n";
-                outputFile << "  After:  " << data[i].attr1 << ", " << data[i].attr2 << ", " << data[i].attr3 << "\n";
+    // Fold in a table's scan counters; its formatting time was charged to the scan
+    void addScanCounters(const ScanCounters& counters) {
+        rowsScanned += counters.rowsScanned;
+        rowsMatched += counters.rowsMatched;
+        blocksSkipped += counters.blocksSkipped;
+        spillReads += counters.spillReads;
+        phaseSeconds[PHASE_SCAN] -= counters.formatSeconds;
+        phaseSeconds[PHASE_FORMAT] += counters.formatSeconds;
+    }
 
-                updatedCount++;
-            }
+    void write(std::ostream& out, int rank) const {
+        out << "{\n";
+        out << "  \"rank\": " << rank << ",\n";
+        out << "  \"role\": \"worker\",\n";
+        out << "  \"phaseSeconds\": {";
+        for (int i = 0; i < PHASE_COUNT; ++i) {
+            out << (i > 0 ? ", " : "") << "\"" << PHASE_NAMES[i] << "\": " << phaseSeconds[i];
         }
-
-        return updatedCount;
+        out << "},\n";
+        out << "  \"statements\": {";
+        for (int t = 0; t < STATEMENT_TYPES; ++t) {
+            out << (t > 0 ? ", " : "") << "\"" << STATEMENT_TYPE_NAMES[t] << "\": " << statements[t];
+        }
+        out << "},\n";
+        out << "  \"messagesReceived\": " << messagesReceived << ",\n";
+        out << "  \"bytesReceived\": " << bytesReceived << ",\n";
+        out << "  \"messagesSent\": " << messagesSent << ",\n";
+        out << "  \"bytesSent\": " << bytesSent << ",\n";
+        out << "  \"sharedReplies\": " << sharedReplies << ",\n";
+        out << "  \"rowsScanned\": " << rowsScanned << ",\n";
+        out << "  \"rowsMatched\": " << rowsMatched << ",\n";
+        out << "  \"blocksSkipped\": " << blocksSkipped << ",\n";
+        out << "  \"spillReads\": " << spillReads << ",\n";
+        out << "  \"storageBytes\": " << storageBytes << ",\n";
+        out << "  \"spilledBytes\": " << spilledBytes << "\n";
+        out << "}\n";
     }
+};
 
+// Packed workload files, as written by workload_generator -b, start with this
+// tag and hold each statement as a 4-byte little-endian length and its text
+const char WORKLOAD_MAGIC[] = "PDBWORK1";
+const int WORKLOAD_MAGIC_LENGTH = 8;
 
-    void query(const char* attr1, const char* attr2, int attr3, char* result) {
-        result[0] = '\0';
-        char tempResult[MAX_RESULT_LENGTH];
-        int resultPos = 0;
-        bool anyResultFound = false;
+// Reads statements from a text workload, one per line, or a packed one
+class StatementReader {
+private:
+    std::ifstream input;
+    bool packed;
 
-        for (int i = 0; i < size; ++i) {
-            if (isDeleted[i]) continue;  // Skip deleted records
-            // More comprehensive matching logic
-            bool attr1Match = (safeStringLength(attr1, MAX_ATTR_LENGTH) == 0) ||
-                (attr1[0] == '*') ||
-                matchesPattern(data[i].attr1, attr1, MAX_ATTR_LENGTH);
+public:
+    explicit StatementReader(const std::string& fileName) : input(fileName, std::ios::in | std::ios::binary), packed(false) {
+        char magic[WORKLOAD_MAGIC_LENGTH];
+        if (input.read(magic, WORKLOAD_MAGIC_LENGTH) && safeCompareStrings(magic, WORKLOAD_MAGIC, WORKLOAD_MAGIC_LENGTH)) {
+            packed = true;
+            return;
+        }
+        input.clear();
+        input.seekg(0);
+    }
 
-            bool attr2Match = (safeStringLength(attr2, MAX_ATTR_LENGTH) == 0) ||
-                (attr2[0] == '*') ||
-                matchesPattern(data[i].attr2, attr2, MAX_ATTR_LENGTH);
+    bool is_open() const {
+        return input.is_open();
+    }
 
-            bool attr3Match = (attr3 == -1) || (data[i].attr3 == attr3);
+    // Read the next statement into command; false at the end of the input
+    bool next(char* command, int maxLength) {
+        if (!packed) {
+            if (!input.getline(command, maxLength)) return false;
 
-            if (attr1Match && attr2Match && attr3Match) {
-                // Construct result string
-                safeCopyString(tempResult, "Found: ", MAX_RESULT_LENGTH);
-                resultPos = 7;
+            // The file is open in binary mode, so drop the \r of Windows line endings
+            int length = safeStringLength(command, maxLength);
+            if (length > 0 && command[length - 1] == '\r') command[length - 1] = '\0';
+            return true;
+        }
 
-                // Copy attr1
-                int j = 0;
-                while (data[i].attr1[j] != '\0' && resultPos < MAX_RESULT_LENGTH - 3) {
-                    tempResult[resultPos++] = data[i].attr1[j++];
-                }
-                tempResult[resultPos++] = ',';
-                tempResult[resultPos++] = ' ';
+        unsigned char lengthBytes[4];
+        if (!input.read((char*)lengthBytes, 4)) return false;
+        int length = lengthBytes[0] | (lengthBytes[1] << 8) | (lengthBytes[2] << 16) | (lengthBytes[3] << 24);
+        if (length < 0 || length >= maxLength) return false;
+        if (!input.read(command, length)) return false;
+        command[length] = '\0';
+        return true;
+    }
 
-                // Copy attr2
-                j = 0;
-                while (data[i].attr2[j] != '\0' && resultPos < MAX_RESULT_LENGTH - 3) {
-                    tempResult[resultPos++] = data[i].attr2[j++];
-                }
-                tempResult[resultPos++] = ',';
-                tempResult[resultPos++] = ' ';
+    void close() {
+        input.close();
+    }
+};
 
-                // Convert attr3 to string
-                int num = data[i].attr3;
-                char numStr[12];
-                int numLen = 0;
+// Output formats: the plain text of every statement, or one record per
+// statement as CSV (statement number, type, quoted text) or packed binary
+// (tag, then a 4-byte statement number, the command letter, a 4-byte length
+// and the text, little-endian) so tools can split the output per statement
+const int OUTPUT_TEXT = 0;
+const int OUTPUT_CSV = 1;
+const int OUTPUT_BINARY = 2;
+const char OUTPUT_MAGIC[] = "PDBOUT01";
+const int OUTPUT_MAGIC_LENGTH = 8;
+const size_t OUTPUT_BUFFER_SIZE = 1 << 22;     // Bytes per output buffer
+const int DEFAULT_OUTPUT_FLUSH_MS = 1000;
+
+int parseOutputFormat(const std::string& name) {
+    if (name == "text") return OUTPUT_TEXT;
+    if (name == "csv") return OUTPUT_CSV;
+    if (name == "binary") return OUTPUT_BINARY;
+    return -1;
+}
 
-                if (num == 0) {
-                    numStr[numLen++] = '0';
-                }
-                else {
-                    int temp = num;
-                    while (temp > 0) {
-                        numStr[numLen++] = '0' + (temp % 10);
-                        temp /= 10;
-                    }
-                }
+void appendLittleEndian(std::string& out, unsigned int value) {
+    for (int i = 0; i < 4; ++i) {
+        out += (char)((value >> (8 * i)) & 0xff);
+    }
+}
 
-                // Reverse number string
-                for (int k = 0; k < numLen / 2; k++) {
-                    char temp = numStr[k];
-                    numStr[k] = numStr[numLen - 1 - k];
-                    numStr[numLen - 1 - k] = temp;
+// Output file written by a background thread. Statements are appended to one
+// buffer while the thread writes the other, so the caller only waits on the
+// disk when it fills a buffer faster than the disk drains one. The file is
+// flushed every flushMs milliseconds (never if 0) and when it is closed.
+class OutputWriter {
+private:
+    std::ofstream file;
+    int format;
+    int flushMs;
+    std::string filling;   // Appended to by the caller
+    std::string draining;  // Being written by the thread
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable wake;     // Wakes the thread: a full buffer or closing
+    std::condition_variable drained;  // Wakes the caller: the thread's buffer is free
+    std::thread thread;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::chrono::steady_clock::time_point nextFlush = std::chrono::steady_clock::now() + std::chrono::milliseconds(flushMs);
+
+        while (true) {
+            bool flushDue = stopping;
+            while (draining.empty() && !stopping) {
+                if (flushMs <= 0) {
+                    wake.wait(lock);
                 }
-
-                // Append number to result
-                for (int k = 0; k < numLen && resultPos < MAX_RESULT_LENGTH - 2; k++) {
-                    tempResult[resultPos++] = numStr[k];
+                else if (wake.wait_until(lock, nextFlush) == std::cv_status::timeout) {
+                    flushDue = true;
+                    break;
                 }
+            }
+            if (stopping) flushDue = true;
 
-                tempResult[resultPos++] = '\n';
-                tempResult[resultPos] = '\0';
-
-                // Append to results if not already found
-                if (!anyResultFound) {
-                    safeCopyString(result, tempResult, MAX_RESULT_LENGTH);
-                    anyResultFound = true;
-                }
-                else {
-                    // If multiple results found, append to existing result
-                    int currentLen = safeStringLength(result, MAX_RESULT_LENGTH);
-                    if (currentLen + resultPos < MAX_RESULT_LENGTH) {
-                        safeCopyString(result + currentLen, tempResult, MAX_RESULT_LENGTH - currentLen);
-                    }
-                }
+            // Take whatever is buffered when a flush is due
+            if (draining.empty() && flushDue) {
+                filling.swap(draining);
+            }
+            if (draining.empty() && stopping) break;
 
-                std::cout << "Found match: " << tempResult << std::endl;
+            lock.unlock();
+            file.write(draining.data(), draining.size());
+            if (flushDue && flushMs > 0) {
+                file.flush();
+                nextFlush = std::chrono::steady_clock::now() + std::chrono::milliseconds(flushMs);
             }
+            lock.lock();
+
+            draining.clear();
+            drained.notify_one();
         }
+        file.flush();
     }
-    void enhancedQuery(const SelectQuery& query, char* result) {
-        result[0] = '\0';
-        char tempResult[MAX_RESULT_LENGTH];
-        int resultPos = 0;
-        int totalResultPos = 0;
-        bool anyResultFound = false;
 
-        for (int i = 0; i < size; ++i) {
-            if (isDeleted[i]) continue;
+    void append(const std::string& data) {
+        std::unique_lock<std::mutex> lock(mutex);
+        filling += data;
+        if (filling.size() < OUTPUT_BUFFER_SIZE) return;
 
-            bool attr1Match = (safeStringLength(query.attr1Condition, MAX_ATTR_LENGTH) == 0) ||
-                (query.attr1Condition[0] == '*') ||
-                matchesPattern(data[i].attr1, query.attr1Condition, MAX_ATTR_LENGTH);
+        while (!draining.empty()) drained.wait(lock);
+        filling.swap(draining);
+        wake.notify_one();
+    }
 
-            bool attr2Match = (safeStringLength(query.attr2Condition, MAX_ATTR_LENGTH) == 0) ||
-                (query.attr2Condition[0] == '*') ||
-                matchesPattern(data[i].attr2, query.attr2Condition, MAX_ATTR_LENGTH);
+public:
+    OutputWriter(const std::string& fileName, int outputFormat, int flushIntervalMs)
+        : file(fileName, std::ios::out | std::ios::binary), format(outputFormat), flushMs(flushIntervalMs), stopping(false) {
+        filling.reserve(OUTPUT_BUFFER_SIZE);
+        draining.reserve(OUTPUT_BUFFER_SIZE);
+        if (!file.is_open()) return;
+
+        if (format == OUTPUT_CSV) filling = "statement,type,output\n";
+        else if (format == OUTPUT_BINARY) filling.assign(OUTPUT_MAGIC, OUTPUT_MAGIC_LENGTH);
+        thread = std::thread(&OutputWriter::run, this);
+    }
 
-            bool attr3Match = (query.attr3Condition == -1) || (data[i].attr3 == query.attr3Condition);
+    ~OutputWriter() {
+        close();
+    }
 
-            if (attr1Match && attr2Match && attr3Match) {
-                // Reset tempResult for each match
-                tempResult[0] = '\0';
-                resultPos = 0;
+    bool is_open() const {
+        return file.is_open();
+    }
 
-                formatSelectResult(data[i], query, tempResult, resultPos);
+    // Queue the output of statement seq (numbered from 0), in statement order
+    void writeStatement(int seq, char command, const std::string& text) {
+        if (format == OUTPUT_TEXT) {
+            if (!text.empty()) append(text);
+            return;
+        }
 
-                // Check if we have space in the main result buffer
-                if (totalResultPos + resultPos < MAX_RESULT_LENGTH) {
-                    if (!anyResultFound) {
-                        safeCopyString(result, tempResult, MAX_RESULT_LENGTH);
-                        totalResultPos = resultPos;
-                    }
-                    else {
-                        safeCopyString(result + totalResultPos, tempResult, MAX_RESULT_LENGTH - totalResultPos);
-                        totalResultPos += resultPos;
-                    }
-                    anyResultFound = true;
-                }
+        std::string record;
+        if (format == OUTPUT_CSV) {
+            record = std::to_string(seq + 1) + "," + STATEMENT_TYPE_NAMES[statementType(command)] + ",\"";
+            for (char c : text) {
+                if (c == '"') record += '"';
+                record += c;
             }
+            record += "\"\n";
+        }
+        else {
+            appendLittleEndian(record, (unsigned int)(seq + 1));
+            record += command;
+            appendLittleEndian(record, (unsigned int)text.length());
+            record += text;
         }
+        append(record);
+    }
 
-        if (!anyResultFound) {
-            result[0] = '\0';
+    // Write out everything queued and stop the thread
+    void close() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
         }
+        wake.notify_one();
+        thread.join();
+        file.close();
     }
 };
 
-void extractValue(const char* input, char* output, int& pos, int maxLen) {
-    int outIdx = 0;
-    while (input[pos] == ' ' || input[pos] == '(') pos++;
+// EXPLAIN: the conditions a statement filters on, INT_MIN / INT_MAX for no attr3 range
+void describeConditions(const char* attr1Condition, const char* attr2Condition, int attr3Condition,
+    int attr3Low, int attr3High, std::ostream& plan) {
+    plan << "  Filter:";
+    bool any = false;
+    if (attr1Condition[0] != '\0' && attr1Condition[0] != '*') {
+        plan << " attr1=" << attr1Condition;
+        any = true;
+    }
+    if (attr2Condition[0] != '\0' && attr2Condition[0] != '*') {
+        plan << (any ? " AND" : "") << " attr2=" << attr2Condition;
+        any = true;
+    }
+    if (attr3Condition != -1) {
+        plan << (any ? " AND" : "") << " attr3=" << attr3Condition;
+        any = true;
+    }
+    if (attr3Low != INT_MIN || attr3High != INT_MAX) {
+        plan << (any ? " AND" : "") << " attr3 in [" << attr3Low << ", " << attr3High << "]";
+        any = true;
+    }
+    if (!any) plan << " none";
+    plan << "\n";
+}
 
-    while (input[pos] != '\0' && input[pos] != ',' && input[pos] != ')' && outIdx < maxLen - 1) {
-        if (input[pos] != ' ') {
-            output[outIdx++] = input[pos];
-        }
-        pos++;
+// EXPLAIN: how a SELECT's rows are read and what the scan itself applies
+void describeScan(const SelectQuery& query, std::ostream& plan) {
+    plan << "  Access: block scan; zone maps pass over blocks that cannot match, sealed blocks are filtered on their codes\n";
+    describeConditions(query.attr1Condition, query.attr2Condition, query.attr3Condition, query.attr3Low, query.attr3High, plan);
+
+    plan << "  Columns:";
+    if (query.selectedColumnCount == 0) plan << " *";
+    for (int c = 0; c < query.selectedColumnCount; ++c) {
+        plan << (c > 0 ? ", " : " ") << query.selectedColumns[c];
     }
-    output[outIdx] = '\0';
-    if (input[pos] == ',') pos++;
+    plan << "\n";
+
+    if (query.isOrdered()) {
+        plan << "  Order:";
+        if (query.orderByColumn != 0) plan << " ORDER BY attr" << query.orderByColumn << (query.orderDescending ? " DESC" : " ASC");
+        if (query.limit >= 0) plan << " LIMIT " << query.limit << ", kept in a heap of at most " << query.limit << " rows";
+        else plan << ", every match sorted";
+        plan << "\n";
+    }
+}
+
+// Run one SELECT for EXPLAIN ANALYZE and measure its scan. No other scan may
+// run on db meanwhile, or its work would be counted too.
+ScanReport analyzeScan(const Database& db, const SelectQuery& query, ResultBuffer& result, MyVector<Tuple>& rows) {
+    ScanCounters before = db.getCounters();
+    double start = MPI_Wtime();
+    db.sharedScan(&query, 1, &result, &rows);
+    ScanReport report;
+    report.scanSeconds = MPI_Wtime() - start;
+    ScanCounters after = db.getCounters();
+    report.rowsScanned = after.rowsScanned - before.rowsScanned;
+    report.rowsMatched = after.rowsMatched - before.rowsMatched;
+    report.blocksSkipped = after.blocksSkipped - before.blocksSkipped;
+    report.spillReads = after.spillReads - before.spillReads;
+    return report;
+}
+
+void writeScanReport(const ScanReport& report, std::ostream& out) {
+    out << "rows scanned " << report.rowsScanned
+        << ", rows matched " << report.rowsMatched
+        << ", blocks skipped " << report.blocksSkipped
+        << ", spill reads " << report.spillReads
+        << ", scan " << report.scanSeconds * 1000.0 << " ms";
 }
 
-void parseInputLine(const char* line, char* attr1, char* attr2, int& attr3, char* setAttr1, char* setAttr2, int& setAttr3) {
-    int pos = 0;
+// Lines of unordered result text
+int countResultRows(const char* text, int length) {
+    int rows = 0;
+    for (int i = 0; i < length; ++i) {
+        if (text[i] == '\n') rows++;
+    }
+    return rows;
+}
 
-    // Reset everything to wildcard/empty state
-    attr1[0] = '\0';
-    attr2[0] = '\0';
-    attr3 = -1;
-    setAttr1[0] = '\0';
-    setAttr2[0] = '\0';
-    setAttr3 = -1;
+// EXPLAIN in a single process: one partition and no routing, so the plan is
+// the scan alone. ANALYZE runs a plain SELECT and reports what its scan did.
+char explainLocalStatement(char* command, Catalog& catalog, Database** tables, std::ostream& outputFile) {
+    bool analyze = findKeyword(command, "ANALYZE ") == 0;
+    if (analyze) command += 8;
+    outputFile << "Plan: " << command << "\n";
+
+    bool isSelect = command[0] == 'S' && findKeyword(command, " JOIN ") < 0 && findStatementView(command, catalog) < 0;
+    int table = isSelect ? normalizeStatement(command, catalog) : -1;
+    if (table < 0) {
+        outputFile << (isSelect ? "  Error: unknown table\n" : "  Runs directly on the local tables\n");
+        if (analyze) outputFile << "  Not analyzed: ANALYZE runs plain SELECTs only\n";
+        return 'E';
+    }
 
-    if (line[0] == 'I') {
-        // INSERT parsing remains the same as before
-        while (line[pos] != '\0' && line[pos] != '(') pos++;
-        if (line[pos] == '\0') return;
+    SelectQuery query;
+    parseSelectQuery(command, query);
+    outputFile << "  Table: " << catalog.getSchema(table).name << "\n";
+    describeScan(query, outputFile);
+    if (!analyze) return 'E';
+
+    ResultBuffer result;
+    MyVector<Tuple> rows;
+    ScanReport report = analyzeScan(*tables[table], query, result, rows);
+    int rowsReturned = countResultRows(result.getData(), result.getLength());
+    if (query.isOrdered()) {
+        std::ostringstream discarded;
+        Tuple* run = rows.getData();
+        int runSize = rows.getSize();
+        rowsReturned = mergeOrderedRuns(&run, &runSize, 1, query, discarded);
+    }
+    outputFile << "  Scan: ";
+    writeScanReport(report, outputFile);
+    outputFile << "\n  Rows returned: " << rowsReturned << "\n";
+    return 'A';
+}
 
-        extractValue(line, attr1, pos, MAX_ATTR_LENGTH);
-        extractValue(line, attr2, pos, MAX_ATTR_LENGTH);
+// Run one statement against the local tables, writing its output to outputFile.
+// Returns the statement's type letter.
+char runLocalStatement(char* command, Catalog& catalog, Database** tables, StatementTemplates& templates,
+    std::ostream& outputFile, std::ostream& tupleCountFile) {
+    if (findKeyword(command, "EXPLAIN ") == 0) {
+        return explainLocalStatement(command + 8, catalog, tables, outputFile);
+    }
 
-        while (line[pos] == ' ' || line[pos] == ',') pos++;
-        while (line[pos] >= '0' && line[pos] <= '9') {
-            attr3 = (attr3 == -1 ? 0 : attr3 * 10) + (line[pos] - '0');
-            pos++;
+    if (command[0] == 'C' && findKeyword(command, " VIEW ") >= 0) {  // CREATE MATERIALIZED VIEW
+        ViewSchema schema;
+        int view = parseCreateView(command, catalog, schema) ? catalog.createView(schema) : -1;
+        if (view < 0) {
+            outputFile << "Error: could not create view: " << command << "\n";
+        }
+        else {
+            tables[schema.table]->addView(schema.groupColumn);
         }
+        return 'V';
     }
-    else if (line[0] == 'S') {
-        // More robust SELECT parsing
-        while (line[pos] != '\0' && (line[pos] != 'W' || line[pos + 1] != 'H')) pos++;
-        if (line[pos] == '\0') return;
-
-        pos += 6;  // Move past "WHERE"
-
-        // Default to wildcard if no conditions specified
-        safeCopyString(attr1, "*", MAX_ATTR_LENGTH);
-        safeCopyString(attr2, "*", MAX_ATTR_LENGTH);
-        attr3 = -1;
-
-        // Parse all possible conditions
-        bool hasCondition = false;
-        while (line[pos] != '\0') {
-            // Check for attr1 condition
-            if (safeCompareStrings(line + pos, "attr1=", 6)) {
-                pos += 6;
-                int attrPos = 0;
-                attr1[0] = '\0';  // Reset previous value
-                while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
-                    attr1[attrPos++] = line[pos++];
-                }
-                attr1[attrPos] = '\0';
-                hasCondition = true;
-            }
-            // Check for attr2 condition
-            else if (safeCompareStrings(line + pos, "attr2=", 6)) {
-                pos += 6;
-                int attrPos = 0;
-                attr2[0] = '\0';  // Reset previous value
-                while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
-                    attr2[attrPos++] = line[pos++];
-                }
-                attr2[attrPos] = '\0';
-                hasCondition = true;
-            }
-            // Check for attr3 condition
-            else if (safeCompareStrings(line + pos, "attr3=", 6)) {
-                pos += 6;
-                attr3 = 0;
-                while (line[pos] >= '0' && line[pos] <= '9') {
-                    attr3 = attr3 * 10 + (line[pos] - '0');
-                    pos++;
-                }
-                hasCondition = true;
-            }
-            else {
-                pos++;
-            }
+
+    if (command[0] == 'C') {  // CREATE TABLE
+        TableSchema schema;
+        int table = parseCreateTable(command, schema) ? catalog.createTable(schema) : -1;
+        if (table < 0) {
+            outputFile << "Error: could not create table: " << command << "\n";
+        }
+        else {
+            tables[table] = new Database(MAX_TABLE_TUPLES);
         }
+        return 'C';
+    }
 
-        // If no conditions were found, leave everything as wildcard
-        if (!hasCondition) {
-            safeCopyString(attr1, "*", MAX_ATTR_LENGTH);
-            safeCopyString(attr2, "*", MAX_ATTR_LENGTH);
-            attr3 = -1;
+    if (command[0] == 'S' && findKeyword(command, " JOIN ") >= 0) {  // SELECT ... JOIN
+        JoinQuery join;
+        if (!parseJoinQuery(command, catalog, join)) {
+            outputFile << "Error: could not parse join: " << command << "\n";
+            return 'E';
         }
+        std::string result;
+        runDistributedJoin(join, tables, MPI_COMM_SELF, result);
+        outputFile << (result.empty() ? "No records found.\n" : result);
+        return 'J';
     }
-    else if (line[0] == 'U') {  // UPDATE
-        // Skip "UPDATE"
-        while (line[pos] != '\0' && line[pos] != 'S') pos++;
-        if (line[pos] == '\0') return;
 
-        // Parse SET clause
-        pos += 3;  // Skip "SET"
+    int view = findStatementView(command, catalog);
+    if (view >= 0) {  // SELECT from a materialized view
+        const ViewSchema& schema = catalog.getView(view);
+        MyVector<GroupRow> groups;
+        tables[schema.table]->getView(schema.tableView).collect(groups);
+        if (writeViewGroups(groups, schema, outputFile) == 0) {
+            outputFile << "No records found.\n";
+        }
+        return 'G';
+    }
 
-        // Parse SET values
-        while (line[pos] != '\0' && line[pos] != 'W') {
-            if (safeCompareStrings(line + pos, "attr1=", 6)) {
-                pos += 6;
-                int attrPos = 0;
-                while (line[pos] != '\0' && line[pos] != ',' && line[pos] != ' ' && attrPos < MAX_ATTR_LENGTH - 1) {
-                    setAttr1[attrPos++] = line[pos++];
-                }
-                setAttr1[attrPos] = '\0';
-            }
-            else if (safeCompareStrings(line + pos, "attr2=", 6)) {
-                pos += 6;
-                int attrPos = 0;
-                while (line[pos] != '\0' && line[pos] != ',' && line[pos] != ' ' && attrPos < MAX_ATTR_LENGTH - 1) {
-                    setAttr2[attrPos++] = line[pos++];
-                }
-                setAttr2[attrPos] = '\0';
-            }
-            else if (safeCompareStrings(line + pos, "attr3=", 6)) {
-                pos += 6;
-                setAttr3 = 0;
-                while (line[pos] >= '0' && line[pos] <= '9') {
-                    setAttr3 = setAttr3 * 10 + (line[pos] - '0');
-                    pos++;
-                }
-            }
-            pos++;
+    if (findKeyword(command, "PREPARE ") == 0) {
+        if (templates.prepare(command, catalog) < 0) {
+            outputFile << "Error: could not prepare: " << command << "\n";
         }
+        return 'E';
+    }
 
-        // Parse WHERE clause (similar to SELECT)
-        if (line[pos] == 'W') {
-            pos += 5;  // Skip "WHERE"
-            while (line[pos] != '\0') {
-                if (safeCompareStrings(line + pos, "attr1=", 6)) {
-                    pos += 6;
-                    int attrPos = 0;
-                    while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
-                        attr1[attrPos++] = line[pos++];
-                    }
-                    attr1[attrPos] = '\0';
-                }
-                else if (safeCompareStrings(line + pos, "attr2=", 6)) {
-                    pos += 6;
-                    int attrPos = 0;
-                    while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
-                        attr2[attrPos++] = line[pos++];
-                    }
-                    attr2[attrPos] = '\0';
-                }
-                else if (safeCompareStrings(line + pos, "attr3=", 6)) {
-                    pos += 6;
-                    attr3 = 0;
-                    while (line[pos] >= '0' && line[pos] <= '9') {
-                        attr3 = attr3 * 10 + (line[pos] - '0');
-                        pos++;
-                    }
-                }
-                else {
-                    pos++;
-                }
-            }
+    // The parsed form comes from the statement's template when it has one
+    SelectQuery query;
+    WorkItem item;
+    int prepared = -1;
+    std::string values;
+    int table;
+    char kind = command[0];
+    if (findKeyword(command, "EXECUTE ") == 0) {
+        prepared = templates.execute(command, values);
+        if (prepared < 0) {
+            outputFile << "Error: could not execute: " << command << "\n";
+            return 'E';
         }
+        bindParameters(templates.get(prepared), values.data(), query, item);
+        table = templates.get(prepared).table;
+        kind = templates.get(prepared).command;
+    }
+    else if (kind == 'S' || kind == 'I' || kind == 'U' || kind == 'D') {
+        table = templates.resolve(command, catalog, query, item, prepared, values);
     }
-    // Add DELETE parsing
-    if (line[0] == 'D') {  // DELETE
-        int pos = 0;
-        // Skip "DELETE FROM"
-        while (line[pos] != '\0' && line[pos] != 'W') pos++;
-        if (line[pos] == '\0') return;
+    else {
+        table = normalizeStatement(command, catalog);
+    }
+    if (table < 0) {
+        outputFile << "Error: unknown table: " << command << "\n";
+        return 'E';
+    }
+    Database& db = *tables[table];
 
-        pos += 5;  // Skip "WHERE"
-        while (line[pos] != '\0') {
-            if (safeCompareStrings(line + pos, "attr1=", 6)) {
-                pos += 6;
-                int attrPos = 0;
-                while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
-                    attr1[attrPos++] = line[pos++];
-                }
-                attr1[attrPos] = '\0';
+    if (kind == 'I') {  // INSERT
+        db.insert(item.attr1, item.attr2, item.attr3);
+    }
+    else if (kind == 'S') {  // SELECT
+        bool found = false;
+        if (query.isOrdered()) {
+            MyVector<Tuple> rows;
+            db.orderedQuery(query, rows);
+            Tuple* run = rows.getData();
+            int runSize = rows.getSize();
+            found = mergeOrderedRuns(&run, &runSize, 1, query, outputFile) > 0;
+        }
+        else {
+            ResultBuffer result;
+            db.enhancedQuery(query, result);
+            if (result.getLength() > 0) {
+                outputFile.write(result.getData(), result.getLength());
+                found = true;
             }
-            else if (safeCompareStrings(line + pos, "attr2=", 6)) {
-                pos += 6;
-                int attrPos = 0;
-                while (line[pos] != '\0' && line[pos] != ' ' && line[pos] != 'A' && attrPos < MAX_ATTR_LENGTH - 1) {
-                    attr2[attrPos++] = line[pos++];
-                }
-                attr2[attrPos] = '\0';
-            }
-            else if (safeCompareStrings(line + pos, "attr3=", 6)) {
-                pos += 6;
-                attr3 = 0;
-                while (line[pos] >= '0' && line[pos] <= '9') {
-                    attr3 = attr3 * 10 + (line[pos] - '0');
-                    pos++;
+        }
+
+        if (!found) {
+            outputFile << "No records found. Query attributes: ";
+            outputFile << "attr1=" << query.attr1Condition << ", ";
+            outputFile << "attr2=" << query.attr2Condition << ", ";
+            outputFile << "attr3=" << query.attr3Condition << "\n";
+        }
+
+        tupleCountFile << db.getNumTuples() << ",\n";
+    }
+    else if (kind == 'U') {  // UPDATE
+        int updateCount = db.update(item.attr1, item.attr2, item.attr3, item.setAttr1, item.setAttr2, item.setAttr3, outputFile);
+        if (updateCount < 0 && db.hasGarbage()) {
+            db.collectGarbage();
+            updateCount = db.update(item.attr1, item.attr2, item.attr3, item.setAttr1, item.setAttr2, item.setAttr3, outputFile);
+        }
+        if (updateCount < 0) {
+            outputFile << "Error: table full, no records updated\n";
+            updateCount = 0;
+        }
+        outputFile << "Total records updated: " << updateCount << "\n\n";
+
+        // Also log tuple count after update
+        tupleCountFile << db.getNumTuples() << ",\n";
+    }
+    else if (kind == 'D') {  // DELETE
+        int deleteCount = db.deleteRecords(item.attr1, item.attr2, item.attr3, outputFile);
+        outputFile << "Total records deleted: " << deleteCount << "\n\n";
+
+        // Also log tuple count after delete
+        tupleCountFile << db.getNumTuples() << ",\n";
+    }
+    return kind;
+}
+
+// File a table's segments are spilled to, one per rank, partition copy and table
+std::string spillFileName(const std::string& directory, int rank, int slot, int table) {
+    return directory + "/spill_" + std::to_string(rank) + "_" + std::to_string(slot) + "_" + std::to_string(table) + ".seg";
+}
+
+// Row data held in memory by the first copies x tableCount tables
+long long residentBytes(Database* tables[][MAX_TABLES], int copies, int tableCount) {
+    long long bytes = 0;
+    for (int copy = 0; copy < copies; ++copy) {
+        for (int table = 0; table < tableCount; ++table) {
+            bytes += tables[copy][table]->getStorageBytes();
+        }
+    }
+    return bytes;
+}
+
+// Whether the tables hold more than budget bytes and a segment that could go
+bool canSpill(Database* tables[][MAX_TABLES], int copies, int tableCount, long long budget) {
+    if (budget <= 0 || residentBytes(tables, copies, tableCount) <= budget) return false;
+    for (int copy = 0; copy < copies; ++copy) {
+        for (int table = 0; table < tableCount; ++table) {
+            if (tables[copy][table]->getResidentSegments() > 0) return true;
+        }
+    }
+    return false;
+}
+
+// Spill the segments scans read least recently, across all the tables, until
+// their row data fits in budget bytes or only unsealed rows are left. Frees
+// segments, so no scan may be running.
+void spillColdSegments(Database* tables[][MAX_TABLES], int copies, int tableCount, long long budget) {
+    long long resident = residentBytes(tables, copies, tableCount);
+    while (resident > budget) {
+        Database* coldest = nullptr;
+        int coldestBlock = -1;
+        for (int copy = 0; copy < copies; ++copy) {
+            for (int table = 0; table < tableCount; ++table) {
+                Database* db = tables[copy][table];
+                int block = db->getResidentSegments() > 0 ? db->coldestSegment() : -1;
+                if (block >= 0 && (coldest == nullptr || db->getLastScanned(block) < coldest->getLastScanned(coldestBlock))) {
+                    coldest = db;
+                    coldestBlock = block;
                 }
             }
-            else {
-                pos++;
-            }
         }
+        if (coldest == nullptr || !coldest->spillSegment(coldestBlock)) return;
+        resident = residentBytes(tables, copies, tableCount);
     }
 }
 
-void runSingleProcess(const std::string& inputFileName, const std::string& outputFileName, const std::string& tupleCountFileName) {
-    Database db;
-    std::ifstream inputFile(inputFileName);
-    std::ofstream outputFile(outputFileName, std::ios::out);
+void runSingleProcess(const std::string& inputFileName, const std::string& outputFileName, const std::string& tupleCountFileName,
+    int outputFormat, int flushMs, long long memoryBudget, const std::string& spillDirectory, StatementStats& stats) {
+    Catalog catalog;
+    StatementTemplates templates;
+    Database* tables[MAX_TABLES];
+    tables[0] = new Database();
+    StatementReader inputFile(inputFileName);
+    OutputWriter outputFile(outputFileName, outputFormat, flushMs);
     std::ofstream tupleCountFile(tupleCountFileName, std::ios::out);
 
     if (!inputFile.is_open() || !outputFile.is_open() || !tupleCountFile.is_open()) {
@@ -786,383 +1248,2244 @@ void runSingleProcess(const std::string& inputFileName, const std::string& outpu
     }
 
     char command[MAX_COMMAND_LENGTH];
-    char attr1[MAX_ATTR_LENGTH];
-    char attr2[MAX_ATTR_LENGTH];
-    int attr3;
-    char setAttr1[MAX_ATTR_LENGTH];
-    char setAttr2[MAX_ATTR_LENGTH];
-    int setAttr3;
-
-    while (inputFile.getline(command, MAX_COMMAND_LENGTH)) {
-        std::cout << "Processing command: " << command << std::endl;
+    std::ostringstream output;
+    int seq = 0;
 
-        if (command[0] == 'I') {  // INSERT
-            parseInputLine(command, attr1, attr2, attr3, setAttr1, setAttr2, setAttr3);
-            db.insert(attr1, attr2, attr3);
+    stats.start();
+    while (inputFile.next(command, MAX_COMMAND_LENGTH)) {
+        std::cout << "Processing command: " << command << std::endl;
+        double statementStart = MPI_Wtime();
+
+        output.str("");
+        char type = runLocalStatement(command, catalog, tables, templates, output, tupleCountFile);
+        outputFile.writeStatement(seq++, type, output.str());
+        stats.record(type, MPI_Wtime() - statementStart);
+
+        for (int i = 0; i < catalog.getTableCount(); ++i) {
+            tables[i]->clearSummaryChanges();
+            if (tables[i]->needsGarbageCollection()) tables[i]->collectGarbage();
+            if (tables[i]->getUnsealedBlocks() > 0) tables[i]->sealBlocks();
+            if (memoryBudget > 0 && !tables[i]->hasSpillFile()) tables[i]->setSpillFile(spillFileName(spillDirectory, 0, 0, i));
         }
-        else if (command[0] == 'S') {  // SELECT
+        if (canSpill(&tables, 1, catalog.getTableCount(), memoryBudget)) {
+            spillColdSegments(&tables, 1, catalog.getTableCount(), memoryBudget);
+        }
+    }
+    stats.stop();
+
+    for (int i = 0; i < catalog.getTableCount(); ++i) {
+        delete tables[i];
+    }
+
+    inputFile.close();
+    outputFile.close();
+    tupleCountFile.close();
+}
+
+const int SHARED_REPLY_SLOTS = 4;             // Replies a worker can have published and unread at once
+const int SHARED_REPLY_MIN_BYTES = 16 << 10;  // Smaller replies are cheaper as plain messages
+const int DEFAULT_SHARED_AREA_MB = 4;         // Per worker, set with -a; 0 sends every reply as a message
+
+// State of a slot in a worker's shared reply area
+const int SLOT_FREE = 0;
+const int SLOT_WRITING = 1;
+const int SLOT_PUBLISHED = 2;
+
+struct SharedSlot {
+    std::atomic<int> state;
+    int bytes;
+};
+
+// Reply areas of the workers on the master's node. Each such worker owns a
+// region of an MPI shared memory window, split into slots: a large reply is
+// copied into a free slot and only the slot's number is sent, on
+// SHARED_REPLY_TAG. The master reads the reply where it lies and frees the
+// slot. A reply that is small, too big for a slot, or finds every slot in
+// use goes as a normal message instead.
+class SharedReplyArea {
+private:
+    MPI_Comm nodeComm;
+    MPI_Win window;
+    long long slotBytes;
+    SharedSlot* slots;  // This worker's own slots, nullptr if it has none
+    char** areas;       // On the master, per worker, nullptr if off the node
+
+    static SharedSlot* slotsAt(char* area) {
+        return (SharedSlot*)area;
+    }
+
+    char* slotData(char* area, int slot) const {
+        return area + SHARED_REPLY_SLOTS * sizeof(SharedSlot) + slot * slotBytes;
+    }
+
+public:
+    SharedReplyArea() : nodeComm(MPI_COMM_NULL), window(MPI_WIN_NULL), slotBytes(0), slots(nullptr), areas(nullptr) {}
+
+    ~SharedReplyArea() {
+        close();
+    }
+
+    SharedReplyArea(const SharedReplyArea&) = delete;
+    SharedReplyArea& operator=(const SharedReplyArea&) = delete;
+
+    // Collective over MPI_COMM_WORLD: set up the window among the ranks that
+    // share the master's node
+    void open(int rank, int numWorkers, long long areaBytes) {
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+        int nodeSize;
+        MPI_Comm_size(nodeComm, &nodeSize);
+        int* nodeRanks = new int[nodeSize];
+        MPI_Allgather(&rank, 1, MPI_INT, nodeRanks, 1, MPI_INT, nodeComm);
+
+        // Ranks are ordered by world rank, so the master's node is the one whose first rank is 0
+        slotBytes = areaBytes / SHARED_REPLY_SLOTS;
+        if (nodeRanks[0] != 0 || nodeSize == 1 || slotBytes < SHARED_REPLY_MIN_BYTES) {
+            delete[] nodeRanks;
+            MPI_Comm_free(&nodeComm);
+            return;
+        }
+
+        MPI_Aint bytes = rank == 0 ? 0 : SHARED_REPLY_SLOTS * (sizeof(SharedSlot) + slotBytes);
+        char* base;
+        MPI_Win_allocate_shared(bytes, 1, MPI_INFO_NULL, nodeComm, &base, &window);
+        if (rank == 0) {
+            areas = new char*[numWorkers]();
+            for (int n = 1; n < nodeSize; ++n) {
+                MPI_Aint size;
+                int unit;
+                char* area;
+                MPI_Win_shared_query(window, n, &size, &unit, &area);
+                areas[nodeRanks[n] - 1] = area;
+            }
+        }
+        else {
+            slots = slotsAt(base);
+            for (int s = 0; s < SHARED_REPLY_SLOTS; ++s) {
+                new (&slots[s]) SharedSlot;
+                slots[s].state.store(SLOT_FREE, std::memory_order_relaxed);
+            }
+        }
+        delete[] nodeRanks;
+    }
+
+    // Collective over the node's ranks again; everything published has been read
+    void close() {
+        if (window != MPI_WIN_NULL) MPI_Win_free(&window);
+        if (nodeComm != MPI_COMM_NULL) MPI_Comm_free(&nodeComm);
+        delete[] areas;
+        areas = nullptr;
+        slots = nullptr;
+    }
+
+    // On a worker: hand the reply message to the master through a free slot.
+    // False if it has to be sent as a message. Executors may call it at once.
+    bool publish(const std::string& message) {
+        if (slots == nullptr || message.length() < (size_t)SHARED_REPLY_MIN_BYTES || (long long)message.length() > slotBytes) {
+            return false;
+        }
+        for (int s = 0; s < SHARED_REPLY_SLOTS; ++s) {
+            int expected = SLOT_FREE;
+            if (!slots[s].state.compare_exchange_strong(expected, SLOT_WRITING, std::memory_order_acquire)) continue;
+            message.copy(slotData((char*)slots, s), message.length());
+            slots[s].bytes = (int)message.length();
+            slots[s].state.store(SLOT_PUBLISHED, std::memory_order_release);
+            MPI_Send(&s, 1, MPI_INT, 0, SHARED_REPLY_TAG, MPI_COMM_WORLD);
+            return true;
+        }
+        return false;
+    }
+
+    // On the master: the reply message a worker published in a slot
+    const char* read(int worker, int slot, int& bytes) const {
+        SharedSlot& shared = slotsAt(areas[worker])[slot];
+        shared.state.load(std::memory_order_acquire);
+        bytes = shared.bytes;
+        return slotData(areas[worker], slot);
+    }
+
+    // On the master: the slot's reply has been taken in and may be reused
+    void release(int worker, int slot) {
+        slotsAt(areas[worker])[slot].state.store(SLOT_FREE, std::memory_order_release);
+    }
+};
+
+void appendReply(std::string& message, ReplyHeader& reply, const Tuple* rows, const char* text, int textLength) {
+    reply.textLength = textLength;
+    appendBytes(message, &reply, sizeof(ReplyHeader));
+    appendBytes(message, rows, (size_t)reply.rowCount * sizeof(Tuple));
+    appendBytes(message, text, textLength);
+}
+
+// Append a reply with an ordered run of rows. All but the last MAX_REPLY_ROWS
+// or fewer go ahead of it, MAX_REPLY_ROWS to a message added to pieces.
+void appendRunReply(std::string& message, std::deque<std::string>& pieces, ReplyHeader& reply, const Tuple* rows,
+    int rowCount, const char* text, int textLength) {
+    int sent = 0;
+    while (rowCount - sent > MAX_REPLY_ROWS) {
+        ReplyHeader piece = reply;
+        piece.rowCount = MAX_REPLY_ROWS;
+        piece.rowsToFollow = rowCount - sent - MAX_REPLY_ROWS;
+        pieces.push_back(std::string());
+        appendReply(pieces.back(), piece, rows + sent, nullptr, 0);
+        sent += MAX_REPLY_ROWS;
+    }
+    reply.rowCount = rowCount - sent;
+    reply.rowsToFollow = 0;
+    appendReply(message, reply, rows + sent, text, textLength);
+}
+
+// Hand a reply message to the master through the shared area, or else as an
+// MPI message; true if it went through the shared area
+bool deliverReply(const std::string& message, SharedReplyArea& shared) {
+    if (message.length() > (size_t)INT_MAX) {
+        std::cerr << "Error: a reply of " << message.length() << " bytes is too large for one message" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (shared.publish(message)) return true;
+    MPI_Send(message.data(), (int)message.length(), MPI_BYTE, 0, REPLY_TAG, MPI_COMM_WORLD);
+    return false;
+}
+
+void sendMessage(const std::string& message, SharedReplyArea& shared, WorkerProfile& profile) {
+    profile.enter(PHASE_SEND);
+    if (deliverReply(message, shared)) profile.sharedReplies++;
+    profile.messagesSent++;
+    profile.bytesSent += message.length();
+}
+
+void sendReply(ReplyHeader& reply, const Tuple* rows, const char* text, int textLength, SharedReplyArea& shared,
+    WorkerProfile& profile) {
+    profile.enter(PHASE_FORMAT);
+    std::string message;
+    appendReply(message, reply, rows, text, textLength);
+    sendMessage(message, shared, profile);
+}
+
+// Reply to an UPDATE or DELETE, with the summary bits it flipped
+void sendWriteReply(ReplyHeader& reply, const Tuple* rows, const std::string& text, const MyVector<int>& changes,
+    SharedReplyArea& shared, WorkerProfile& profile) {
+    profile.enter(PHASE_FORMAT);
+    reply.summaryCount = changes.getSize();
+    std::string message;
+    appendReply(message, reply, rows, text.data(), (int)text.length());
+    appendBytes(message, changes.getData(), (size_t)reply.summaryCount * sizeof(int));
+    sendMessage(message, shared, profile);
+}
+
+const int SCAN_POLL_MICROSECONDS = 50;  // How long the receive loop waits on the executors between probes
+const int DEFAULT_EXECUTOR_THREADS = 1;  // Scan threads per worker, set with -e
+const int MAX_UNSEALED_BLOCKS = 4;       // Full blocks left uncompressed before the scans are waited for
+
+// A SELECT or a batch of them, as received, queued for an executor
+struct ScanTask {
+    const Database* db;
+    int partition;   // Whose rows db holds, which the replies answer for
+    int snapshot;    // Version the scan reads: every write received before it
+    int tupleCount;  // Live rows as of that version
+    std::string message;
+};
+
+// Answer a task's SELECTs with one scan of the table, building one reply
+// message, led by the pieces of any ordered run too long for it
+void runScanTask(const ScanTask& task, std::deque<std::string>& messages) {
+    CommandHeader header;
+    copyBytes(&header, task.message.data(), sizeof(CommandHeader));
+    const char* body = task.message.data() + sizeof(CommandHeader);
+    int queryCount = header.command == 'B' ? header.bodyCount : 1;
+
+    SelectQuery* queries = new SelectQuery[queryCount];
+    int* seqs = new int[queryCount];
+    if (header.command == 'B') {
+        for (int q = 0; q < queryCount; ++q) {
+            BatchEntry entry;
+            copyBytes(&entry, body + q * sizeof(BatchEntry), sizeof(BatchEntry));
+            seqs[q] = entry.seq;
+            queries[q] = entry.query;
+        }
+    }
+    else {
+        copyBytes(&queries[0], body, sizeof(SelectQuery));
+        seqs[0] = header.seq;
+    }
+
+    // Ordered queries come back as this worker's sorted top-K run of raw
+    // tuples for the master to merge, the others as text
+    ResultBuffer* results = new ResultBuffer[queryCount];
+    MyVector<Tuple>* rows = new MyVector<Tuple>[queryCount];
+    task.db->sharedScan(queries, queryCount, results, rows, task.snapshot);
+
+    std::string message;
+    for (int q = 0; q < queryCount; ++q) {
+        ReplyHeader reply = { seqs[q], task.partition + 1, 0, task.tupleCount, 0, 0, 0, 0 };
+        appendRunReply(message, messages, reply, rows[q].getData(), rows[q].getSize(), results[q].getData(),
+            results[q].getLength());
+    }
+    messages.push_back(std::string());
+    messages.back().swap(message);
+
+    delete[] queries;
+    delete[] seqs;
+    delete[] results;
+    delete[] rows;
+}
+
+// Runs a worker's SELECTs on a pool of executor threads, each against the
+// snapshot taken when it arrived, while the receiving thread goes on applying
+// writes. With MPI_THREAD_MULTIPLE an executor sends its reply as soon as it
+// is built; otherwise replies are queued for the receiving thread to send, so
+// every MPI call stays on that thread.
+class ExecutorPool {
+private:
+    bool sendsReplies;
+    SharedReplyArea& shared;
+    int threadCount;
+    std::thread* threads;
+    std::mutex mutex;
+    std::condition_variable wake;      // A task was queued, or stopping
+    std::condition_variable finished;  // A task was answered
+    std::deque<ScanTask*> tasks;
+    std::deque<std::string> replies;
+    int unsent;        // Tasks not answered yet, and replies queued and not taken
+    bool stopping;
+    double scanSeconds;
+    double sendSeconds;
+    long long messagesSent;
+    long long bytesSent;
+    long long sharedReplies;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            while (tasks.empty() && !stopping) wake.wait(lock);
+            if (tasks.empty()) break;
+
+            ScanTask* task = tasks.front();
+            tasks.pop_front();
+            lock.unlock();
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::deque<std::string> messages;
+            runScanTask(*task, messages);
+            delete task;
+            std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+            int published = 0;
+            if (sendsReplies) {
+                for (const std::string& message : messages) {
+                    if (deliverReply(message, shared)) published++;
+                }
+            }
+            std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+
+            lock.lock();
+            scanSeconds += std::chrono::duration<double>(built - start).count();
+            if (sendsReplies) {
+                sendSeconds += std::chrono::duration<double>(sent - built).count();
+                messagesSent += messages.size();
+                for (const std::string& message : messages) bytesSent += message.length();
+                sharedReplies += published;
+                unsent--;
+            }
+            else {
+                unsent += (int)messages.size() - 1;
+                for (std::string& message : messages) {
+                    replies.push_back(std::string());
+                    replies.back().swap(message);
+                }
+            }
+            finished.notify_all();
+        }
+    }
+
+public:
+    ExecutorPool(int executorThreads, bool sendFromExecutors, SharedReplyArea& replyArea)
+        : sendsReplies(sendFromExecutors), shared(replyArea), threadCount(executorThreads < 1 ? 1 : executorThreads),
+          unsent(0), stopping(false), scanSeconds(0.0), sendSeconds(0.0), messagesSent(0), bytesSent(0), sharedReplies(0) {
+        threads = new std::thread[threadCount];
+        for (int i = 0; i < threadCount; ++i) {
+            threads[i] = std::thread(&ExecutorPool::run, this);
+        }
+    }
+
+    ~ExecutorPool() {
+        stop();
+        delete[] threads;
+    }
+
+    void submit(ScanTask* task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(task);
+        unsent++;
+        wake.notify_one();
+    }
+
+    // Whether the receiving thread must send the replies itself
+    bool queuesReplies() const {
+        return !sendsReplies;
+    }
+
+    // Take a finished reply to send; false if none is ready
+    bool takeReply(std::string& reply) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (replies.empty()) return false;
+        reply.swap(replies.front());
+        replies.pop_front();
+        unsent--;
+        return true;
+    }
+
+    // Wait up to the given time for a task to be answered, if any is outstanding
+    void waitForReply(int microseconds) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (replies.empty() && unsent > 0) {
+            finished.wait_for(lock, std::chrono::microseconds(microseconds));
+        }
+    }
+
+    // No scan is queued or running and every reply has gone out
+    bool isIdle() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return unsent == 0;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        for (int i = 0; i < threadCount; ++i) threads[i].join();
+    }
+
+    // Fold the executors' time and the replies they sent into the worker's profile
+    void addTo(WorkerProfile& profile) const {
+        profile.addSeconds(PHASE_SCAN, scanSeconds);
+        profile.addSeconds(PHASE_SEND, sendSeconds);
+        profile.messagesSent += messagesSent;
+        profile.bytesSent += bytesSent;
+        profile.sharedReplies += sharedReplies;
+    }
+
+    // Where replies too large for a plain message may be left for the master
+    SharedReplyArea& replyArea() {
+        return shared;
+    }
+};
+
+// Send the replies of the finished scans
+void sendScanReplies(ExecutorPool& scanner, WorkerProfile& profile) {
+    std::string reply;
+    while (scanner.takeReply(reply)) {
+        sendMessage(reply, scanner.replyArea(), profile);
+    }
+}
+
+// Wait for every queued scan and send its reply, e.g. before rows are moved
+void finishScans(ExecutorPool& scanner, WorkerProfile& profile) {
+    while (!scanner.isIdle()) {
+        sendScanReplies(scanner, profile);
+        scanner.waitForReply(SCAN_POLL_MICROSECONDS);
+    }
+}
+
+// Reclaim a table's dead row versions once enough have piled up, or to make
+// room when it is full. Compaction moves rows, so the scans finish first.
+void collectGarbage(Database& db, ExecutorPool& scanner, WorkerProfile& profile) {
+    if (db.needsGarbageCollection() || (db.isFull() && db.hasGarbage())) {
+        finishScans(scanner, profile);
+        db.collectGarbage();
+    }
+}
+
+// Compress a table's full blocks. Sealing frees their rows, so it waits for a
+// moment without scans, or for the scans once too many blocks are waiting.
+void sealBlocks(Database& db, ExecutorPool& scanner, WorkerProfile& profile) {
+    int unsealed = db.getUnsealedBlocks();
+    if (unsealed == 0 || (unsealed < MAX_UNSEALED_BLOCKS && !scanner.isIdle())) return;
+    finishScans(scanner, profile);
+    db.sealBlocks();
+}
+
+// Keep a worker's row data within its memory budget. Spilling frees
+// segments, so the scans finish first; it follows sealing, which has
+// usually waited for them already.
+void spillSegments(Database* tables[][MAX_TABLES], int copies, int tableCount, long long budget,
+    ExecutorPool& scanner, WorkerProfile& profile) {
+    if (!canSpill(tables, copies, tableCount, budget)) return;
+    finishScans(scanner, profile);
+    spillColdSegments(tables, copies, tableCount, budget);
+}
+
+void runWorker(int rank, int numWorkers, int replicas, int executorThreads, bool executorsSend, long long memoryBudget,
+    const std::string& spillDirectory, MPI_Comm workerComm, SharedReplyArea& shared, WorkerProfile& profile) {
+    // Every table is stored once per partition this worker holds: its own in
+    // slot 0 and the ones it mirrors for the workers before it in the others
+    Catalog catalog;
+    StatementTemplates prepared;
+    Database* tables[MAX_REPLICAS][MAX_TABLES];
+    for (int slot = 0; slot < replicas; ++slot) {
+        tables[slot][0] = new Database();
+        if (memoryBudget > 0) tables[slot][0]->setSpillFile(spillFileName(spillDirectory, rank, slot, 0));
+    }
+    std::string message;
+
+    // Open output file to write tuple count for each worker
+    std::ofstream outputFile("tuple_count.txt", std::ios::app);
+    if (!outputFile.is_open()) {
+        std::cerr << "Error: Could not open worker output file\n";
+        return;
+    }
+
+    ExecutorPool scanner(executorThreads, executorsSend, shared);
+
+    profile.start();
+    while (true) {
+        sendScanReplies(scanner, profile);
+
+        // While scans are running and their replies are ours to send, poll for
+        // the next command so the replies go out as soon as they are ready
+        profile.enter(PHASE_RECEIVE);
+        MPI_Status status;
+        if (scanner.queuesReplies() && !scanner.isIdle()) {
+            int arrived = 0;
+            MPI_Iprobe(0, MPI_ANY_TAG, MPI_COMM_WORLD, &arrived, &status);
+            if (!arrived) {
+                scanner.waitForReply(SCAN_POLL_MICROSECONDS);
+                continue;
+            }
+        }
+        else {
+            MPI_Probe(0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        }
+        int messageBytes;
+        MPI_Get_count(&status, MPI_BYTE, &messageBytes);
+        message.resize(messageBytes);
+        int slot = status.MPI_TAG == COMMAND_TAG ? 0 : status.MPI_TAG - REPLICA_TAG;
+        int partition = (rank - 1 - slot + numWorkers) % numWorkers;
+        MPI_Recv(&message[0], messageBytes, MPI_BYTE, 0, status.MPI_TAG, MPI_COMM_WORLD, &status);
+        profile.messagesReceived++;
+        profile.bytesReceived += messageBytes;
+
+        profile.enter(PHASE_DECODE);
+        CommandHeader header;
+        copyBytes(&header, message.data(), sizeof(CommandHeader));
+        const char* body = message.data() + sizeof(CommandHeader);
+
+        if (header.command == 'Q') {
+            break;
+        }
+
+        if (header.command == 'P' || header.command == 'X') {  // A prepared write: turn it back into the command it stands for
+            if (header.command == 'P') {
+                PreparedStatement statement;
+                copyBytes(&statement, body, sizeof(PreparedStatement));
+                prepared.set(header.bodyCount, statement);
+                body += sizeof(PreparedStatement);
+            }
+            const PreparedStatement& statement = prepared.get(header.bodyCount);
+            SelectQuery unused;
+            WorkItem item;
+            bindParameters(statement, body, unused, item);
+            header.command = statement.command;
+            header.bodyCount = 0;
+            message.assign((const char*)&header, sizeof(CommandHeader));
+            appendBytes(message, &item, sizeof(WorkItem));
+            body = message.data() + sizeof(CommandHeader);
+        }
+
+        ReplyHeader reply = { header.seq, partition + 1, 0, 0, 0, 0, 0, 0 };
+        std::string text;
+        if (header.command == 'B') profile.statements[statementType('S')] += header.bodyCount;
+        else profile.statements[statementType(header.command)]++;
+
+        if (header.command == 'C') {  // CREATE TABLE
+            TableSchema schema;
+            copyBytes(&schema, body, sizeof(TableSchema));
+            int table = catalog.createTable(schema);
+            if (table >= 0) {
+                for (int copy = 0; copy < replicas; ++copy) {
+                    tables[copy][table] = new Database(MAX_TABLE_TUPLES);
+                    if (memoryBudget > 0) tables[copy][table]->setSpillFile(spillFileName(spillDirectory, rank, copy, table));
+                }
+            }
+            continue;
+        }
+
+        if (header.command == 'V') {  // CREATE MATERIALIZED VIEW
+            ViewSchema schema;
+            copyBytes(&schema, body, sizeof(ViewSchema));
+            if (catalog.createView(schema) >= 0) {
+                for (int copy = 0; copy < replicas; ++copy) {
+                    tables[copy][schema.table]->addView(schema.groupColumn);
+                }
+            }
+            continue;
+        }
+
+        if (header.command == 'J') {  // JOIN
+            JoinQuery join;
+            copyBytes(&join, body, sizeof(JoinQuery));
+            profile.enter(PHASE_SCAN);
+            runDistributedJoin(join, tables[0], workerComm, text);
+            sendReply(reply, nullptr, text.data(), (int)text.length(), shared, profile);
+            continue;
+        }
+
+        Database& db = *tables[slot][header.table];
+
+        if (header.command == 'M') {  // Rows whose partition key an UPDATE moved to this partition
+            profile.enter(PHASE_SCAN);
+            for (int i = 0; i < header.bodyCount; ++i) {
+                Tuple row;
+                copyBytes(&row, body + i * sizeof(Tuple), sizeof(Tuple));
+                if (db.isFull()) collectGarbage(db, scanner, profile);
+                db.insert(row.attr1, row.attr2, row.attr3);
+            }
+        }
+        else if (header.command == 'I') {  // INSERT
+            WorkItem item;
+            copyBytes(&item, body, sizeof(WorkItem));
+
+            // Only insert if this worker should handle this data
+            profile.enter(PHASE_SCAN);
+            if (partitionOf(item.attr3, numWorkers) == partition) {
+                if (db.isFull()) collectGarbage(db, scanner, profile);
+                db.insert(item.attr1, item.attr2, item.attr3);
+            }
+        }
+        else if (header.command == 'G') {  // Read a materialized view: the partition's groups
+            int view;
+            copyBytes(&view, body, sizeof(int));
+            profile.enter(PHASE_SCAN);
+            MyVector<GroupRow> groups;
+            db.getView(catalog.getView(view).tableView).collect(groups);
+            reply.tupleCount = db.getNumTuples();
+            sendReply(reply, nullptr, (const char*)groups.getData(), groups.getSize() * (int)sizeof(GroupRow), shared, profile);
+        }
+        else if (header.command == 'A') {  // EXPLAIN ANALYZE: a SELECT scanned here, on its own, and measured
             SelectQuery query;
-            parseSelectQuery(command, query);
+            copyBytes(&query, body, sizeof(SelectQuery));
+            finishScans(scanner, profile);
+            profile.enter(PHASE_SCAN);
+            ResultBuffer result;
+            MyVector<Tuple> rows;
+            ScanReport report = analyzeScan(db, query, result, rows);
+            text.assign((const char*)&report, sizeof(ScanReport));
+            text.append(result.getData(), result.getLength());
+            reply.tupleCount = db.getNumTuples();
+            profile.enter(PHASE_FORMAT);
+            std::string message;
+            std::deque<std::string> pieces;
+            appendRunReply(message, pieces, reply, rows.getData(), rows.getSize(), text.data(), (int)text.length());
+            for (const std::string& piece : pieces) sendMessage(piece, shared, profile);
+            sendMessage(message, shared, profile);
+        }
+        else if (header.command == 'S' || header.command == 'B') {  // SELECT, or a batch of them
+            // Scanned by an executor at the current version; later writes don't wait for it
+            ScanTask* task = new ScanTask;
+            task->db = &db;
+            task->partition = partition;
+            task->snapshot = db.currentVersion();
+            task->tupleCount = db.getNumTuples();
+            task->message.swap(message);
+            scanner.submit(task);
+            continue;
+        }
+        else if (header.command == 'U') {  // UPDATE
+            WorkItem item;
+            copyBytes(&item, body, sizeof(WorkItem));
+
+            profile.enter(PHASE_SCAN);
+            if (db.isFull()) collectGarbage(db, scanner, profile);
+            std::ostringstream details;
+            reply.affectedCount = db.update(item.attr1, item.attr2, item.attr3, item.setAttr1, item.setAttr2, item.setAttr3, details);
+            if (reply.affectedCount < 0 && db.hasGarbage()) {  // Not applied: make room and try again
+                finishScans(scanner, profile);
+                db.collectGarbage();
+                reply.affectedCount = db.update(item.attr1, item.attr2, item.attr3, item.setAttr1, item.setAttr2, item.setAttr3, details);
+            }
+            if (reply.affectedCount < 0) {
+                details << "Error: table full, no records updated\n";
+                reply.affectedCount = 0;
+            }
+
+            // Rows whose new attr3 belongs to another partition go back to the master to be moved
+            MyVector<Tuple> moved;
+            if (item.setAttr3 != -1) {
+                db.extractMisplaced(numWorkers, partition, moved);
+            }
+
+            // Only the partition's own worker answers; the master sends the
+            // moved rows on to every copy of their new partition
+            if (slot == 0) {
+                reply.rowCount = moved.getSize();
+                reply.tupleCount = db.getNumTuples();
+                sendWriteReply(reply, moved.getData(), details.str(), db.getSummaryChanges(), shared, profile);
+            }
+        }
+        else if (header.command == 'D') {  // DELETE
+            WorkItem item;
+            copyBytes(&item, body, sizeof(WorkItem));
+
+            profile.enter(PHASE_SCAN);
+            std::ostringstream details;
+            reply.affectedCount = db.deleteRecords(item.attr1, item.attr2, item.attr3, details);
+            if (slot == 0) {
+                reply.tupleCount = db.getNumTuples();
+                sendWriteReply(reply, nullptr, details.str(), db.getSummaryChanges(), shared, profile);
+            }
+        }
+
+        // The master tracks inserted and moved rows itself and has heard about the rest
+        db.clearSummaryChanges();
+
+        if (db.needsGarbageCollection() && scanner.isIdle()) {
+            db.collectGarbage();
+        }
+
+        sealBlocks(db, scanner, profile);
+        spillSegments(tables, replicas, catalog.getTableCount(), memoryBudget, scanner, profile);
+    }
+
+    profile.enter(PHASE_RECEIVE);
+    finishScans(scanner, profile);
+    scanner.stop();
+    scanner.addTo(profile);
+    for (int slot = 0; slot < replicas; ++slot) {
+        for (int i = 0; i < catalog.getTableCount(); ++i) {
+            profile.addScanCounters(tables[slot][i]->getCounters());
+            profile.storageBytes += tables[slot][i]->getStorageBytes();
+            profile.spilledBytes += tables[slot][i]->getSpilledBytes();
+            delete tables[slot][i];
+        }
+    }
+
+    // Close the output file
+    outputFile.close();
+}
+
+// Whether two text conditions (empty, '*', exact or prefix*) can match the same value
+bool textConditionsOverlap(const char* a, const char* b) {
+    int lenA = safeStringLength(a, MAX_ATTR_LENGTH);
+    int lenB = safeStringLength(b, MAX_ATTR_LENGTH);
+    if (lenA == 0 || lenB == 0 || a[0] == '*' || b[0] == '*') return true;
+
+    bool prefixA = a[lenA - 1] == '*';
+    bool prefixB = b[lenB - 1] == '*';
+    if (prefixA) lenA--;
+    if (prefixB) lenB--;
+
+    if (!prefixA && !prefixB) {
+        return safeCompareStrings(a, b, MAX_ATTR_LENGTH);
+    }
+
+    // A prefix pattern overlaps anything that agrees with it on its prefix
+    int common = lenA < lenB ? lenA : lenB;
+    if (!prefixA && lenA < lenB) return false;
+    if (!prefixB && lenB < lenA) return false;
+    for (int i = 0; i < common; ++i) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+// Whether some row could satisfy both a SELECT and the given WHERE conditions
+bool conditionsOverlap(const SelectQuery& query, const char* attr1, const char* attr2, int attr3) {
+    if (query.attr3Condition != -1 && attr3 != -1 && query.attr3Condition != attr3) {
+        return false;
+    }
+    if (attr3 != -1 && (attr3 < query.attr3Low || attr3 > query.attr3High)) {
+        return false;
+    }
+    return textConditionsOverlap(query.attr1Condition, attr1) &&
+        textConditionsOverlap(query.attr2Condition, attr2);
+}
+
+// A cached SELECT result. The entry is taken when the SELECT is issued and
+// filled when its output is formatted; a write in between drops it.
+struct CacheEntry {
+    bool inUse;
+    bool filled;
+    int table;
+    int seq;
+    long long lastUsed;
+    SelectQuery query;
+    std::string output;
+};
+
+// Formatted SELECT output on the master, keyed by table and parsed query.
+// Writes drop only the entries whose WHERE conditions they could affect.
+class ResultCache {
+private:
+    CacheEntry* entries;
+    int capacity;
+    long long clock;
+    int hits;
+    int misses;
+    int invalidations;
+
+    int find(int table, const SelectQuery& query) const {
+        for (int i = 0; i < capacity; ++i) {
+            if (entries[i].inUse && entries[i].table == table && sameSelectQuery(entries[i].query, query)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void drop(CacheEntry& entry) {
+        entry.inUse = false;
+        entry.output.clear();
+        invalidations++;
+    }
+
+public:
+    explicit ResultCache(int capacity)
+        : capacity(capacity > 0 ? capacity : 0), clock(0), hits(0), misses(0), invalidations(0) {
+        entries = new CacheEntry[this->capacity > 0 ? this->capacity : 1];
+        for (int i = 0; i < this->capacity; ++i) entries[i].inUse = false;
+    }
+
+    ~ResultCache() {
+        delete[] entries;
+    }
+
+    bool isEnabled() const {
+        return capacity > 0;
+    }
+
+    // Copy out the cached output of a SELECT; false on a miss
+    bool lookup(int table, const SelectQuery& query, std::string& output) {
+        int i = find(table, query);
+        if (i < 0 || !entries[i].filled) {
+            misses++;
+            return false;
+        }
+        hits++;
+        entries[i].lastUsed = ++clock;
+        output = entries[i].output;
+        return true;
+    }
+
+    // Take an entry for a SELECT being issued, evicting the least recently used one
+    void remember(int table, const SelectQuery& query, int seq) {
+        int i = find(table, query);
+        if (i < 0) {
+            i = 0;
+            for (int j = 0; j < capacity; ++j) {
+                if (!entries[j].inUse) {
+                    i = j;
+                    break;
+                }
+                if (entries[j].lastUsed < entries[i].lastUsed) i = j;
+            }
+        }
+
+        CacheEntry& entry = entries[i];
+        entry.inUse = true;
+        entry.filled = false;
+        entry.table = table;
+        entry.seq = seq;
+        entry.lastUsed = ++clock;
+        entry.query = query;
+        entry.output.clear();
+    }
+
+    // Store a SELECT's output, unless a write has dropped its entry meanwhile
+    void fill(int seq, const std::string& output) {
+        for (int i = 0; i < capacity; ++i) {
+            if (entries[i].inUse && !entries[i].filled && entries[i].seq == seq) {
+                entries[i].filled = true;
+                entries[i].output = output;
+                return;
+            }
+        }
+    }
+
+    void invalidateInsert(int table, const Tuple& row) {
+        for (int i = 0; i < capacity; ++i) {
+            if (entries[i].inUse && entries[i].table == table && tupleMatchesQuery(row, entries[i].query)) {
+                drop(entries[i]);
+            }
+        }
+    }
+
+    // An UPDATE affects the rows matching its WHERE conditions both before and after the change
+    void invalidateWrite(int table, const WorkItem& item) {
+        const char* newAttr1 = item.setAttr1[0] != '\0' ? item.setAttr1 : item.attr1;
+        const char* newAttr2 = item.setAttr2[0] != '\0' ? item.setAttr2 : item.attr2;
+        int newAttr3 = item.setAttr3 != -1 ? item.setAttr3 : item.attr3;
+
+        for (int i = 0; i < capacity; ++i) {
+            if (!entries[i].inUse || entries[i].table != table) continue;
+
+            const SelectQuery& query = entries[i].query;
+            if (conditionsOverlap(query, item.attr1, item.attr2, item.attr3) ||
+                (item.command == 'U' && conditionsOverlap(query, newAttr1, newAttr2, newAttr3))) {
+                drop(entries[i]);
+            }
+        }
+    }
+
+    void printStats(std::ostream& out) const {
+        out << "Result cache: " << hits << " hits, " << misses << " misses, "
+            << invalidations << " invalidations" << std::endl;
+    }
+};
+
+// A statement the master has issued but not yet written out, one per window slot
+struct PendingStatement {
+    int seq;
+    char command;
+    double submitTime;
+    int table;
+    bool isWrite;
+    bool* touchesWorker;
+    int pendingReplies;
+    SelectQuery query;
+    int view;                     // Read by a 'G'
+    std::string message;          // Kept alive until the sends complete
+    std::string* workerMessages;  // Rows an UPDATE moves, or the batch sent, per worker
+    std::string* movedRows;       // Rows an UPDATE moved out, per worker they came from
+    MyVector<MPI_Request> sendRequests;
+    std::ostringstream output;
+    std::string* workerText;
+    RunMerger merge;              // An ordered SELECT's runs, merged as they come in
+    int* runSizes;                // Rows of each worker's run, for EXPLAIN ANALYZE
+    int* affectedCounts;
+    int* tupleCounts;
+    int* movedTo;
+    double sentTime;              // EXPLAIN ANALYZE: when the command went out,
+    double* replySeconds;         // and how long after that each worker answered
+};
+
+// A client connected to the server
+struct ClientConnection {
+    int fd;              // -1 once the client has gone
+    std::string input;   // Received text not yet split into statements
+    std::string output;  // Answers not yet sent
+    size_t outputSent;
+    int unanswered;      // Statements submitted but not yet answered
+    bool inputClosed;    // The client sent everything it will send
+};
+
+// Server mode: hands each finished statement's output back to the client that
+// sent it. Statements are numbered in the order they are submitted and written
+// out in that order, so the owner of each is queued as it is submitted.
+class ClientRouter {
+private:
+    MyVector<ClientConnection*> clients;  // Indexed by client id, null when free
+    std::deque<int> owners;               // Client of every statement not yet written out
+
+    void release(int id) {
+        delete clients[id];
+        clients[id] = nullptr;
+    }
+
+public:
+    ~ClientRouter() {
+        for (int id = 0; id < clients.getSize(); ++id) delete clients[id];
+    }
+
+    int add(int fd) {
+        ClientConnection* client = new ClientConnection;
+        client->fd = fd;
+        client->outputSent = 0;
+        client->unanswered = 0;
+        client->inputClosed = false;
+        for (int id = 0; id < clients.getSize(); ++id) {
+            if (clients[id] == nullptr) {
+                clients[id] = client;
+                return id;
+            }
+        }
+        clients.push_back(client);
+        return clients.getSize() - 1;
+    }
+
+    int getSlotCount() const {
+        return clients.getSize();
+    }
+
+    // The client with this id, or null if the slot is free
+    ClientConnection* get(int id) {
+        return clients[id];
+    }
+
+    // The next statement submitted belongs to this client
+    void expect(int id) {
+        owners.push_back(id);
+        clients[id]->unanswered++;
+    }
+
+    void deliver(char command, const std::string& text) {
+        int id = owners.front();
+        owners.pop_front();
+        ClientConnection* client = clients[id];
+        client->unanswered--;
+        if (client->fd >= 0) {
+            appendResponse(client->output, command, text.data(), (int)text.length());
+        }
+        else if (client->unanswered == 0) {
+            release(id);
+        }
+    }
+
+    // The client went away; its statements still run, their answers are dropped
+    void disconnect(int id) {
+        ClientConnection* client = clients[id];
+        client->fd = -1;
+        client->output.clear();
+        client->outputSent = 0;
+        if (client->unanswered == 0) release(id);
+    }
+
+    bool hasOutput() const {
+        for (int id = 0; id < clients.getSize(); ++id) {
+            if (clients[id] != nullptr && clients[id]->outputSent < clients[id]->output.length()) return true;
+        }
+        return false;
+    }
+};
+
+// Issues statements to the workers without waiting for earlier ones to finish.
+// Up to windowSize statements are in flight; a statement is held back while it
+// would touch a partition an in-flight UPDATE or DELETE writes. Writes need not
+// wait for reads in flight: a worker answers each SELECT from the snapshot of
+// the writes it received before it. Output is written in statement order.
+//
+// With replicas > 1 every partition is also mirrored on the replicas - 1
+// workers after its own. Writes go to every copy in statement order, and each
+// read goes to the copy with the fewest reads in flight. Bookkeeping stays per
+// partition: whichever copy answers, it answers for the partition.
+class Dispatcher {
+private:
+    int numWorkers;
+    int replicas;
+    int* readLoad;         // Per worker, SELECT replies still to come
+    int readTurn;          // Rotates ties between equally loaded copies
+    int windowSize;
+    PendingStatement* window;
+    int nextSeq;
+    int oldestSeq;         // Oldest statement not yet written out
+    int repliesPending;
+    int* writersInFlight;  // Per worker
+    ValueSummary* summaries;  // [table * numWorkers + partition] attr1/attr2 values the partition may hold
+    long long partitionsSkipped;
+    int* retiredCounts;    // [table * numWorkers + worker] live tuples as of the last written statement
+    bool* touches;         // Footprint of the statement being submitted
+    int maxBatch;
+    SelectQuery* batch;    // Consecutive SELECTs waiting to share one scan
+    double* batchTimes;    // When each of them was submitted
+    int batchSize;
+    int batchTable;
+    ResultCache cache;
+    StatementStats& stats;
+    SharedReplyArea& shared;
+    double submittedAt;    // When the statement being submitted was read
+    Catalog catalog;
+    StatementTemplates templates;
+    bool* templateHeld;     // [prepared * numWorkers + worker] whether the worker holds the prepared statement
+    char preparedCommand;   // 'P' or 'X' while a prepared write is issued, else 0
+    int preparedStatement;
+    int tableRows[MAX_TABLES];  // Live row estimate per table, used to pick a join strategy
+    OutputWriter* outputFile;
+    ClientRouter* router;       // In server mode output goes back to the clients instead of a file
+    std::ofstream& tupleCountFile;
+
+    PendingStatement& slotFor(int seq) {
+        return window[seq % windowSize];
+    }
+
+    bool conflicts() const {
+        for (int w = 0; w < numWorkers; ++w) {
+            if (touches[w] && writersInFlight[w] > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void touchAllWorkers() {
+        for (int w = 0; w < numWorkers; ++w) touches[w] = true;
+    }
+
+    // Worker holding the copy of a partition in the given replica slot
+    int replicaHost(int partition, int slot) const {
+        return (partition + slot) % numWorkers;
+    }
+
+    // Replica slot a read of the partition goes to
+    int chooseReplica(int partition) {
+        int start = readTurn++ % replicas;
+        int best = start;
+        for (int i = 1; i < replicas; ++i) {
+            int slot = (start + i) % replicas;
+            if (readLoad[replicaHost(partition, slot)] < readLoad[replicaHost(partition, best)]) best = slot;
+        }
+        return best;
+    }
+
+    void sendToReplica(PendingStatement& stmt, const std::string& message, int partition, int slot) {
+        MPI_Request request;
+        MPI_Isend(message.data(), (int)message.length(), MPI_BYTE, replicaHost(partition, slot) + 1, commandTag(slot),
+            MPI_COMM_WORLD, &request);
+        stmt.sendRequests.push_back(request);
+    }
+
+    // Touch only the partition owning attr3, or every worker if attr3 is unconstrained
+    void touchPartition(int attr3) {
+        int owner = partitionOf(attr3, numWorkers);
+        if (owner < 0) {
+            touchAllWorkers();
+            return;
+        }
+        for (int w = 0; w < numWorkers; ++w) touches[w] = w == owner;
+    }
+
+    // Drop the partitions whose summary rules out the equality conditions. A
+    // partition with a write in flight is kept: its summary may be behind.
+    void skipUnmatched(int table, const char* attr1Condition, const char* attr2Condition) {
+        if (!isExactCondition(attr1Condition) && !isExactCondition(attr2Condition)) return;
+        for (int w = 0; w < numWorkers; ++w) {
+            if (touches[w] && writersInFlight[w] == 0 &&
+                !summaries[table * numWorkers + w].mayMatch(attr1Condition, attr2Condition)) {
+                touches[w] = false;
+                partitionsSkipped++;
+            }
+        }
+    }
+
+    void touchForSelect(int table, const SelectQuery& query) {
+        touchPartition(query.attr3Condition);
+        skipUnmatched(table, query.attr1Condition, query.attr2Condition);
+    }
+
+    // Receive a reply message; a batch carries one reply per SELECT. A reply
+    // left in shared memory is read in place and its slot handed back.
+    void receiveReply(const MPI_Status& probed) {
+        MPI_Status status;
+        if (probed.MPI_TAG == SHARED_REPLY_TAG) {
+            int slot;
+            MPI_Recv(&slot, 1, MPI_INT, probed.MPI_SOURCE, SHARED_REPLY_TAG, MPI_COMM_WORLD, &status);
+            int bytes;
+            const char* message = shared.read(probed.MPI_SOURCE - 1, slot, bytes);
+            handleReplies(message, bytes, probed.MPI_SOURCE);
+            shared.release(probed.MPI_SOURCE - 1, slot);
+            return;
+        }
+
+        int bytes;
+        MPI_Get_count(&probed, MPI_BYTE, &bytes);
+        std::string message(bytes, '\0');
+        MPI_Recv(&message[0], bytes, MPI_BYTE, probed.MPI_SOURCE, REPLY_TAG, MPI_COMM_WORLD, &status);
+        handleReplies(message.data(), bytes, probed.MPI_SOURCE);
+    }
+
+    // Take in each reply of a message from the given rank
+    void handleReplies(const char* message, int bytes, int source) {
+        size_t offset = 0;
+        while (offset < (size_t)bytes) {
+            ReplyHeader reply;
+            copyBytes(&reply, message + offset, sizeof(ReplyHeader));
+            if (slotFor(reply.seq).command == 'S' && reply.rowsToFollow == 0) readLoad[source - 1]--;
+            const char* rows = message + offset + sizeof(ReplyHeader);
+            const char* text = rows + (size_t)reply.rowCount * sizeof(Tuple);
+            const char* changes = text + reply.textLength;
+            offset += sizeof(ReplyHeader) + (size_t)reply.rowCount * sizeof(Tuple) + reply.textLength +
+                (size_t)reply.summaryCount * sizeof(int);
+            handleReply(reply, rows, text, changes);
+        }
+    }
+
+    void handleReply(const ReplyHeader& reply, const char* rows, const char* text, const char* changes) {
+        PendingStatement& stmt = slotFor(reply.seq);
+        int w = reply.worker - 1;
+
+        // Rows of an ordered run are merged in as they come; an EXPLAIN
+        // ANALYZE only counts them
+        if ((stmt.command == 'S' || stmt.command == 'A') && stmt.query.isOrdered()) {
+            std::ostringstream discarded;
+            stmt.runSizes[w] += reply.rowCount;
+            stmt.merge.add(w, rows, reply.rowCount, reply.rowsToFollow == 0, stmt.command == 'A' ? discarded : stmt.output);
+            if (reply.rowsToFollow > 0) return;
+        }
+
+        ValueSummary& summary = summaries[stmt.table * numWorkers + w];
+        for (int i = 0; i < reply.summaryCount; ++i) {
+            int change;
+            copyBytes(&change, changes + i * sizeof(int), sizeof(int));
+            summary.apply(change);
+        }
+        stmt.affectedCounts[w] = reply.affectedCount;
+        stmt.tupleCounts[w] = reply.tupleCount;
+        stmt.workerText[w].assign(text, reply.textLength);
+
+        if (stmt.command == 'A') stmt.replySeconds[w] = MPI_Wtime() - stmt.sentTime;
+
+        if (stmt.command == 'U') {
+            stmt.movedRows[w].assign(rows, (size_t)reply.rowCount * sizeof(Tuple));
+        }
+
+        repliesPending--;
+        stmt.pendingReplies--;
+        if (stmt.pendingReplies == 0) {
+            complete(stmt);
+        }
+    }
+
+    // All replies are in: release the statement's partitions and format its output
+    void complete(PendingStatement& stmt) {
+        for (int w = 0; w < numWorkers; ++w) {
+            if (stmt.touchesWorker[w] && stmt.isWrite) writersInFlight[w]--;
+        }
+
+        std::ostringstream& output = stmt.output;
+        if (stmt.command == 'S') {
+            bool found = false;
+            if (stmt.query.isOrdered()) {
+                found = stmt.merge.getWritten() > 0;
+            }
+            else {
+                for (int w = 0; w < numWorkers; ++w) {
+                    if (!stmt.workerText[w].empty()) {
+                        output << stmt.workerText[w];
+                        found = true;
+                    }
+                }
+            }
+
+            if (!found) {
+                const SelectQuery& query = stmt.query;
+                output << "No records found.";
+
+                // Output specific conditions used in the query
+                output << " Query attributes: ";
+                bool firstCondition = true;
+
+                if (query.attr1Condition[0] != '\0' && query.attr1Condition[0] != '*') {
+                    output << "attr1=" << query.attr1Condition;
+                    firstCondition = false;
+                }
+
+                if (query.attr2Condition[0] != '\0' && query.attr2Condition[0] != '*') {
+                    if (!firstCondition) output << ", ";
+                    output << "attr2=" << query.attr2Condition;
+                    firstCondition = false;
+                }
+
+                if (query.attr3Condition != -1) {
+                    if (!firstCondition) output << ", ";
+                    output << "attr3=" << query.attr3Condition;
+                    firstCondition = false;
+                }
+
+                if (query.hasRange()) {
+                    if (!firstCondition) output << ", ";
+                    output << "attr3 in [" << query.attr3Low << ", " << query.attr3High << "]";
+                }
+
+                output << "\n";
+            }
+
+            if (cache.isEnabled()) {
+                cache.fill(stmt.seq, output.str());
+            }
+        }
+        else if (stmt.command == 'G') {
+            // Every partition sent its part of each group; they add up by value
+            MyVector<GroupRow> groups;
+            for (int w = 0; w < numWorkers; ++w) {
+                int count = (int)(stmt.workerText[w].length() / sizeof(GroupRow));
+                for (int i = 0; i < count; ++i) {
+                    GroupRow group;
+                    copyBytes(&group, stmt.workerText[w].data() + i * sizeof(GroupRow), sizeof(GroupRow));
+                    groups.push_back(group);
+                }
+            }
+            if (writeViewGroups(groups, catalog.getView(stmt.view), output) == 0) {
+                output << "No records found.\n";
+            }
+        }
+        else if (stmt.command == 'A') {
+            // Each reply's text starts with what the worker's scan did. The
+            // rest is the result, which is only counted; the time not spent
+            // scanning went on messages and waiting behind other work.
+            int rowsReturned = 0;
+            for (int w = 0; w < numWorkers; ++w) {
+                if (!stmt.touchesWorker[w]) continue;
+                const std::string& text = stmt.workerText[w];
+                ScanReport report;
+                copyBytes(&report, text.data(), sizeof(ScanReport));
+                long long replies = stmt.runSizes[w] > MAX_REPLY_ROWS ? (stmt.runSizes[w] - 1) / MAX_REPLY_ROWS + 1 : 1;
+                long long bytesSent = replies * sizeof(ReplyHeader) + (long long)stmt.runSizes[w] * sizeof(Tuple) + text.length();
+                output << "  Worker " << w + 1 << ": ";
+                writeScanReport(report, output);
+                output << ", bytes sent " << bytesSent
+                    << ", communication " << (stmt.replySeconds[w] - report.scanSeconds) * 1000.0 << " ms\n";
+                rowsReturned += countResultRows(text.data() + sizeof(ScanReport), (int)(text.length() - sizeof(ScanReport)));
+            }
+            if (stmt.query.isOrdered()) rowsReturned = stmt.merge.getWritten();
+            output << "  Rows returned: " << rowsReturned << "\n";
+        }
+        else if (stmt.command == 'J') {
+            bool found = false;
+            for (int w = 0; w < numWorkers; ++w) {
+                if (!stmt.workerText[w].empty()) {
+                    output << stmt.workerText[w];
+                    found = true;
+                }
+            }
+            if (!found) {
+                output << "No records found.\n";
+            }
+        }
+        else if (stmt.command == 'U' || stmt.command == 'D') {
+            const char* label = stmt.command == 'U' ? "Updates" : "Deletes";
+            int total = 0;
+            for (int w = 0; w < numWorkers; ++w) {
+                if (stmt.affectedCounts[w] > 0 || !stmt.workerText[w].empty()) {  // Rows changed, or an error
+                    output << label << " from worker " << w + 1 << ":\n";
+                    output << stmt.workerText[w];
+                }
+                total += stmt.affectedCounts[w];
+            }
+
+            if (stmt.command == 'U') {
+                output << "Total records updated: " << total << "\n\n";
+                sendMovedRows(stmt);
+            }
+            else {
+                tableRows[stmt.table] -= total;
+                output << "Total records deleted: " << total << "\n\n";
+            }
+        }
+    }
+
+    // Re-insert the rows an UPDATE moved to another partition. Anything touching
+    // those partitions was held back behind the UPDATE, so it sees the moved rows.
+    // They are gathered in worker order, not reply order, so every run stores
+    // them, and numbers them, the same way.
+    void sendMovedRows(PendingStatement& stmt) {
+        for (int source = 0; source < numWorkers; ++source) {
+            const std::string& moved = stmt.movedRows[source];
+            for (size_t offset = 0; offset < moved.length(); offset += sizeof(Tuple)) {
+                Tuple row;
+                copyBytes(&row, moved.data() + offset, sizeof(Tuple));
+                appendBytes(stmt.workerMessages[partitionOf(row.attr3, numWorkers)], &row, sizeof(Tuple));
+            }
+        }
+
+        for (int w = 0; w < numWorkers; ++w) {
+            std::string& rows = stmt.workerMessages[w];
+            if (rows.empty()) continue;
+
+            CommandHeader header = { 'M', stmt.seq, stmt.table, (int)(rows.length() / sizeof(Tuple)) };
+            stmt.movedTo[w] = header.bodyCount;
+            for (int i = 0; i < header.bodyCount; ++i) {
+                Tuple row;
+                copyBytes(&row, rows.data() + i * sizeof(Tuple), sizeof(Tuple));
+                summaries[stmt.table * numWorkers + w].addRow(row);
+            }
+            rows.insert(0, (const char*)&header, sizeof(CommandHeader));
 
-            char result[MAX_RESULT_LENGTH];
-            db.enhancedQuery(query, result);
+            for (int slot = 0; slot < replicas; ++slot) {
+                sendToReplica(stmt, rows, w, slot);
+            }
+        }
+    }
 
-            if (result[0] != '\0') {
-                outputFile << result;
+    // Write out finished statements from the front of the window, in order
+    void retireFinished() {
+        while (oldestSeq < nextSeq) {
+            PendingStatement& stmt = slotFor(oldestSeq);
+            if (stmt.pendingReplies > 0) return;
+
+            int sendsDone = 1;
+            if (stmt.sendRequests.getSize() > 0) {
+                MPI_Testall(stmt.sendRequests.getSize(), stmt.sendRequests.getData(), &sendsDone, MPI_STATUSES_IGNORE);
             }
-            else {
-                outputFile << "No records found. Query attributes: ";
-                outputFile << "attr1=" << query.attr1Condition << ", ";
-                outputFile << "attr2=" << query.attr2Condition << ", ";
-                outputFile << "attr3=" << query.attr3Condition << "\n";
+            if (!sendsDone) return;
+
+            if (router != nullptr) router->deliver(stmt.command, stmt.output.str());
+            else outputFile->writeStatement(stmt.seq, stmt.command, stmt.output.str());
+            stats.record(stmt.command, MPI_Wtime() - stmt.submitTime);
+
+            int* counts = retiredCounts + stmt.table * numWorkers;
+            if (stmt.command == 'S') {
+                // Workers the SELECT was not sent to report their count as of this point
+                for (int w = 0; w < numWorkers; ++w) {
+                    tupleCountFile << (w > 0 ? "," : "") << (stmt.touchesWorker[w] ? stmt.tupleCounts[w] : counts[w]);
+                }
+                tupleCountFile << "\n";
             }
 
-            tupleCountFile << db.getNumTuples() << ",\n";
-        }
-        else if (command[0] == 'U') {  // UPDATE
-            parseInputLine(command, attr1, attr2, attr3, setAttr1, setAttr2, setAttr3);
-            int updateCount = db.update(attr1, attr2, attr3, setAttr1, setAttr2, setAttr3, outputFile);
-            outputFile << "Total records updated: " << updateCount << "\n\n";
-            outputFile.flush();
+            if (stmt.command == 'I') {
+                for (int w = 0; w < numWorkers; ++w) {
+                    if (stmt.touchesWorker[w]) counts[w]++;
+                }
+            }
+            else if (stmt.command == 'S' || stmt.command == 'U' || stmt.command == 'D') {
+                for (int w = 0; w < numWorkers; ++w) {
+                    if (stmt.touchesWorker[w]) counts[w] = stmt.tupleCounts[w];
+                    counts[w] += stmt.movedTo[w];
+                }
+            }
 
-            // Also log tuple count after update
-            tupleCountFile << db.getNumTuples() << ",\n";
+            oldestSeq++;
         }
-        else if (command[0] == 'D') {  // DELETE
-            parseInputLine(command, attr1, attr2, attr3, setAttr1, setAttr2, setAttr3);
-            int deleteCount = db.deleteRecords(attr1, attr2, attr3, outputFile);
-            outputFile << "Total records deleted: " << deleteCount << "\n\n";
-            outputFile.flush();
+    }
 
-            // Also log tuple count after delete
-            tupleCountFile << db.getNumTuples() << ",\n";
+    // Block until a reply arrives, or until the oldest statement's sends complete
+    void waitForProgress() {
+        if (repliesPending > 0) {
+            MPI_Status status;
+            MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            receiveReply(status);
+        }
+        else {
+            PendingStatement& oldest = slotFor(oldestSeq);
+            MPI_Waitall(oldest.sendRequests.getSize(), oldest.sendRequests.getData(), MPI_STATUSES_IGNORE);
+            oldest.sendRequests.clear();
         }
     }
 
-    inputFile.close();
-    outputFile.close();
-    tupleCountFile.close();
-}
-
-void runWorker(int rank, int numWorkers) {
-    Database db;
-    char buffer1[MAX_ATTR_LENGTH];
-    char buffer2[MAX_ATTR_LENGTH];
-    char setBuffer1[MAX_ATTR_LENGTH];
-    char setBuffer2[MAX_ATTR_LENGTH];
-    int attr3, setAttr3;
-    char result[MAX_RESULT_LENGTH];
-
-    // Buffers for selected columns
-    char selectedColumns[MAX_COLUMNS][MAX_COLUMN_NAME];
-    int selectedColumnCount;
+    // Wait until slotCount window slots are free and a statement with the
+    // current footprint no longer conflicts with anything in flight
+    void waitForRoom(int slotCount) {
+        retireFinished();
+        while (nextSeq - oldestSeq > windowSize - slotCount || conflicts()) {
+            waitForProgress();
+            retireFinished();
+        }
+    }
 
+    // Take the next window slot for a statement with the current footprint
+    PendingStatement& reserve(char command, int table, bool isWrite, bool expectsReply, const SelectQuery* query) {
+        PendingStatement& stmt = slotFor(nextSeq);
+        stmt.seq = nextSeq++;
+        stmt.command = command;
+        stmt.submitTime = submittedAt;
+        stmt.table = table;
+        stmt.isWrite = isWrite;
+        stmt.pendingReplies = 0;
+        stmt.output.str("");
+        stmt.sendRequests.clear();
+        if (query != nullptr) stmt.query = *query;
+
+        for (int w = 0; w < numWorkers; ++w) {
+            stmt.touchesWorker[w] = touches[w];
+            stmt.workerText[w].clear();
+            stmt.workerMessages[w].clear();
+            stmt.movedRows[w].clear();
+            stmt.affectedCounts[w] = 0;
+            stmt.tupleCounts[w] = 0;
+            stmt.movedTo[w] = 0;
+            stmt.runSizes[w] = 0;
+
+            if (touches[w] && expectsReply) {
+                stmt.pendingReplies++;
+                repliesPending++;
+                if (isWrite) writersInFlight[w]++;
+            }
+        }
+        if ((command == 'S' || command == 'A') && query != nullptr && query->isOrdered()) {
+            stmt.merge.begin(stmt.touchesWorker, numWorkers, *query);
+        }
 
-    // Open output file to write tuple count for each worker
-    std::ofstream outputFile("tuple_count.txt", std::ios::app);
-    if (!outputFile.is_open()) {
-        std::cerr << "Error: Could not open worker output file\n";
-        return;
+        if (command == 'S' && expectsReply && cache.isEnabled()) {
+            cache.remember(table, *query, stmt.seq);
+        }
+        return stmt;
     }
 
-    while (true) {
-        MPI_Status status;
-        MPI_Recv(buffer1, MAX_ATTR_LENGTH, MPI_CHAR, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+    // Take the next window slot once the statement no longer conflicts with
+    // anything in flight, then send it to every worker it touches. The
+    // preamble leads the statement's output.
+    void issue(char command, int table, bool isWrite, bool expectsReply, const std::string& body, const SelectQuery* query,
+        const std::string& preamble = std::string()) {
+        waitForRoom(1);
+        PendingStatement& stmt = reserve(command, table, isWrite, expectsReply, query);
+        stmt.output << preamble;
+        stmt.sentTime = MPI_Wtime();
+
+        CommandHeader header = { command, stmt.seq, table, 0 };
+        if (preparedCommand != 0) {
+            header.command = preparedCommand;
+            header.bodyCount = preparedStatement;
+        }
+        stmt.message.assign((const char*)&header, sizeof(CommandHeader));
+        stmt.message += body;
+
+        // Rows are written to every copy of a partition and read from one.
+        // Table creation and joins go to each partition's own worker only.
+        for (int w = 0; w < numWorkers; ++w) {
+            if (!touches[w]) continue;
+
+            if (command == 'S') {
+                int slot = chooseReplica(w);
+                readLoad[replicaHost(w, slot)]++;
+                sendToReplica(stmt, stmt.message, w, slot);
+            }
+            else {
+                int copies = command == 'I' || command == 'U' || command == 'D' ? replicas : 1;
+                for (int slot = 0; slot < copies; ++slot) {
+                    sendToReplica(stmt, stmt.message, w, slot);
+                }
+            }
+        }
 
-        if (status.MPI_TAG == 99) {
-            break;
+        // Every partition was ruled out: the answer is known already
+        if (expectsReply && stmt.pendingReplies == 0) {
+            complete(stmt);
         }
+    }
 
-        if (status.MPI_TAG == 0) {  // INSERT
-            MPI_Recv(buffer2, MAX_ATTR_LENGTH, MPI_CHAR, 0, 1, MPI_COMM_WORLD, &status);
-            MPI_Recv(&attr3, 1, MPI_INT, 0, 2, MPI_COMM_WORLD, &status);
+    // Issue the waiting SELECTs. Each takes its own window slot, but every worker
+    // gets a single 'B' message with the ones that touch it and answers them all
+    // from one pass over its rows.
+    void flushBatch() {
+        if (batchSize == 0) return;
+
+        int count = batchSize;
+        batchSize = 0;
+        double currentSubmit = submittedAt;
+        if (count == 1) {
+            std::string body;
+            appendBytes(body, &batch[0], sizeof(SelectQuery));
+            touchForSelect(batchTable, batch[0]);
+            submittedAt = batchTimes[0];
+            issue('S', batchTable, false, true, body, &batch[0]);
+            submittedAt = currentSubmit;
+            return;
+        }
 
-            // Only insert if this worker should handle this data
-            if ((attr3 % numWorkers) == (rank - 1)) {
-                db.insert(buffer1, buffer2, attr3);
+        // The batch as a whole reads the union of its SELECTs' partitions
+        bool* batchTouches = new bool[numWorkers]();
+        for (int q = 0; q < count; ++q) {
+            touchForSelect(batchTable, batch[q]);
+            for (int w = 0; w < numWorkers; ++w) {
+                if (touches[w]) batchTouches[w] = true;
             }
         }
-        else if (status.MPI_TAG == 3) {  // SELECT
-            // Receive selected columns
-            MPI_Recv(&selectedColumnCount, 1, MPI_INT, 0, 4, MPI_COMM_WORLD, &status);
-            
-            // Receive column names if any specific columns are selected
-            if (selectedColumnCount > 0) {
-                MPI_Recv(selectedColumns, selectedColumnCount * MAX_COLUMN_NAME, MPI_CHAR, 0, 5, MPI_COMM_WORLD, &status);
+        for (int w = 0; w < numWorkers; ++w) touches[w] = batchTouches[w];
+        waitForRoom(count);
+
+        int* entryCounts = new int[numWorkers]();
+        std::string* messages = new std::string[numWorkers];
+        for (int q = 0; q < count; ++q) {
+            touchForSelect(batchTable, batch[q]);
+            submittedAt = batchTimes[q];
+            PendingStatement& stmt = reserve('S', batchTable, false, true, &batch[q]);
+            if (stmt.pendingReplies == 0) {
+                complete(stmt);
+                continue;
+            }
+
+            BatchEntry entry;
+            entry.seq = stmt.seq;
+            entry.query = batch[q];
+            for (int w = 0; w < numWorkers; ++w) {
+                if (!touches[w]) continue;
+                appendBytes(messages[w], &entry, sizeof(BatchEntry));
+                entryCounts[w]++;
             }
+        }
 
-            // Receive query conditions
-            MPI_Recv(buffer2, MAX_ATTR_LENGTH, MPI_CHAR, 0, 6, MPI_COMM_WORLD, &status);
-            MPI_Recv(&attr3, 1, MPI_INT, 0, 7, MPI_COMM_WORLD, &status);
+        // The last statement of the batch owns the send buffers, so they stay
+        // alive until it retires
+        PendingStatement& last = slotFor(nextSeq - 1);
+        for (int w = 0; w < numWorkers; ++w) {
+            if (entryCounts[w] == 0) continue;
 
-            // Prepare SelectQuery
-            SelectQuery query;
-            
-            // Set selected columns
-            for (int i = 0; i < selectedColumnCount; ++i) {
-                query.addSelectedColumn(selectedColumns[i]);
-            }
-            
-            // Set conditions
-            if (safeStringLength(buffer1, MAX_ATTR_LENGTH) > 0) {
-                safeCopyString(query.attr1Condition, buffer1, MAX_ATTR_LENGTH);
-            }
-            if (safeStringLength(buffer2, MAX_ATTR_LENGTH) > 0) {
-                safeCopyString(query.attr2Condition, buffer2, MAX_ATTR_LENGTH);
-            }
-            query.attr3Condition = attr3;
-
-            // Query local database partition
-            char workerResult[MAX_RESULT_LENGTH];
-            db.enhancedQuery(query, workerResult);
-            
-            MPI_Send(workerResult, MAX_RESULT_LENGTH, MPI_CHAR, 0, 8, MPI_COMM_WORLD);
-
-            // Send the current tuple count to master
-            int tupleCount = db.getNumTuples();
-            MPI_Send(&tupleCount, 1, MPI_INT, 0, 9, MPI_COMM_WORLD);
-        }
-        else if (status.MPI_TAG == 8) {  // UPDATE
-            MPI_Recv(buffer2, MAX_ATTR_LENGTH, MPI_CHAR, 0, 9, MPI_COMM_WORLD, &status);
-            MPI_Recv(&attr3, 1, MPI_INT, 0, 10, MPI_COMM_WORLD, &status);
-            MPI_Recv(setBuffer1, MAX_ATTR_LENGTH, MPI_CHAR, 0, 11, MPI_COMM_WORLD, &status);
-            MPI_Recv(setBuffer2, MAX_ATTR_LENGTH, MPI_CHAR, 0, 12, MPI_COMM_WORLD, &status);
-            MPI_Recv(&setAttr3, 1, MPI_INT, 0, 13, MPI_COMM_WORLD, &status);
-
-            char updateResult[MAX_RESULT_LENGTH] = "";
-            std::ofstream tempOutputFile("temp_output.txt", std::ios::app);
-            int updateCount = db.update(buffer1, buffer2, attr3, setBuffer1, setBuffer2, setAttr3, tempOutputFile);
-            tempOutputFile.close();
-
-            // Read the temporary file and send its contents
-            std::ifstream tempInputFile("temp_output.txt");
-            std::string updateDetails((std::istreambuf_iterator<char>(tempInputFile)),
-                std::istreambuf_iterator<char>());
-            tempInputFile.close();
-            std::remove("temp_output.txt");
-
-            // Send update count and details back to master
-            MPI_Send(&updateCount, 1, MPI_INT, 0, 14, MPI_COMM_WORLD);
-            MPI_Send(updateDetails.c_str(), updateDetails.length() + 1, MPI_CHAR, 0, 15, MPI_COMM_WORLD);
-        }
-        else if (status.MPI_TAG == 16) {  // DELETE
-            MPI_Recv(buffer2, MAX_ATTR_LENGTH, MPI_CHAR, 0, 17, MPI_COMM_WORLD, &status);
-            MPI_Recv(&attr3, 1, MPI_INT, 0, 18, MPI_COMM_WORLD, &status);
-
-            std::ofstream tempOutputFile("temp_output.txt", std::ios::app);
-            int deleteCount = db.deleteRecords(buffer1, buffer2, attr3, tempOutputFile);
-            tempOutputFile.close();
-
-            // Read and send delete details
-            std::ifstream tempInputFile("temp_output.txt");
-            std::string deleteDetails((std::istreambuf_iterator<char>(tempInputFile)),
-                std::istreambuf_iterator<char>());
-            tempInputFile.close();
-            std::remove("temp_output.txt");
-
-            MPI_Send(&deleteCount, 1, MPI_INT, 0, 19, MPI_COMM_WORLD);
-            MPI_Send(deleteDetails.c_str(), deleteDetails.length() + 1, MPI_CHAR, 0, 20, MPI_COMM_WORLD);
+            CommandHeader header = { 'B', last.seq, batchTable, entryCounts[w] };
+            std::string& message = last.workerMessages[w];
+            message.assign((const char*)&header, sizeof(CommandHeader));
+            message += messages[w];
+
+            int slot = chooseReplica(w);
+            readLoad[replicaHost(w, slot)] += entryCounts[w];
+            sendToReplica(last, message, w, slot);
         }
+
+        submittedAt = currentSubmit;
+
+        delete[] batchTouches;
+        delete[] entryCounts;
+        delete[] messages;
     }
 
-    // Close the output file
-    outputFile.close();
-}
+    // A statement that never reaches the workers, such as a parse error, still
+    // takes its place in the output order
+    void issueLocal(const std::string& text) {
+        flushBatch();
+        for (int w = 0; w < numWorkers; ++w) touches[w] = false;
+        issue('E', 0, false, false, std::string(), nullptr);
+        slotFor(nextSeq - 1).output << text;
+    }
 
-void runMaster(int numWorkers, const std::string& inputFileName, const std::string& outputFileName, const std::string& tupleCountFileName) {
-    std::ifstream inputFile(inputFileName);
-    std::ofstream outputFile(outputFileName, std::ios::out);
-    std::ofstream tupleCountFile(tupleCountFileName, std::ios::out);
+    // A cache hit needs no worker; its tuple counts are those of the statements before it
+    void issueCached(int table, const SelectQuery& query, const std::string& text) {
+        flushBatch();
+        for (int w = 0; w < numWorkers; ++w) touches[w] = false;
+        issue('S', table, false, false, std::string(), &query);
+        slotFor(nextSeq - 1).output << text;
+    }
 
-    if (!inputFile.is_open() || !outputFile.is_open()) {
-        std::cerr << "Error: Could not open files\n";
-        return;
+    // Issue an INSERT, UPDATE or DELETE to every copy of the partitions it
+    // touches. One from a prepared statement carries only its values when
+    // all of those workers hold the statement, and the statement too otherwise.
+    void issueWrite(char command, int table, bool expectsReply, const WorkItem& item, int prepared, const std::string& values) {
+        std::string body;
+        if (prepared < 0) {
+            appendBytes(body, &item, sizeof(WorkItem));
+            issue(command, table, true, expectsReply, body, nullptr);
+            return;
+        }
+
+        bool held = true;
+        for (int w = 0; w < numWorkers; ++w) {
+            if (!touches[w]) continue;
+            for (int slot = 0; slot < replicas; ++slot) {
+                bool& holds = templateHeld[prepared * numWorkers + replicaHost(w, slot)];
+                held = held && holds;
+                holds = true;
+            }
+        }
+        if (!held) appendBytes(body, &templates.get(prepared), sizeof(PreparedStatement));
+        body += values;
+
+        preparedCommand = held ? 'X' : 'P';
+        preparedStatement = prepared;
+        issue(command, table, true, expectsReply, body, nullptr);
+        preparedCommand = 0;
     }
 
-    char setAttr1[MAX_ATTR_LENGTH];
-    char setAttr2[MAX_ATTR_LENGTH];
-    int setAttr3;
-    char command[MAX_COMMAND_LENGTH];
-    char attr1[MAX_ATTR_LENGTH];
-    char attr2[MAX_ATTR_LENGTH];
-    int attr3;
+    // EXPLAIN: list the workers whose flag is set
+    void describeWorkers(const char* label, const bool* flags, std::ostream& plan) const {
+        int count = 0;
+        plan << "  " << label << ":";
+        for (int w = 0; w < numWorkers; ++w) {
+            if (!flags[w]) continue;
+            plan << (count > 0 ? ", " : " ") << w + 1;
+            count++;
+        }
+        plan << (count == 0 ? " none" : "") << " (" << count << " of " << numWorkers << ")\n";
+    }
 
-    while (inputFile.getline(command, MAX_COMMAND_LENGTH)) {
-        std::cout << "Processing command: " << command << std::endl;
+    // EXPLAIN: route a statement as it would be routed, leaving its footprint
+    // in touches, and say which workers the partition key and the value
+    // summaries ruled out
+    void describeRouting(int table, int attr3, const char* attr1Condition, const char* attr2Condition, std::ostream& plan) {
+        touchPartition(attr3);
+        bool* routed = new bool[numWorkers];
+        bool* pruned = new bool[numWorkers];
+        for (int w = 0; w < numWorkers; ++w) routed[w] = touches[w];
+        long long skipped = partitionsSkipped;
+        skipUnmatched(table, attr1Condition, attr2Condition);
+        partitionsSkipped = skipped;  // A plan skips nothing
+
+        describeWorkers("Workers contacted", touches, plan);
+        if (attr3 != -1) {
+            for (int w = 0; w < numWorkers; ++w) pruned[w] = !routed[w];
+            describeWorkers("Pruned by the partition key", pruned, plan);
+        }
+        if (isExactCondition(attr1Condition) || isExactCondition(attr2Condition)) {
+            for (int w = 0; w < numWorkers; ++w) pruned[w] = routed[w] && !touches[w];
+            describeWorkers("Pruned by value summaries", pruned, plan);
+        }
+        delete[] routed;
+        delete[] pruned;
+    }
 
-        if (command[0] == 'I') {  // INSERT
-            parseInputLine(command, attr1, attr2, attr3, setAttr1, setAttr2, setAttr3);
-            std::cout << "Parsed INSERT values: " << attr1 << ", " << attr2 << ", " << attr3 << std::endl;
+    // EXPLAIN: write the plan a statement would get, leaving its footprint in
+    // touches. Returns the table of a plain SELECT, which ANALYZE can run, or -1.
+    int planStatement(char* command, SelectQuery& query, std::ostream& plan) {
+        plan << "Plan: " << command << "\n";
+        touchAllWorkers();
+
+        if (command[0] == 'C') {
+            plan << "  Catalog change, sent to every worker\n";
+            return -1;
+        }
 
-            // Broadcast insert to all workers
-            for (int worker = 1; worker <= numWorkers; ++worker) {
-                MPI_Send(attr1, MAX_ATTR_LENGTH, MPI_CHAR, worker, 0, MPI_COMM_WORLD);
-                MPI_Send(attr2, MAX_ATTR_LENGTH, MPI_CHAR, worker, 1, MPI_COMM_WORLD);
-                MPI_Send(&attr3, 1, MPI_INT, worker, 2, MPI_COMM_WORLD);
+        if (command[0] == 'S' && findKeyword(command, " JOIN ") >= 0) {
+            JoinQuery join;
+            if (!parseJoinQuery(command, catalog, join)) {
+                plan << "  Error: could not parse join\n";
+                return -1;
             }
+            int strategy = chooseJoinStrategy(tableRows[join.leftTable], tableRows[join.rightTable]);
+            plan << "  Join: " << (strategy == JOIN_SHUFFLE ? "both sides shuffled on the join keys" :
+                strategy == JOIN_BROADCAST_LEFT ? "left side broadcast" : "right side broadcast")
+                << ", estimated rows " << tableRows[join.leftTable] << " and " << tableRows[join.rightTable] << "\n";
+            describeWorkers("Workers contacted", touches, plan);
+            plan << "  Master: concatenates the workers' joined rows\n";
+            return -1;
         }
-        else if (command[0] == 'S') {  // SELECT
-            SelectQuery query;
+
+        int view = findStatementView(command, catalog);
+        if (view >= 0) {
+            plan << "  View: " << catalog.getView(view).name << ", kept up to date by every write; no scan\n";
+            describeWorkers("Workers contacted", touches, plan);
+            plan << "  Master: adds up the groups every worker sends\n";
+            return -1;
+        }
+
+        int table = normalizeStatement(command, catalog);
+        if (table < 0) {
+            plan << "  Error: unknown table\n";
+            return -1;
+        }
+        plan << "  Table: " << catalog.getSchema(table).name << "\n";
+
+        if (command[0] == 'S') {
             parseSelectQuery(command, query);
+            describeRouting(table, query.attr3Condition, query.attr1Condition, query.attr2Condition, plan);
+            describeScan(query, plan);
+            if (replicas > 1) plan << "  Copies: each partition is read from the least loaded of its " << replicas << " copies\n";
+            if (!query.isOrdered()) plan << "  Master: concatenates the workers' results\n";
+            else if (query.limit >= 0) plan << "  Master: merges the workers' sorted runs, stopping after " << query.limit << " rows\n";
+            else plan << "  Master: merges the workers' sorted runs\n";
+            return table;
+        }
+
+        if (command[0] != 'I' && command[0] != 'U' && command[0] != 'D') {
+            plan << "  Error: not a statement the database runs\n";
+            return -1;
+        }
 
-            // Prepare buffers for query conditions
-            char workerAttr1[MAX_ATTR_LENGTH];
-            char workerAttr2[MAX_ATTR_LENGTH];
-            int workerAttr3;
+        WorkItem item;
+        parseInputLine(command, item.attr1, item.attr2, item.attr3, item.setAttr1, item.setAttr2, item.setAttr3);
+        if (command[0] == 'I') {
+            int owner = partitionOf(item.attr3, numWorkers);
+            for (int w = 0; w < numWorkers; ++w) touches[w] = w == owner;
+            describeWorkers("Workers contacted", touches, plan);
+        }
+        else {
+            if (command[0] == 'U' && item.setAttr3 != -1) {
+                describeWorkers("Workers contacted", touches, plan);
+                plan << "  Moves: SET attr3 may move rows to any partition; the master re-inserts them\n";
+            }
+            else {
+                describeRouting(table, item.attr3, item.attr1, item.attr2, plan);
+            }
+            plan << "  Access: block scan; zone maps pass over blocks that cannot match\n";
+            describeConditions(item.attr1, item.attr2, item.attr3, INT_MIN, INT_MAX, plan);
+        }
+        if (replicas > 1) plan << "  Copies: written to all " << replicas << " copies of each partition\n";
+        return -1;
+    }
 
-            // If specific conditions aren't set, use wildcard/default
-            safeCopyString(workerAttr1, query.attr1Condition[0] != '\0' ? query.attr1Condition : "*", MAX_ATTR_LENGTH);
-            safeCopyString(workerAttr2, query.attr2Condition[0] != '\0' ? query.attr2Condition : "*", MAX_ATTR_LENGTH);
-            workerAttr3 = query.attr3Condition;
+    // EXPLAIN shows the plan. EXPLAIN ANALYZE also runs a plain SELECT on each
+    // partition's own worker and reports what every scan did and how long its
+    // answer took to come back.
+    void explain(char* statement) {
+        flushBatch();
+        bool analyze = findKeyword(statement, "ANALYZE ") == 0;
+        if (analyze) statement += 8;
+
+        std::ostringstream plan;
+        SelectQuery query;
+        int table = planStatement(statement, query, plan);
+        if (!analyze) {
+            issueLocal(plan.str());
+            return;
+        }
+        if (table < 0) {
+            plan << "  Not analyzed: ANALYZE runs plain SELECTs only\n";
+            issueLocal(plan.str());
+            return;
+        }
 
-            // Track tuple counts
-            MyVector<int> tupleCounts;
-            bool found = false;
+        std::string body;
+        appendBytes(body, &query, sizeof(SelectQuery));
+        issue('A', table, false, true, body, &query, plan.str());
+    }
 
-            // Query all workers
-            for (int worker = 1; worker <= numWorkers; ++worker) {
-                // Send enhanced query parameters
-                MPI_Send(workerAttr1, MAX_ATTR_LENGTH, MPI_CHAR, worker, 3, MPI_COMM_WORLD);
+public:
+    Dispatcher(int workers, int replicaCount, int window, int batchLimit, int cacheEntries, StatementStats& statementStats,
+        SharedReplyArea& replyArea, OutputWriter* output, ClientRouter* clientRouter, std::ofstream& tupleCounts)
+        : numWorkers(workers), replicas(replicaCount), readTurn(0), windowSize(window), nextSeq(0), oldestSeq(0), repliesPending(0),
+          batchSize(0), batchTable(0), cache(cacheEntries), stats(statementStats), shared(replyArea), submittedAt(0.0),
+          outputFile(output), router(clientRouter), tupleCountFile(tupleCounts) {
+        this->window = new PendingStatement[windowSize];
+        for (int i = 0; i < windowSize; ++i) {
+            PendingStatement& stmt = this->window[i];
+            stmt.touchesWorker = new bool[numWorkers];
+            stmt.pendingReplies = 0;
+            stmt.workerMessages = new std::string[numWorkers];
+            stmt.movedRows = new std::string[numWorkers];
+            stmt.workerText = new std::string[numWorkers];
+            stmt.runSizes = new int[numWorkers]();
+            stmt.affectedCounts = new int[numWorkers]();
+            stmt.tupleCounts = new int[numWorkers]();
+            stmt.movedTo = new int[numWorkers]();
+            stmt.replySeconds = new double[numWorkers]();
+        }
+        writersInFlight = new int[numWorkers]();
+        readLoad = new int[numWorkers]();
+        summaries = new ValueSummary[MAX_TABLES * numWorkers];
+        partitionsSkipped = 0;
+        retiredCounts = new int[MAX_TABLES * numWorkers]();
+        touches = new bool[numWorkers];
+        templateHeld = new bool[MAX_PREPARED * numWorkers]();
+        preparedCommand = 0;
+        preparedStatement = -1;
+        for (int i = 0; i < MAX_TABLES; ++i) tableRows[i] = 0;
+
+        // A batch takes one window slot per SELECT
+        maxBatch = batchLimit < windowSize ? batchLimit : windowSize;
+        if (maxBatch < 1) maxBatch = 1;
+        batch = new SelectQuery[maxBatch];
+        batchTimes = new double[maxBatch];
+    }
 
-                // Send selected columns
-                int selectedColumnCount = query.selectedColumnCount;
-                MPI_Send(&selectedColumnCount, 1, MPI_INT, worker, 4, MPI_COMM_WORLD);
+    ~Dispatcher() {
+        for (int i = 0; i < windowSize; ++i) {
+            PendingStatement& stmt = window[i];
+            delete[] stmt.touchesWorker;
+            delete[] stmt.workerMessages;
+            delete[] stmt.movedRows;
+            delete[] stmt.workerText;
+            delete[] stmt.runSizes;
+            delete[] stmt.affectedCounts;
+            delete[] stmt.tupleCounts;
+            delete[] stmt.movedTo;
+            delete[] stmt.replySeconds;
+        }
+        delete[] window;
+        delete[] writersInFlight;
+        delete[] readLoad;
+        delete[] summaries;
+        delete[] retiredCounts;
+        delete[] touches;
+        delete[] templateHeld;
+        delete[] batch;
+        delete[] batchTimes;
+    }
 
-                // Send column names if any specific columns are selected
-                if (selectedColumnCount > 0) {
-                    MPI_Send(query.selectedColumns, selectedColumnCount * MAX_COLUMN_NAME, MPI_CHAR, worker, 5, MPI_COMM_WORLD);
-                }
+    // Issue a statement; false if it is not one the database runs, in which
+    // case it takes no place in the output
+    bool submit(char* command) {
+        submittedAt = MPI_Wtime();
 
-                // Send other query conditions
-                MPI_Send(workerAttr2, MAX_ATTR_LENGTH, MPI_CHAR, worker, 6, MPI_COMM_WORLD);
-                MPI_Send(&workerAttr3, 1, MPI_INT, worker, 7, MPI_COMM_WORLD);
+        if (findKeyword(command, "EXPLAIN ") == 0) {
+            explain(command + 8);
+            return true;
+        }
 
-                // Receive worker's results
-                char workerResult[MAX_RESULT_LENGTH];
-                MPI_Status status;
-                MPI_Recv(workerResult, MAX_RESULT_LENGTH, MPI_CHAR, worker, 8, MPI_COMM_WORLD, &status);
+        if (findKeyword(command, "PREPARE ") == 0) {
+            if (templates.prepare(command, catalog) < 0) {
+                issueLocal(std::string("Error: could not prepare: ") + command + "\n");
+            }
+            else {
+                issueLocal(std::string());
+            }
+            return true;
+        }
 
-                if (workerResult[0] != '\0') {
-                    outputFile << workerResult;
-                    outputFile.flush();
-                    found = true;
-                }
+        // Anything but a plain SELECT ends the current batch; an EXECUTE
+        // ends it once it is known not to be one
+        bool isJoin = command[0] == 'S' && findKeyword(command, " JOIN ") >= 0;
+        bool isExecute = findKeyword(command, "EXECUTE ") == 0;
+        if ((command[0] != 'S' && !isExecute) || isJoin) {
+            flushBatch();
+        }
 
-                // Get the tuple count from the worker
-                int workerTupleCount;
-                MPI_Recv(&workerTupleCount, 1, MPI_INT, worker, 9, MPI_COMM_WORLD, &status);
-                tupleCounts.push_back(workerTupleCount);
+        if (command[0] == 'C' && findKeyword(command, " VIEW ") >= 0) {  // CREATE MATERIALIZED VIEW
+            ViewSchema schema;
+            if (!parseCreateView(command, catalog, schema) || catalog.createView(schema) < 0) {
+                issueLocal(std::string("Error: could not create view: ") + command + "\n");
+                return true;
             }
+            std::string body;
+            appendBytes(body, &schema, sizeof(ViewSchema));
+            touchAllWorkers();
+            issue('V', schema.table, true, false, body, nullptr);
+            return true;
+        }
 
-            if (!found) {
-                outputFile << "No records found.";
+        if (command[0] == 'C') {  // CREATE TABLE
+            TableSchema schema;
+            if (!parseCreateTable(command, schema) || catalog.createTable(schema) < 0) {
+                issueLocal(std::string("Error: could not create table: ") + command + "\n");
+                return true;
+            }
+            std::string body;
+            appendBytes(body, &schema, sizeof(TableSchema));
+            touchAllWorkers();
+            issue('C', 0, true, false, body, nullptr);
+            return true;
+        }
 
-                // Output specific conditions used in the query
-                outputFile << " Query attributes: ";
-                bool firstCondition = true;
+        if (isJoin) {  // SELECT ... JOIN
+            JoinQuery join;
+            if (!parseJoinQuery(command, catalog, join)) {
+                issueLocal(std::string("Error: could not parse join: ") + command + "\n");
+                return true;
+            }
+            join.strategy = chooseJoinStrategy(tableRows[join.leftTable], tableRows[join.rightTable]);
+
+            // Every worker takes part in the exchange
+            std::string body;
+            appendBytes(body, &join, sizeof(JoinQuery));
+            touchAllWorkers();
+            issue('J', join.leftTable, false, true, body, nullptr);
+            return true;
+        }
 
-                if (query.attr1Condition[0] != '\0' && query.attr1Condition[0] != '*') {
-                    outputFile << "attr1=" << query.attr1Condition;
-                    firstCondition = false;
-                }
+        int view = findStatementView(command, catalog);
+        if (view >= 0) {  // SELECT from a materialized view: each worker sends its groups
+            flushBatch();
+            std::string body;
+            appendBytes(body, &view, sizeof(int));
+            touchAllWorkers();
+            issue('G', catalog.getView(view).table, false, true, body, nullptr);
+            slotFor(nextSeq - 1).view = view;
+            return true;
+        }
 
-                if (query.attr2Condition[0] != '\0' && query.attr2Condition[0] != '*') {
-                    if (!firstCondition) outputFile << ", ";
-                    outputFile << "attr2=" << query.attr2Condition;
-                    firstCondition = false;
-                }
+        // The parsed form comes from the statement's template when it has one
+        SelectQuery query;
+        WorkItem item;
+        int prepared = -1;
+        std::string values;
+        int table;
+        char kind = command[0];
+        if (isExecute) {
+            prepared = templates.execute(command, values);
+            if (prepared < 0) {
+                issueLocal(std::string("Error: could not execute: ") + command + "\n");
+                return true;
+            }
+            bindParameters(templates.get(prepared), values.data(), query, item);
+            table = templates.get(prepared).table;
+            kind = templates.get(prepared).command;
+        }
+        else if (kind == 'S' || kind == 'I' || kind == 'U' || kind == 'D') {
+            table = templates.resolve(command, catalog, query, item, prepared, values);
+        }
+        else {
+            table = normalizeStatement(command, catalog);
+        }
+        if (table < 0) {
+            issueLocal(std::string("Error: unknown table: ") + command + "\n");
+            return true;
+        }
 
-                if (query.attr3Condition != -1) {
-                    if (!firstCondition) outputFile << ", ";
-                    outputFile << "attr3=" << query.attr3Condition;
-                }
+        if (kind == 'S') {  // SELECT
+            std::string cached;
+            if (cache.isEnabled() && cache.lookup(table, query, cached)) {
+                issueCached(table, query, cached);
+                return true;
+            }
+
+            // Held back so that a run of SELECTs on one table shares a scan
+            if (batchSize > 0 && (batchTable != table || batchSize == maxBatch)) {
+                flushBatch();
+            }
+            batch[batchSize] = query;
+            batchTimes[batchSize++] = submittedAt;
+            batchTable = table;
+            return true;
+        }
 
-                outputFile << "\n";
-                outputFile.flush();
+        if (kind != 'I' && kind != 'U' && kind != 'D') {
+            return false;
+        }
+        flushBatch();
+
+        Tuple row;
+        safeCopyString(row.attr1, item.attr1, MAX_ATTR_LENGTH);
+        safeCopyString(row.attr2, item.attr2, MAX_ATTR_LENGTH);
+        row.attr3 = item.attr3;
+        if (cache.isEnabled()) {
+            if (kind == 'I') {
+                cache.invalidateInsert(table, row);
+            }
+            else {
+                cache.invalidateWrite(table, item);
             }
+        }
 
-            // Write counts to CSV
-            for (int i = 0; i < tupleCounts.getSize(); ++i) {
-                tupleCountFile << (i > 0 ? "," : "") << tupleCounts[i];
+        if (kind == 'I') {  // INSERT
+            std::cout << "Parsed INSERT values: " << item.attr1 << ", " << item.attr2 << ", " << item.attr3 << std::endl;
+
+            // Only the owning worker receives the row; it needs no reply since later
+            // statements to the same worker are received after it
+            int owner = partitionOf(item.attr3, numWorkers);
+            for (int w = 0; w < numWorkers; ++w) touches[w] = w == owner;
+            issueWrite('I', table, false, item, prepared, values);
+            if (owner >= 0) {
+                tableRows[table]++;
+                summaries[table * numWorkers + owner].addRow(row);
+            }
+        }
+        else if (kind == 'U') {  // UPDATE
+            // Changing attr3 may move rows to any partition
+            if (item.setAttr3 != -1) {
+                touchAllWorkers();
             }
-            tupleCountFile << "\n";
+            else {
+                touchPartition(item.attr3);
+                skipUnmatched(table, item.attr1, item.attr2);
+            }
+            issueWrite('U', table, true, item, prepared, values);
         }
-        else if (command[0] == 'U') {  // UPDATE
-            parseInputLine(command, attr1, attr2, attr3, setAttr1, setAttr2, setAttr3);
+        else {  // DELETE
+            touchPartition(item.attr3);
+            skipUnmatched(table, item.attr1, item.attr2);
+            issueWrite('D', table, true, item, prepared, values);
+        }
+        return true;
+    }
 
-            int totalUpdated = 0;
-            for (int worker = 1; worker <= numWorkers; ++worker) {
-                // Send update command to worker
-                MPI_Send(attr1, MAX_ATTR_LENGTH, MPI_CHAR, worker, 8, MPI_COMM_WORLD);
-                MPI_Send(attr2, MAX_ATTR_LENGTH, MPI_CHAR, worker, 9, MPI_COMM_WORLD);
-                MPI_Send(&attr3, 1, MPI_INT, worker, 10, MPI_COMM_WORLD);
-                MPI_Send(setAttr1, MAX_ATTR_LENGTH, MPI_CHAR, worker, 11, MPI_COMM_WORLD);
-                MPI_Send(setAttr2, MAX_ATTR_LENGTH, MPI_CHAR, worker, 12, MPI_COMM_WORLD);
-                MPI_Send(&setAttr3, 1, MPI_INT, worker, 13, MPI_COMM_WORLD);
+    // A statement that is answered with the text alone, such as an error
+    void submitLocal(const std::string& text) {
+        issueLocal(text);
+    }
 
-                // Receive update results
-                int workerUpdateCount;
-                MPI_Status status;
-                MPI_Recv(&workerUpdateCount, 1, MPI_INT, worker, 14, MPI_COMM_WORLD, &status);
+    // Issue the SELECTs held back for a shared scan
+    void flush() {
+        flushBatch();
+    }
 
-                // Receive and write update details
-                char updateDetails[MAX_RESULT_LENGTH * 10];  // Larger buffer for multiple updates
-                MPI_Recv(updateDetails, MAX_RESULT_LENGTH * 10, MPI_CHAR, worker, 15, MPI_COMM_WORLD, &status);
-                if (workerUpdateCount > 0) {
-                    outputFile << "Updates from worker " << worker << ":\n";
-                    outputFile << updateDetails;
-                }
+    // Take in the replies that have arrived and write out the statements they
+    // finish, without blocking. Returns whether any reply arrived.
+    bool poll() {
+        int arrived = 1;
+        bool received = false;
+        while (repliesPending > 0 && arrived) {
+            MPI_Status status;
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &arrived, &status);
+            if (arrived) receiveReply(status);
+            received = received || arrived;
+        }
+        retireFinished();
+        return received;
+    }
 
-                totalUpdated += workerUpdateCount;
-            }
+    // Nothing is held back, in flight or waiting to be written out
+    bool isIdle() const {
+        return batchSize == 0 && oldestSeq == nextSeq;
+    }
+
+    // Wait for everything in flight, write it out and stop the workers
+    void finish() {
+        flushBatch();
+        while (oldestSeq < nextSeq) {
+            waitForProgress();
+            retireFinished();
+        }
+
+        for (int worker = 1; worker <= numWorkers; ++worker) {
+            CommandHeader header = { 'Q', nextSeq, 0, 0 };
+            MPI_Send(&header, sizeof(CommandHeader), MPI_BYTE, worker, COMMAND_TAG, MPI_COMM_WORLD);
+        }
+
+        if (cache.isEnabled()) {
+            cache.printStats(std::cout);
+        }
+        std::cout << "Partitions skipped by value summaries: " << partitionsSkipped << std::endl;
+    }
+};
+
+void runMaster(int numWorkers, int replicas, int windowSize, int batchSize, int cacheEntries, const std::string& inputFileName,
+    const std::string& outputFileName, const std::string& tupleCountFileName, int outputFormat, int flushMs, SharedReplyArea& shared,
+    StatementStats& stats) {
+    StatementReader inputFile(inputFileName);
+    OutputWriter outputFile(outputFileName, outputFormat, flushMs);
+    std::ofstream tupleCountFile(tupleCountFileName, std::ios::out);
+
+    if (!inputFile.is_open() || !outputFile.is_open()) {
+        std::cerr << "Error: Could not open files\n";
+        return;
+    }
+
+    Dispatcher dispatcher(numWorkers, replicas, windowSize, batchSize, cacheEntries, stats, shared, &outputFile, nullptr, tupleCountFile);
+    char command[MAX_COMMAND_LENGTH];
+
+    stats.start();
+    while (inputFile.next(command, MAX_COMMAND_LENGTH)) {
+        std::cout << "Processing command: " << command << std::endl;
+        dispatcher.submit(command);
+    }
+
+    // Write out everything still in flight and send the termination signal
+    dispatcher.finish();
+    stats.stop();
+
+    inputFile.close();
+    outputFile.close();
+}
+
+#ifndef _WIN32
+const int SERVER_READ_CHUNK = 1 << 16;
+const int SERVER_SPIN_POLLS = 64;         // Loops without a reply before the server waits in poll at all
+const int SERVER_POLL_MICROSECONDS = 50;  // How long it then waits between reply probes
+
+// Split a client's input into statements and submit them, in order
+void submitClientStatements(int id, ClientConnection& client, ClientRouter& router, Dispatcher& dispatcher, bool& stopping) {
+    char command[MAX_COMMAND_LENGTH];
+    size_t start = 0;
+    size_t end;
+    while (!stopping && (end = client.input.find('\n', start)) != std::string::npos) {
+        size_t length = end - start;
+        if (length > 0 && client.input[end - 1] == '\r') length--;
+        if (length > (size_t)MAX_COMMAND_LENGTH - 1) length = MAX_COMMAND_LENGTH - 1;
+        copyBytes(command, client.input.data() + start, (int)length);
+        command[length] = '\0';
+        start = end + 1;
+
+        if (length == 0) continue;
+        if (safeCompareStrings(command, SHUTDOWN_STATEMENT, MAX_COMMAND_LENGTH)) {
+            stopping = true;
+            break;
+        }
+
+        router.expect(id);
+        if (!dispatcher.submit(command)) {
+            dispatcher.submitLocal(std::string("Error: unsupported statement: ") + command + "\n");
+        }
+    }
+    client.input.erase(0, start);
+}
+
+// Serve statements from clients on a local socket until one sends SHUTDOWN.
+// Every client's statements join one pipeline to the workers, so the data
+// stays loaded from one job to the next and concurrent clients share the
+// window and the batched scans. Each client gets its answers in its own order.
+void runServer(int numWorkers, int replicas, int windowSize, int batchSize, int cacheEntries, const std::string& address,
+    const std::string& tupleCountFileName, SharedReplyArea& shared, StatementStats& stats) {
+    std::ofstream tupleCountFile(tupleCountFileName, std::ios::out);
+    ClientRouter router;
+    Dispatcher dispatcher(numWorkers, replicas, windowSize, batchSize, cacheEntries, stats, shared, nullptr, &router, tupleCountFile);
+
+    int listener = listenOn(address);
+    if (listener < 0) {
+        std::cerr << "Error: Could not listen on " << address << "\n";
+        dispatcher.finish();
+        return;
+    }
+    setNonBlocking(listener);
+    std::cout << "Listening on " << address << std::endl;
+
+    MyVector<pollfd> fds;
+    MyVector<int> fdClients;  // Client id of each entry of fds after the listener
+    char buffer[SERVER_READ_CHUNK];
+    bool stopping = false;
+    int quietPolls = 0;  // Loops in a row in which no reply arrived
+
+    stats.start();
+    while (!stopping || !dispatcher.isIdle() || router.hasOutput()) {
+        fds.clear();
+        fdClients.clear();
+        pollfd listening = { listener, (short)(stopping ? 0 : POLLIN), 0 };
+        fds.push_back(listening);
+        for (int id = 0; id < router.getSlotCount(); ++id) {
+            ClientConnection* client = router.get(id);
+            if (client == nullptr || client->fd < 0) continue;
+            short events = 0;
+            if (!stopping && !client->inputClosed) events |= POLLIN;
+            if (client->outputSent < client->output.length()) events |= POLLOUT;
+            pollfd entry = { client->fd, events, 0 };
+            fds.push_back(entry);
+            fdClients.push_back(id);
+        }
 
-            outputFile << "Total records updated: " << totalUpdated << "\n\n";
-            outputFile.flush();
+        // Sleep in poll until a client is ready. While statements wait on the
+        // workers, keep probing for replies as long as they are coming in,
+        // then wait only a moment at a time so they are still taken in promptly.
+        if (dispatcher.isIdle()) {
+            poll(fds.getData(), fds.getSize(), -1);
+        }
+        else if (quietPolls < SERVER_SPIN_POLLS) {
+            poll(fds.getData(), fds.getSize(), 0);
+        }
+        else {
+            timespec wait = { 0, SERVER_POLL_MICROSECONDS * 1000 };
+            ppoll(fds.getData(), fds.getSize(), &wait, nullptr);
         }
-        else if (command[0] == 'D') {  // DELETE
-            parseInputLine(command, attr1, attr2, attr3, setAttr1, setAttr2, setAttr3);
 
-            int totalDeleted = 0;
-            for (int worker = 1; worker <= numWorkers; ++worker) {
-                // Send delete command to worker
-                MPI_Send(attr1, MAX_ATTR_LENGTH, MPI_CHAR, worker, 16, MPI_COMM_WORLD);
-                MPI_Send(attr2, MAX_ATTR_LENGTH, MPI_CHAR, worker, 17, MPI_COMM_WORLD);
-                MPI_Send(&attr3, 1, MPI_INT, worker, 18, MPI_COMM_WORLD);
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listener, nullptr, nullptr)) >= 0) {
+                setNonBlocking(fd);
+                router.add(fd);
+            }
+        }
 
-                // Receive delete results
-                int workerDeleteCount;
-                MPI_Status status;
-                MPI_Recv(&workerDeleteCount, 1, MPI_INT, worker, 19, MPI_COMM_WORLD, &status);
+        for (int i = 1; i < fds.getSize(); ++i) {
+            int id = fdClients[i - 1];
+            ClientConnection& client = *router.get(id);
+            bool failed = (fds[i].revents & (POLLERR | POLLNVAL)) != 0;
 
-                // Receive and write delete details
-                char deleteDetails[MAX_RESULT_LENGTH * 10];
-                MPI_Recv(deleteDetails, MAX_RESULT_LENGTH * 10, MPI_CHAR, worker, 20, MPI_COMM_WORLD, &status);
-                if (workerDeleteCount > 0) {
-                    outputFile << "Deletes from worker " << worker << ":\n";
-                    outputFile << deleteDetails;
+            if (!failed && (fds[i].revents & (POLLIN | POLLHUP)) && !client.inputClosed && !stopping) {
+                ssize_t received = recv(client.fd, buffer, SERVER_READ_CHUNK, 0);
+                if (received > 0) {
+                    client.input.append(buffer, received);
+                    submitClientStatements(id, client, router, dispatcher, stopping);
+                }
+                else if (received == 0) {
+                    client.inputClosed = true;
                 }
+                else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    failed = true;
+                }
+            }
 
-                totalDeleted += workerDeleteCount;
+            if (!failed && client.outputSent < client.output.length()) {
+                ssize_t sent = send(client.fd, client.output.data() + client.outputSent,
+                    client.output.length() - client.outputSent, MSG_NOSIGNAL);
+                if (sent > 0) {
+                    client.outputSent += sent;
+                    if (client.outputSent == client.output.length()) {
+                        client.output.clear();
+                        client.outputSent = 0;
+                    }
+                }
+                else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    failed = true;
+                }
             }
 
-            outputFile << "Total records deleted: " << totalDeleted << "\n\n";
-            outputFile.flush();
+            // A client that has sent everything is closed once it has every answer
+            if (failed || (client.inputClosed && client.unanswered == 0 && client.output.empty())) {
+                close(client.fd);
+                router.disconnect(id);
+            }
         }
-    }
 
-    // Send termination signal to all workers
-    for (int worker = 1; worker <= numWorkers; ++worker) {
-        char terminateMsg = '\0';
-        MPI_Send(&terminateMsg, 1, MPI_CHAR, worker, 99, MPI_COMM_WORLD);
+        // Whatever arrived has been read, so the SELECTs held back go out now
+        dispatcher.flush();
+        if (dispatcher.poll()) quietPolls = 0;
+        else quietPolls++;
     }
 
-    inputFile.close();
-    outputFile.close();
+    // Stop the workers
+    dispatcher.finish();
+    stats.stop();
+
+    for (int id = 0; id < router.getSlotCount(); ++id) {
+        ClientConnection* client = router.get(id);
+        if (client != nullptr && client->fd >= 0) close(client->fd);
+    }
+    close(listener);
+    if (!isPortAddress(address)) unlink(address.c_str());
 }
+#endif
 
 int main(int argc, char** argv) {
 
-    MPI_Init(&argc, &argv);
+    // Worker executors send their replies themselves when the library allows
+    // it; with less thread support every MPI call is made from the main thread
+    int threadSupport;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &threadSupport);
+    if (threadSupport < MPI_THREAD_FUNNELED) {
+        std::cerr << "Error: MPI library without thread support\n";
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -1172,6 +3495,19 @@ int main(int argc, char** argv) {
     std::string inputFileName = "input.sql";
     std::string outputFileName = "output.txt";
     std::string tupleCountFileName = "tuple_counts.csv";
+    int windowSize = DEFAULT_PIPELINE_WINDOW;
+    int batchSize = DEFAULT_SCAN_BATCH;
+    int cacheEntries = 0;  // Result cache off unless -c gives its size
+    int outputFormat = OUTPUT_TEXT;
+    int flushMs = DEFAULT_OUTPUT_FLUSH_MS;
+    int executorThreads = DEFAULT_EXECUTOR_THREADS;
+    int replicas = 1;  // Copies of each partition, set with -r
+    long long memoryBudget = 0;       // Bytes of row data a rank keeps in memory, unlimited unless -m gives megabytes
+    std::string spillDirectory = ".";  // Where segments over the budget are spilled, set with -d
+    int sharedAreaMb = DEFAULT_SHARED_AREA_MB;
+    std::string serverAddress;  // Server mode only when -u names a socket path or port
+    std::string statsFileName;  // Run statistics are written only when -s names a file
+    std::string reportPrefix;   // Per-rank reports are written only when -p names a prefix
 
     // Parse command-line arguments
     for (int i = 1; i < argc; ++i) {
@@ -1184,19 +3520,135 @@ int main(int argc, char** argv) {
         else if (std::string(argv[i]) == "-t" && i + 1 < argc) {
             tupleCountFileName = argv[++i];
         }
+        else if (std::string(argv[i]) == "-w" && i + 1 < argc) {
+            windowSize = std::stoi(argv[++i]);
+            if (windowSize < 1) windowSize = 1;
+        }
+        else if (std::string(argv[i]) == "-b" && i + 1 < argc) {
+            batchSize = std::stoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "-c" && i + 1 < argc) {
+            cacheEntries = std::stoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "-f" && i + 1 < argc) {
+            outputFormat = parseOutputFormat(argv[++i]);
+            if (outputFormat < 0) {
+                if (rank == 0) std::cerr << "Error: unknown output format " << argv[i] << ", writing text\n";
+                outputFormat = OUTPUT_TEXT;
+            }
+        }
+        else if (std::string(argv[i]) == "-l" && i + 1 < argc) {
+            flushMs = std::stoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "-e" && i + 1 < argc) {
+            executorThreads = std::stoi(argv[++i]);
+            if (executorThreads < 1) executorThreads = 1;
+        }
+        else if (std::string(argv[i]) == "-u" && i + 1 < argc) {
+            serverAddress = argv[++i];
+        }
+        else if (std::string(argv[i]) == "-r" && i + 1 < argc) {
+            replicas = std::stoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "-m" && i + 1 < argc) {
+            memoryBudget = std::stoll(argv[++i]) << 20;
+        }
+        else if (std::string(argv[i]) == "-d" && i + 1 < argc) {
+            spillDirectory = argv[++i];
+        }
+        else if (std::string(argv[i]) == "-a" && i + 1 < argc) {
+            sharedAreaMb = std::stoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "-s" && i + 1 < argc) {
+            statsFileName = argv[++i];
+        }
+        else if (std::string(argv[i]) == "-p" && i + 1 < argc) {
+            reportPrefix = argv[++i];
+        }
     }
 
+#ifdef _WIN32
+    if (!serverAddress.empty()) {
+        if (rank == 0) std::cerr << "Error: server mode needs POSIX sockets, running the input file instead\n";
+        serverAddress.clear();
+    }
+#endif
+
+    // A partition has at most one copy per worker
+    if (replicas > size - 1) replicas = size - 1;
+    if (replicas > MAX_REPLICAS) replicas = MAX_REPLICAS;
+    if (replicas < 1) replicas = 1;
+
+    // Communicator of the worker ranks only, used for data exchange during joins
+    MPI_Comm workerComm;
+    MPI_Comm_split(MPI_COMM_WORLD, rank == 0 ? MPI_UNDEFINED : 1, rank, &workerComm);
+
+    // Workers on the master's node leave large replies in shared memory
+    SharedReplyArea shared;
+    if (size > 1) shared.open(rank, size - 1, (long long)sharedAreaMb << 20);
+
     double totalStartTime = MPI_Wtime();
+    StatementStats stats;
+    WorkerProfile profile;
 
     if (size == 1) {
-        runSingleProcess(inputFileName, outputFileName, tupleCountFileName);
+        if (!serverAddress.empty()) {
+            std::cerr << "Error: server mode needs at least one worker rank\n";
+        }
+        else {
+            runSingleProcess(inputFileName, outputFileName, tupleCountFileName, outputFormat, flushMs, memoryBudget, spillDirectory, stats);
+        }
     }
     else {
+        if (rank == 0 && !serverAddress.empty()) {
+#ifndef _WIN32
+            runServer(size - 1, replicas, windowSize, batchSize, cacheEntries, serverAddress, tupleCountFileName, shared, stats);
+#endif
+        }
+        else if (rank == 0) {
+            runMaster(size - 1, replicas, windowSize, batchSize, cacheEntries, inputFileName, outputFileName, tupleCountFileName,
+                outputFormat, flushMs, shared, stats);
+        }
+        else {
+            runWorker(rank, size - 1, replicas, executorThreads, threadSupport >= MPI_THREAD_MULTIPLE, memoryBudget, spillDirectory,
+                workerComm, shared, profile);
+        }
+    }
+    shared.close();
+
+    if (workerComm != MPI_COMM_NULL) {
+        MPI_Comm_free(&workerComm);
+    }
+
+    if (!statsFileName.empty()) {
+        // Every rank reports its peak memory to the root, which writes the summary
+        long long peakRssKb = readPeakRssKb();
+        long long* allPeakRssKb = new long long[size];
+        MPI_Gather(&peakRssKb, 1, MPI_LONG_LONG, allPeakRssKb, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
         if (rank == 0) {
-            runMaster(size - 1, inputFileName, outputFileName, tupleCountFileName);
+            std::ofstream statsFile(statsFileName, std::ios::out);
+            if (statsFile.is_open()) {
+                stats.write(statsFile, size, allPeakRssKb);
+            }
+            else {
+                std::cerr << "Error: Could not open statistics file\n";
+            }
+        }
+        delete[] allPeakRssKb;
+    }
+
+    if (!reportPrefix.empty()) {
+        // Every rank writes its own report: statement latencies on the root, phase times on workers
+        std::ofstream reportFile(reportPrefix + ".rank" + std::to_string(rank) + ".json", std::ios::out);
+        if (!reportFile.is_open()) {
+            std::cerr << "Error: Could not open report file\n";
+        }
+        else if (rank == 0) {
+            stats.writeReport(reportFile, rank, size == 1 ? "single" : "master");
         }
         else {
-            runWorker(rank, size - 1);
+            profile.write(reportFile, rank);
         }
     }
 
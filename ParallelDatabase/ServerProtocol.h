@@ -0,0 +1,143 @@
+// Wire protocol of the database's server mode (-u), shared by the server and
+// its clients. A client sends statements as lines of text. The server answers
+// every statement, in the order that client sent them, with one frame: the
+// command letter, the output length as 4 bytes little-endian, then the output
+// text. The line SHUTDOWN stops the server once everything in flight has been
+// answered. Sockets are POSIX only, so server mode is not built on Windows.
+#pragma once
+
+#include <string>
+
+const char SHUTDOWN_STATEMENT[] = "SHUTDOWN";
+const int RESPONSE_HEADER_LENGTH = 5;  // Command letter and 4-byte length
+const int SERVER_BACKLOG = 64;
+
+inline void appendResponse(std::string& out, char command, const char* text, int textLength) {
+    out += command;
+    for (int shift = 0; shift < 32; shift += 8) {
+        out += (char)(((unsigned int)textLength >> shift) & 0xff);
+    }
+    out.append(text, textLength);
+}
+
+#ifndef _WIN32
+
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// An address is a loopback TCP port when it is all digits, else a Unix socket path
+inline bool isPortAddress(const std::string& address) {
+    if (address.empty()) return false;
+    for (size_t i = 0; i < address.size(); ++i) {
+        if (address[i] < '0' || address[i] > '9') return false;
+    }
+    return true;
+}
+
+// Fill in the socket address for an address string; returns its length, or -1
+inline int openSocket(const std::string& address, sockaddr_storage& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    if (isPortAddress(address)) {
+        sockaddr_in* inet = (sockaddr_in*)&addr;
+        inet->sin_family = AF_INET;
+        inet->sin_port = htons((unsigned short)std::atoi(address.c_str()));
+        inet->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return sizeof(sockaddr_in);
+    }
+
+    sockaddr_un* local = (sockaddr_un*)&addr;
+    if (address.size() >= sizeof(local->sun_path)) return -1;
+    local->sun_family = AF_UNIX;
+    std::memcpy(local->sun_path, address.c_str(), address.size() + 1);
+    return sizeof(sockaddr_un);
+}
+
+// Listening socket for the server, or -1. A stale Unix socket file is replaced.
+inline int listenOn(const std::string& address) {
+    sockaddr_storage addr;
+    int length = openSocket(address, addr);
+    if (length < 0) return -1;
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (addr.ss_family == AF_INET) {
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    }
+    else {
+        unlink(address.c_str());
+    }
+
+    if (bind(fd, (sockaddr*)&addr, length) < 0 || listen(fd, SERVER_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Connection to a server, or -1
+inline int connectTo(const std::string& address) {
+    sockaddr_storage addr;
+    int length = openSocket(address, addr);
+    if (length < 0) return -1;
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (sockaddr*)&addr, length) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (addr.ss_family == AF_INET) {
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    return fd;
+}
+
+inline void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Write all of data to a blocking socket; false if the connection failed
+inline bool sendAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Read exactly length bytes from a blocking socket; false at end of stream
+inline bool receiveAll(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(fd, data, length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+// Read the server's answer to the next statement; false if the connection closed
+inline bool readResponse(int fd, char& command, std::string& text) {
+    unsigned char header[RESPONSE_HEADER_LENGTH];
+    if (!receiveAll(fd, (char*)header, RESPONSE_HEADER_LENGTH)) return false;
+    command = (char)header[0];
+    unsigned int length = header[1] | (header[2] << 8) | (header[3] << 16) | ((unsigned int)header[4] << 24);
+    text.resize(length);
+    return length == 0 || receiveAll(fd, &text[0], length);
+}
+
+#endif
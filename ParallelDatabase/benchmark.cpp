@@ -0,0 +1,278 @@
+// Benchmark driver: runs the database over a sweep of rank counts and workload
+// files and collects the statistics each run writes with -s into one CSV and
+// one JSON report.
+//
+// Usage: benchmark [-e exe] [-r ranks] [-d dir | -f file ...] [-n repeats]
+//                  [-m launcher] [-a launcher args] [-x database args]
+//                  [-c csv] [-j json] [-w work dir]
+//
+// Ranks are given as a list and/or ranges, e.g. "1-4,8,12". Without -f every
+// sql_*_insertBias70.sql file in the workload directory is run.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+
+struct OperationStats {
+    std::string type;
+    double count;
+    double perSecond;
+    double p50Ms;
+    double p99Ms;
+    double maxMs;
+};
+
+struct RunResult {
+    std::string file;
+    int ranks;
+    int run;
+    int exitCode;
+    double wallSeconds;
+    std::string statsJson;  // As written by the database, empty if the run failed
+    double statements;
+    double statementsPerSecond;
+    std::vector<OperationStats> operations;
+    std::vector<long long> peakRssKb;
+};
+
+// Parse "1-4,8,12" into a list of rank counts
+std::vector<int> parseRanks(const std::string& text) {
+    std::vector<int> ranks;
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        if (item.empty()) continue;
+        size_t dash = item.find('-');
+        int first = std::stoi(item.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+        for (int r = first; r <= last; ++r) ranks.push_back(r);
+    }
+    return ranks;
+}
+
+// Statement count encoded in names like sql_1000_insertBias70.sql, for sorting
+long long workloadSize(const std::string& path) {
+    std::string name = std::filesystem::path(path).filename().string();
+    size_t digits = name.find_first_of("0123456789");
+    if (digits == std::string::npos) return 0;
+    return std::atoll(name.c_str() + digits);
+}
+
+bool smallerWorkload(const std::string& a, const std::string& b) {
+    long long sizeA = workloadSize(a);
+    long long sizeB = workloadSize(b);
+    return sizeA != sizeB ? sizeA < sizeB : a < b;
+}
+
+std::vector<std::string> findWorkloads(const std::string& directory) {
+    const std::string prefix = "sql_";
+    const std::string suffix = "_insertBias70.sql";
+    std::vector<std::string> files;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() > prefix.size() + suffix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end(), smallerWorkload);
+    return files;
+}
+
+// Value of the number following "key": at or after position from, or 0
+double findNumber(const std::string& json, const std::string& key, size_t from = 0) {
+    size_t pos = json.find("\"" + key + "\":", from);
+    if (pos == std::string::npos) return 0.0;
+    return std::atof(json.c_str() + pos + key.size() + 3);
+}
+
+// Fill in the run's numbers from the statistics file the database wrote
+void parseStats(RunResult& result) {
+    const std::string& json = result.statsJson;
+    result.statements = findNumber(json, "statements");
+    result.statementsPerSecond = findNumber(json, "statementsPerSecond");
+
+    size_t pos = json.find("\"operations\":");
+    while ((pos = json.find("{\"type\": \"", pos)) != std::string::npos) {
+        size_t nameStart = pos + 10;
+        size_t nameEnd = json.find('"', nameStart);
+        OperationStats op;
+        op.type = json.substr(nameStart, nameEnd - nameStart);
+        op.count = findNumber(json, "count", pos);
+        op.perSecond = findNumber(json, "perSecond", pos);
+        op.p50Ms = findNumber(json, "p50Ms", pos);
+        op.p99Ms = findNumber(json, "p99Ms", pos);
+        op.maxMs = findNumber(json, "maxMs", pos);
+        result.operations.push_back(op);
+        pos = nameEnd;
+    }
+
+    pos = json.find("\"peakRssKb\": [");
+    if (pos != std::string::npos) {
+        std::stringstream values(json.substr(pos + 14, json.find(']', pos) - pos - 14));
+        std::string value;
+        while (std::getline(values, value, ',')) {
+            result.peakRssKb.push_back(std::atoll(value.c_str()));
+        }
+    }
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+void writeCsv(const std::string& path, const std::vector<RunResult>& results) {
+    std::ofstream csv(path, std::ios::out);
+    csv << "FileName,NumOfNodes,Run,ExitCode,WallSeconds,Statements,StatementsPerSecond,"
+        << "Operation,Count,OpsPerSecond,P50Ms,P99Ms,MaxMs,PeakRssMaxKb,PeakRssTotalKb\n";
+
+    for (const RunResult& result : results) {
+        long long rssMax = 0;
+        long long rssTotal = 0;
+        for (long long kb : result.peakRssKb) {
+            rssMax = std::max(rssMax, kb);
+            rssTotal += kb;
+        }
+
+        std::string name = std::filesystem::path(result.file).stem().string();
+        std::ostringstream prefix;
+        prefix << name << "," << result.ranks << "," << result.run << "," << result.exitCode << ","
+            << result.wallSeconds << "," << result.statements << "," << result.statementsPerSecond << ",";
+
+        if (result.operations.empty()) {
+            csv << prefix.str() << ",,,,,,," << rssMax << "," << rssTotal << "\n";
+        }
+        for (const OperationStats& op : result.operations) {
+            csv << prefix.str() << op.type << "," << op.count << "," << op.perSecond << ","
+                << op.p50Ms << "," << op.p99Ms << "," << op.maxMs << ","
+                << rssMax << "," << rssTotal << "\n";
+        }
+    }
+}
+
+void writeJson(const std::string& path, const std::vector<RunResult>& results) {
+    std::ofstream json(path, std::ios::out);
+    json << "{\"runs\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const RunResult& result = results[i];
+        json << (i > 0 ? ",\n" : "\n");
+        json << "{\"file\": \"" << jsonEscape(result.file) << "\", \"ranks\": " << result.ranks
+            << ", \"run\": " << result.run << ", \"exitCode\": " << result.exitCode
+            << ", \"wallSeconds\": " << result.wallSeconds
+            << ", \"stats\": " << (result.statsJson.empty() ? "null" : result.statsJson) << "}";
+    }
+    json << "\n]}\n";
+}
+
+int main(int argc, char** argv) {
+    std::string executable = "./parallel_database";
+    std::string launcher = "mpirun";
+    std::string launcherArgs;
+    std::string databaseArgs;
+    std::string workloadDirectory = "x64/Debug";
+    std::string csvFileName = "performance_log.csv";
+    std::string jsonFileName = "performance_log.json";
+    std::string workDirectory = "bench_runs";
+    std::vector<std::string> files;
+    std::vector<int> rankCounts = parseRanks("1-4");
+    int repeats = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Error: missing value for " << arg << "\n";
+            return 1;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "-e") executable = value;
+        else if (arg == "-r") rankCounts = parseRanks(value);
+        else if (arg == "-d") workloadDirectory = value;
+        else if (arg == "-f") files.push_back(value);
+        else if (arg == "-n") repeats = std::max(1, std::stoi(value));
+        else if (arg == "-m") launcher = value;
+        else if (arg == "-a") launcherArgs = value;
+        else if (arg == "-x") databaseArgs = value;
+        else if (arg == "-c") csvFileName = value;
+        else if (arg == "-j") jsonFileName = value;
+        else if (arg == "-w") workDirectory = value;
+        else {
+            std::cerr << "Error: unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (files.empty()) {
+        files = findWorkloads(workloadDirectory);
+    }
+    if (files.empty() || rankCounts.empty()) {
+        std::cerr << "Error: no workload files or rank counts to run\n";
+        return 1;
+    }
+
+    std::filesystem::create_directories(workDirectory);
+    std::string outputPath = workDirectory + "/output.txt";
+    std::string countsPath = workDirectory + "/tuple_counts.csv";
+    std::string statsPath = workDirectory + "/stats.json";
+    std::string logPath = workDirectory + "/run.log";
+
+    std::vector<RunResult> results;
+    for (const std::string& file : files) {
+        for (int ranks : rankCounts) {
+            for (int run = 1; run <= repeats; ++run) {
+                RunResult result;
+                result.file = file;
+                result.ranks = ranks;
+                result.run = run;
+                result.statements = 0;
+                result.statementsPerSecond = 0;
+
+                std::filesystem::remove(statsPath);
+                std::ostringstream command;
+                command << launcher << " -n " << ranks << " " << launcherArgs << " " << executable
+                    << " -i \"" << file << "\" -o \"" << outputPath << "\" -t \"" << countsPath
+                    << "\" -s \"" << statsPath << "\" " << databaseArgs << " > \"" << logPath << "\" 2>&1";
+
+                auto start = std::chrono::steady_clock::now();
+                result.exitCode = std::system(command.str().c_str());
+                auto end = std::chrono::steady_clock::now();
+                result.wallSeconds = std::chrono::duration<double>(end - start).count();
+
+                if (result.exitCode == 0 && std::filesystem::exists(statsPath)) {
+                    result.statsJson = readFile(statsPath);
+                    parseStats(result);
+                }
+
+                std::cout << std::filesystem::path(file).filename().string() << " ranks=" << ranks
+                    << " run=" << run << " exit=" << result.exitCode << " wall=" << result.wallSeconds
+                    << "s statements/s=" << result.statementsPerSecond << std::endl;
+                results.push_back(result);
+
+                // Rewrite the reports after every run so an interrupted sweep keeps its numbers
+                writeCsv(csvFileName, results);
+                writeJson(jsonFileName, results);
+            }
+        }
+    }
+
+    return 0;
+}
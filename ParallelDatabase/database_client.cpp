@@ -0,0 +1,104 @@
+// Command-line client for the database's server mode: sends statements to a
+// server started with -u and prints the output of each one as it comes back.
+//
+// Usage: database_client [-a address] [-i file] [-o file] [-x]
+//   -a address  Unix socket path or loopback TCP port of the server (default pdb.sock)
+//   -i file     statements to run, one per line (default: standard input)
+//   -o file     write the output there instead of standard output
+//   -x          send SHUTDOWN after the statements, stopping the server
+//
+// Statements are sent as they are read and answers printed as they arrive, so
+// a script runs pipelined while an interactive session sees each answer in turn.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "ServerProtocol.h"
+
+// Print every answer until the server closes the connection
+void printResponses(int fd, std::ostream* output) {
+    char command;
+    std::string text;
+    while (readResponse(fd, command, text)) {
+        *output << text << std::flush;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string address = "pdb.sock";
+    std::string inputFileName;
+    std::string outputFileName;
+    bool shutdownServer = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-x") {
+            shutdownServer = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Error: missing value for " << arg << "\n";
+            return 1;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "-a") address = value;
+        else if (arg == "-i") inputFileName = value;
+        else if (arg == "-o") outputFileName = value;
+        else {
+            std::cerr << "Error: unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    std::ifstream inputFile;
+    if (!inputFileName.empty()) {
+        inputFile.open(inputFileName);
+        if (!inputFile.is_open()) {
+            std::cerr << "Error: Could not open " << inputFileName << "\n";
+            return 1;
+        }
+    }
+    std::istream& input = inputFileName.empty() ? std::cin : inputFile;
+
+    std::ofstream outputFile;
+    if (!outputFileName.empty()) {
+        outputFile.open(outputFileName, std::ios::out | std::ios::binary);
+        if (!outputFile.is_open()) {
+            std::cerr << "Error: Could not open " << outputFileName << "\n";
+            return 1;
+        }
+    }
+    std::ostream* output = outputFileName.empty() ? &std::cout : &outputFile;
+
+    int fd = connectTo(address);
+    if (fd < 0) {
+        std::cerr << "Error: Could not connect to " << address << "\n";
+        return 1;
+    }
+
+    std::thread reader(printResponses, fd, output);
+
+    std::string line;
+    bool connected = true;
+    while (connected && std::getline(input, line)) {
+        line += '\n';
+        connected = sendAll(fd, line.data(), line.length());
+    }
+    if (connected && shutdownServer) {
+        std::string statement = std::string(SHUTDOWN_STATEMENT) + "\n";
+        connected = sendAll(fd, statement.data(), statement.length());
+    }
+
+    // The server closes the connection once every statement has been answered
+    shutdown(fd, SHUT_WR);
+    reader.join();
+    close(fd);
+
+    if (!connected) {
+        std::cerr << "Error: Connection to " << address << " lost\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Load generator for the database's server mode: replays a workload over
+// several concurrent connections, each keeping a number of statements in
+// flight, and reports throughput and latency percentiles.
+//
+// Usage: load_client [-a address] [-i file] [-c connections] [-d depth] [-n count]
+//   -a address      Unix socket path or loopback TCP port of the server (default pdb.sock)
+//   -i file         workload, one statement per line (default workload.sql)
+//   -c connections  concurrent client connections (default 4)
+//   -d depth        statements each connection keeps in flight (default 1)
+//   -n count        statements to send, cycling through the workload (default: the workload once)
+//
+// Statement i goes to connection i mod connections, so every connection sends
+// its share of the workload in order.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "ServerProtocol.h"
+
+struct ConnectionResult {
+    bool failed;
+    std::vector<double> latencies;  // Seconds
+    long long counts[128];          // Statements answered per command letter
+};
+
+void runConnection(const std::string& address, const std::vector<std::string>& statements, int connection,
+    int connections, long long count, int depth, ConnectionResult& result) {
+    result.failed = false;
+    for (int c = 0; c < 128; ++c) result.counts[c] = 0;
+
+    int fd = connectTo(address);
+    if (fd < 0) {
+        result.failed = true;
+        return;
+    }
+
+    std::deque<std::chrono::steady_clock::time_point> sentAt;
+    long long next = connection;
+    char command;
+    std::string text;
+    while (next < count || !sentAt.empty()) {
+        // Keep depth statements in flight
+        while (next < count && (int)sentAt.size() < depth) {
+            const std::string& statement = statements[next % statements.size()];
+            sentAt.push_back(std::chrono::steady_clock::now());
+            if (!sendAll(fd, statement.data(), statement.length())) {
+                result.failed = true;
+                close(fd);
+                return;
+            }
+            next += connections;
+        }
+
+        if (!readResponse(fd, command, text)) {
+            result.failed = true;
+            break;
+        }
+        std::chrono::duration<double> latency = std::chrono::steady_clock::now() - sentAt.front();
+        sentAt.pop_front();
+        result.latencies.push_back(latency.count());
+        result.counts[command & 127]++;
+    }
+    close(fd);
+}
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty()) return 0.0;
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int main(int argc, char** argv) {
+    std::string address = "pdb.sock";
+    std::string inputFileName = "workload.sql";
+    int connections = 4;
+    int depth = 1;
+    long long count = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Error: missing value for " << arg << "\n";
+            return 1;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "-a") address = value;
+        else if (arg == "-i") inputFileName = value;
+        else if (arg == "-c") connections = std::max(1, std::stoi(value));
+        else if (arg == "-d") depth = std::max(1, std::stoi(value));
+        else if (arg == "-n") count = std::stoll(value);
+        else {
+            std::cerr << "Error: unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    // The server answers every statement but blank lines and SHUTDOWN
+    std::ifstream input(inputFileName);
+    if (!input.is_open()) {
+        std::cerr << "Error: Could not open " << inputFileName << "\n";
+        return 1;
+    }
+    std::vector<std::string> statements;
+    std::string line;
+    while (std::getline(input, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line == SHUTDOWN_STATEMENT) continue;
+        statements.push_back(line + "\n");
+    }
+    if (statements.empty()) {
+        std::cerr << "Error: no statements in " << inputFileName << "\n";
+        return 1;
+    }
+    if (count < 0) count = (long long)statements.size();
+
+    std::vector<ConnectionResult> results(connections);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < connections; ++c) {
+        threads.emplace_back(runConnection, std::cref(address), std::cref(statements), c, connections, count, depth,
+            std::ref(results[c]));
+    }
+    for (std::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> latencies;
+    long long counts[128] = {};
+    int failed = 0;
+    for (const ConnectionResult& result : results) {
+        if (result.failed) failed++;
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        for (int c = 0; c < 128; ++c) counts[c] += result.counts[c];
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << "statements=" << latencies.size() << " seconds=" << seconds
+        << " statements/s=" << (seconds > 0 ? latencies.size() / seconds : 0.0)
+        << " p50Ms=" << percentile(latencies, 0.50) * 1000.0
+        << " p99Ms=" << percentile(latencies, 0.99) * 1000.0
+        << " maxMs=" << (latencies.empty() ? 0.0 : latencies.back() * 1000.0) << "\n";
+    for (int c = 0; c < 128; ++c) {
+        if (counts[c] > 0) std::cout << "  " << (char)c << ": " << counts[c] << "\n";
+    }
+
+    if (failed > 0) {
+        std::cerr << "Error: " << failed << " of " << connections << " connections failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,436 @@
+// Microbenchmarks for the core kernels in DatabaseCore.h: the string helpers,
+// the statement parsers, row formatting and the Database scan loops over
+// generated tables of several sizes and selectivities.
+//
+// Usage: microbenchmarks [-r reps] [-w warmup] [-t ms] [-n rows] [-f filter]
+//                        [-c csv] [-s seed] [-l]
+//   -r reps     timed repetitions per kernel (default 15)
+//   -w warmup   untimed repetitions before timing (default 3)
+//   -t ms       minimum time of one repetition, the kernel is looped to reach it (default 20)
+//   -n rows     table sizes of the scan kernels, e.g. "10000,100000" (default 10000,100000,1000000)
+//   -f filter   only run kernels whose name contains this text
+//   -c csv      CSV report (default microbenchmarks.csv)
+//   -s seed     random seed of the generated data (default 1)
+//   -l          list the kernel names and exit
+//
+// Every figure is the time per operation: per call for the helpers, parsers and
+// formatting, per row scanned for the scans.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "DatabaseCore.h"
+
+const int INPUT_COUNT = 4096;       // Generated inputs per helper kernel
+const int ATTR3_VALUES = 1000;      // attr3 values are uniform in [0, ATTR3_VALUES)
+const int SHARED_SCAN_QUERIES = 8;  // Queries evaluated together by the shared scan kernel
+
+// Keeps results alive so the compiler cannot drop the timed work
+volatile long long benchmarkSink = 0;
+
+struct Options {
+    int repetitions;
+    int warmup;
+    double minRepetitionSeconds;
+    std::string filter;
+    bool listOnly;
+};
+
+struct Summary {
+    std::string name;
+    std::string unit;
+    long long opsPerRepetition;
+    double minNs;
+    double medianNs;
+    double meanNs;
+    double stddevNs;
+};
+
+// Inputs of the kernel being measured
+struct Fixture {
+    std::vector<Tuple> tuples;
+    std::vector<std::string> values;
+    std::vector<std::string> patterns;
+    std::vector<std::string> insertLines;
+    std::vector<std::string> selectLines;
+    std::vector<std::string> rangeLines;
+    std::vector<std::string> orderedLines;
+    SelectQuery allColumns;
+    SelectQuery twoColumns;
+    Database* table;
+    int tableRows;
+    SelectQuery scanQuery;
+    SelectQuery sharedQueries[SHARED_SCAN_QUERIES];
+    ResultBuffer results[SHARED_SCAN_QUERIES];
+};
+
+// A kernel runs once over its inputs and returns the operations it did
+typedef long long (*Kernel)(Fixture& fixture);
+
+long long runMatchesExact(Fixture& fixture) {
+    long long matches = 0;
+    for (int i = 0; i < INPUT_COUNT; ++i) {
+        matches += matchesPattern(fixture.values[i].c_str(), fixture.values[(i * 7) % INPUT_COUNT].c_str(), MAX_ATTR_LENGTH);
+    }
+    benchmarkSink = benchmarkSink + matches;
+    return INPUT_COUNT;
+}
+
+long long runMatchesPrefix(Fixture& fixture) {
+    long long matches = 0;
+    for (int i = 0; i < INPUT_COUNT; ++i) {
+        matches += matchesPattern(fixture.values[i].c_str(), fixture.patterns[i].c_str(), MAX_ATTR_LENGTH);
+    }
+    benchmarkSink = benchmarkSink + matches;
+    return INPUT_COUNT;
+}
+
+long long runCompareStrings(Fixture& fixture) {
+    long long matches = 0;
+    for (int i = 0; i < INPUT_COUNT; ++i) {
+        matches += safeCompareStrings(fixture.values[i].c_str(), fixture.values[(i * 7) % INPUT_COUNT].c_str(), MAX_ATTR_LENGTH);
+    }
+    benchmarkSink = benchmarkSink + matches;
+    return INPUT_COUNT;
+}
+
+long long runParseLines(const std::vector<std::string>& lines) {
+    char attr1[MAX_ATTR_LENGTH], attr2[MAX_ATTR_LENGTH], setAttr1[MAX_ATTR_LENGTH], setAttr2[MAX_ATTR_LENGTH];
+    int attr3, setAttr3;
+    long long total = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        parseInputLine(lines[i].c_str(), attr1, attr2, attr3, setAttr1, setAttr2, setAttr3);
+        total += attr3 + attr1[0];
+    }
+    benchmarkSink = benchmarkSink + total;
+    return (long long)lines.size();
+}
+
+long long runParseInsert(Fixture& fixture) {
+    return runParseLines(fixture.insertLines);
+}
+
+long long runParseSelectLine(Fixture& fixture) {
+    return runParseLines(fixture.selectLines);
+}
+
+long long runParseQueries(const std::vector<std::string>& lines) {
+    SelectQuery query;
+    long long total = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        parseSelectQuery(lines[i].c_str(), query);
+        total += query.attr3Condition + query.selectedColumnCount + query.limit;
+    }
+    benchmarkSink = benchmarkSink + total;
+    return (long long)lines.size();
+}
+
+long long runParseSelect(Fixture& fixture) {
+    return runParseQueries(fixture.selectLines);
+}
+
+long long runParseRange(Fixture& fixture) {
+    return runParseQueries(fixture.rangeLines);
+}
+
+long long runParseOrdered(Fixture& fixture) {
+    return runParseQueries(fixture.orderedLines);
+}
+
+long long runFormat(Fixture& fixture, const SelectQuery& query) {
+    ResultBuffer result(INT_MAX);
+    RowFormat format(query);
+    for (int i = 0; i < INPUT_COUNT; ++i) {
+        format.append(fixture.tuples[i], result);
+    }
+    benchmarkSink = benchmarkSink + result.getLength();
+    return INPUT_COUNT;
+}
+
+long long runFormatAll(Fixture& fixture) {
+    return runFormat(fixture, fixture.allColumns);
+}
+
+long long runFormatTwo(Fixture& fixture) {
+    return runFormat(fixture, fixture.twoColumns);
+}
+
+long long runEnhancedQuery(Fixture& fixture) {
+    fixture.table->enhancedQuery(fixture.scanQuery, fixture.results[0]);
+    benchmarkSink = benchmarkSink + fixture.results[0].getLength();
+    return fixture.tableRows;
+}
+
+long long runOrderedQuery(Fixture& fixture) {
+    MyVector<Tuple> rows;
+    fixture.table->orderedQuery(fixture.scanQuery, rows);
+    benchmarkSink = benchmarkSink + rows.getSize();
+    return fixture.tableRows;
+}
+
+// Reported per row and query, to compare with one enhancedQuery per query
+long long runSharedScan(Fixture& fixture) {
+    MyVector<Tuple> rows[SHARED_SCAN_QUERIES];
+    fixture.table->sharedScan(fixture.sharedQueries, SHARED_SCAN_QUERIES, fixture.results, rows);
+    benchmarkSink = benchmarkSink + fixture.results[0].getLength();
+    return (long long)fixture.tableRows * SHARED_SCAN_QUERIES;
+}
+
+double elapsedSeconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool selected(const std::string& name, const Options& options) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// Time one kernel: warm up, loop it enough times per repetition to reach the
+// minimum repetition time, then summarize the per-operation times
+void measure(const std::string& name, const char* unit, Kernel kernel, Fixture& fixture,
+    const Options& options, std::vector<Summary>& summaries) {
+    if (!selected(name, options)) return;
+    if (options.listOnly) {
+        std::cout << name << "\n";
+        return;
+    }
+
+    long long loops = 1;
+    for (int i = 0; i < options.warmup; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        kernel(fixture);
+        double seconds = elapsedSeconds(start);
+        if (seconds > 0.0) {
+            loops = std::max(loops, (long long)std::ceil(options.minRepetitionSeconds / seconds));
+        }
+    }
+
+    std::vector<double> nsPerOp;
+    long long opsPerRepetition = 0;
+    for (int r = 0; r < options.repetitions; ++r) {
+        long long ops = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < loops; ++i) {
+            ops += kernel(fixture);
+        }
+        double seconds = elapsedSeconds(start);
+        nsPerOp.push_back(seconds * 1e9 / std::max(1LL, ops));
+        opsPerRepetition = ops;
+    }
+
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    Summary summary;
+    summary.name = name;
+    summary.unit = unit;
+    summary.opsPerRepetition = opsPerRepetition;
+    summary.minNs = nsPerOp.front();
+    size_t middle = nsPerOp.size() / 2;
+    summary.medianNs = nsPerOp.size() % 2 ? nsPerOp[middle] : (nsPerOp[middle - 1] + nsPerOp[middle]) / 2.0;
+    double sum = 0.0;
+    for (double value : nsPerOp) sum += value;
+    summary.meanNs = sum / nsPerOp.size();
+    double squares = 0.0;
+    for (double value : nsPerOp) squares += (value - summary.meanNs) * (value - summary.meanNs);
+    summary.stddevNs = nsPerOp.size() > 1 ? std::sqrt(squares / (nsPerOp.size() - 1)) : 0.0;
+    summaries.push_back(summary);
+
+    std::cout << name << ": median " << summary.medianNs << " ns/" << unit << ", min " << summary.minNs
+        << ", mean " << summary.meanNs << " +- " << summary.stddevNs << std::endl;
+}
+
+// Generated inputs in the shape of the workload generator's statements
+void buildInputs(Fixture& fixture, std::mt19937_64& random) {
+    std::uniform_int_distribution<int> attr1Values(0, 11);
+    std::uniform_int_distribution<int> attr2Values(0, 9);
+    std::uniform_int_distribution<int> attr3Values(0, ATTR3_VALUES - 1);
+
+    for (int i = 0; i < INPUT_COUNT; ++i) {
+        std::string attr1 = "name" + std::to_string(attr1Values(random));
+        std::string attr2 = "group" + std::to_string(attr2Values(random));
+        int attr3 = attr3Values(random);
+
+        Tuple tuple;
+        safeCopyString(tuple.attr1, attr1.c_str(), MAX_ATTR_LENGTH);
+        safeCopyString(tuple.attr2, attr2.c_str(), MAX_ATTR_LENGTH);
+        tuple.attr3 = attr3;
+        fixture.tuples.push_back(tuple);
+
+        fixture.values.push_back(attr1);
+        fixture.patterns.push_back(attr1.substr(0, 5) + "*");
+        fixture.insertLines.push_back("INSERT INTO table VALUES (" + attr1 + ", " + attr2 + ", " + std::to_string(attr3) + ")");
+        fixture.selectLines.push_back("SELECT attr2, attr3 FROM table WHERE attr1=" + attr1 + " AND attr3=" + std::to_string(attr3));
+        fixture.rangeLines.push_back("SELECT attr1, attr2, attr3 FROM table WHERE attr3>=" + std::to_string(attr3) +
+            " AND attr3<=" + std::to_string(attr3 + 9));
+        fixture.orderedLines.push_back("SELECT attr1, attr3 FROM table WHERE attr2=" + attr2 + " ORDER BY attr3 DESC LIMIT 10");
+    }
+
+    parseSelectQuery("SELECT attr1, attr2, attr3 FROM table", fixture.allColumns);
+    parseSelectQuery("SELECT attr2, attr3 FROM table", fixture.twoColumns);
+}
+
+// Fill a table with rows drawn like buildInputs' tuples
+void buildTable(Database& table, int rows, std::mt19937_64& random) {
+    std::uniform_int_distribution<int> attr1Values(0, 11);
+    std::uniform_int_distribution<int> attr2Values(0, 9);
+    std::uniform_int_distribution<int> attr3Values(0, ATTR3_VALUES - 1);
+
+    // Database::insert logs every row; drop the log while loading
+    std::streambuf* console = std::cout.rdbuf(nullptr);
+    for (int i = 0; i < rows; ++i) {
+        std::string attr1 = "name" + std::to_string(attr1Values(random));
+        std::string attr2 = "group" + std::to_string(attr2Values(random));
+        table.insert(attr1.c_str(), attr2.c_str(), attr3Values(random));
+    }
+    std::cout.rdbuf(console);
+}
+
+// Range over attr3 that matches about the given fraction of the rows
+void rangeQuery(double selectivity, const char* columns, const char* tail, SelectQuery& query) {
+    int high = std::max(0, (int)(selectivity * ATTR3_VALUES) - 1);
+    std::string line = std::string("SELECT ") + columns + " FROM table WHERE attr3>=0 AND attr3<=" + std::to_string(high) + tail;
+    parseSelectQuery(line.c_str(), query);
+}
+
+std::vector<int> parseSizes(const std::string& text) {
+    std::vector<int> sizes;
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        if (!item.empty()) sizes.push_back(std::stoi(item));
+    }
+    return sizes;
+}
+
+void writeCsv(const std::string& path, const std::vector<Summary>& summaries, const Options& options) {
+    std::ofstream csv(path, std::ios::out);
+    csv << "Benchmark,Unit,Repetitions,OpsPerRepetition,MinNs,MedianNs,MeanNs,StddevNs\n";
+    for (const Summary& summary : summaries) {
+        csv << summary.name << "," << summary.unit << "," << options.repetitions << "," << summary.opsPerRepetition << ","
+            << summary.minNs << "," << summary.medianNs << "," << summary.meanNs << "," << summary.stddevNs << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    options.repetitions = 15;
+    options.warmup = 3;
+    options.minRepetitionSeconds = 0.02;
+    options.listOnly = false;
+    std::string csvFileName = "microbenchmarks.csv";
+    std::vector<int> tableSizes = parseSizes("10000,100000,1000000");
+    unsigned long long seed = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-l") {
+            options.listOnly = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Error: missing value for " << arg << "\n";
+            return 1;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "-r") options.repetitions = std::max(1, std::stoi(value));
+        else if (arg == "-w") options.warmup = std::max(1, std::stoi(value));
+        else if (arg == "-t") options.minRepetitionSeconds = std::stod(value) / 1000.0;
+        else if (arg == "-n") tableSizes = parseSizes(value);
+        else if (arg == "-f") options.filter = value;
+        else if (arg == "-c") csvFileName = value;
+        else if (arg == "-s") seed = std::stoull(value);
+        else {
+            std::cerr << "Error: unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    std::mt19937_64 random(seed);
+    Fixture fixture;
+    fixture.table = nullptr;
+    fixture.tableRows = 0;
+    buildInputs(fixture, random);
+
+    std::vector<Summary> summaries;
+    measure("matchesPattern/exact", "call", runMatchesExact, fixture, options, summaries);
+    measure("matchesPattern/prefix", "call", runMatchesPrefix, fixture, options, summaries);
+    measure("safeCompareStrings", "call", runCompareStrings, fixture, options, summaries);
+    measure("parseInputLine/insert", "call", runParseInsert, fixture, options, summaries);
+    measure("parseInputLine/select", "call", runParseSelectLine, fixture, options, summaries);
+    measure("parseSelectQuery/equality", "call", runParseSelect, fixture, options, summaries);
+    measure("parseSelectQuery/range", "call", runParseRange, fixture, options, summaries);
+    measure("parseSelectQuery/ordered", "call", runParseOrdered, fixture, options, summaries);
+    measure("RowFormat/allColumns", "call", runFormatAll, fixture, options, summaries);
+    measure("RowFormat/twoColumns", "call", runFormatTwo, fixture, options, summaries);
+
+    const double selectivities[] = { 0.001, 0.01, 0.1, 1.0 };
+    for (int rows : tableSizes) {
+        std::string suffix = "/rows=" + std::to_string(rows);
+
+        // Only load tables some selected kernel scans
+        bool needed = false;
+        const char* kernels[] = { "scan/enhancedQuery", "scan/orderedQuery", "scan/sharedScan",
+            "scan/sealed/enhancedQuery", "scan/sealed/orderedQuery" };
+        for (const char* kernel : kernels) {
+            for (double selectivity : selectivities) {
+                std::ostringstream name;
+                name << kernel << suffix << "/selectivity=" << selectivity;
+                needed = needed || selected(name.str(), options);
+            }
+        }
+        if (!needed) continue;
+
+        Database* table = nullptr;
+        if (!options.listOnly) {
+            table = new Database(rows);
+            buildTable(*table, rows, random);
+        }
+        fixture.table = table;
+        fixture.tableRows = rows;
+
+        for (double selectivity : selectivities) {
+            std::ostringstream name;
+            name << suffix << "/selectivity=" << selectivity;
+
+            rangeQuery(selectivity, "attr1, attr2, attr3", "", fixture.scanQuery);
+            measure("scan/enhancedQuery" + name.str(), "row", runEnhancedQuery, fixture, options, summaries);
+
+            rangeQuery(selectivity, "attr1, attr3", " ORDER BY attr3 DESC LIMIT 10", fixture.scanQuery);
+            measure("scan/orderedQuery" + name.str(), "row", runOrderedQuery, fixture, options, summaries);
+
+            // The batch mixes the generated equality SELECTs with one query at this selectivity
+            for (int q = 0; q < SHARED_SCAN_QUERIES - 1; ++q) {
+                parseSelectQuery(fixture.selectLines[q].c_str(), fixture.sharedQueries[q]);
+            }
+            rangeQuery(selectivity, "attr1, attr2, attr3", "", fixture.sharedQueries[SHARED_SCAN_QUERIES - 1]);
+            measure("scan/sharedScan" + name.str(), "row-query", runSharedScan, fixture, options, summaries);
+        }
+
+        // The same scans over the table's compressed segments
+        if (table != nullptr) table->sealBlocks();
+        for (double selectivity : selectivities) {
+            std::ostringstream name;
+            name << suffix << "/selectivity=" << selectivity;
+
+            rangeQuery(selectivity, "attr1, attr2, attr3", "", fixture.scanQuery);
+            measure("scan/sealed/enhancedQuery" + name.str(), "row", runEnhancedQuery, fixture, options, summaries);
+
+            rangeQuery(selectivity, "attr1, attr3", " ORDER BY attr3 DESC LIMIT 10", fixture.scanQuery);
+            measure("scan/sealed/orderedQuery" + name.str(), "row", runOrderedQuery, fixture, options, summaries);
+        }
+
+        delete table;
+        fixture.table = nullptr;
+    }
+
+    if (!options.listOnly) {
+        writeCsv(csvFileName, summaries, options);
+    }
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+// Checks that binding literals into a statement template gives what parsing
+// the statement gives. A template is checked against a full parse only for
+// the first statement of its shape; every later one is bound by the copies of
+// the parser's rules in DatabaseCore.h, so this runs those copies against the
+// parser on the cases where their rules are easy to get wrong: text values
+// holding 'A', trailing commas in SET lists, exclusive attr3 bounds and LIMIT.
+//
+// Usage: template_tests [-v]
+//   -v   print every statement checked, not only the failures
+//
+// Exits with 1 if any statement binds differently from how it parses, or a
+// shape that should be bound from its template is parsed instead.
+
+#include <iostream>
+#include <string>
+#include "DatabaseCore.h"
+
+// Statements of one shape. The first sets up the automatic template, the
+// others are bound from it unless the template was found unusable.
+struct ShapeCase {
+    const char* name;
+    bool binds;  // Whether the later statements should come from the template
+    const char* statements[6];
+};
+
+const ShapeCase SHAPE_CASES[] = {
+    { "attr1 value", true, {
+        "SELECT * FROM table WHERE attr1=Drama",
+        "SELECT * FROM table WHERE attr1=Action",
+        "SELECT * FROM table WHERE attr1=xAy",
+        "SELECT * FROM table WHERE attr1=A",
+        nullptr } },
+    { "attr2 and attr3 values", true, {
+        "SELECT attr1 FROM table WHERE attr2=Fox AND attr3=2001",
+        "SELECT attr1 FROM table WHERE attr2=Universal AND attr3=0",
+        "SELECT attr1 FROM table WHERE attr2=MAGIC AND attr3=17",
+        nullptr } },
+    { "exclusive upper bound", true, {
+        "SELECT * FROM table WHERE attr3<2000",
+        "SELECT * FROM table WHERE attr3<1",
+        "SELECT * FROM table WHERE attr3<0",
+        "SELECT * FROM table WHERE attr3<99999",
+        nullptr } },
+    { "exclusive lower bound", true, {
+        "SELECT attr1, attr3 FROM table WHERE attr3>1999",
+        "SELECT attr1, attr3 FROM table WHERE attr3>0",
+        "SELECT attr1, attr3 FROM table WHERE attr3>7",
+        nullptr } },
+    { "inclusive range", true, {
+        "SELECT * FROM table WHERE attr3>=10 AND attr3<=20",
+        "SELECT * FROM table WHERE attr3>=0 AND attr3<=0",
+        "SELECT * FROM table WHERE attr3>=5 AND attr3<=4",
+        nullptr } },
+    { "LIMIT", true, {
+        "SELECT attr1 FROM table ORDER BY attr3 DESC LIMIT 5",
+        "SELECT attr1 FROM table ORDER BY attr3 DESC LIMIT 0",
+        "SELECT attr1 FROM table ORDER BY attr3 DESC LIMIT 120",
+        nullptr } },
+    { "condition and LIMIT", true, {
+        "SELECT * FROM table WHERE attr2=Fox ORDER BY attr1 LIMIT 3",
+        "SELECT * FROM table WHERE attr2=Apex ORDER BY attr1 LIMIT 1",
+        "SELECT * FROM table WHERE attr2=bAb ORDER BY attr1 LIMIT 30",
+        nullptr } },
+    { "INSERT", true, {
+        "INSERT INTO table VALUES (Drama, Fox, 2001)",
+        "INSERT INTO table VALUES (Action, Alpha, 0)",
+        "INSERT INTO table VALUES (x, y, 7)",
+        "INSERT INTO table VALUES (Comedy, Warner Bros, 1999)",
+        nullptr } },
+    { "INSERT without spaces", true, {
+        "INSERT INTO table VALUES (Drama,Fox,2001)",
+        "INSERT INTO table VALUES (Action,Alpha,42)",
+        nullptr } },
+    { "UPDATE SET list", true, {
+        "UPDATE table SET attr1=Drama, attr2=Fox WHERE attr3=5",
+        "UPDATE table SET attr1=Action, attr2=Alpha WHERE attr3=0",
+        "UPDATE table SET attr1=a, attr2=b WHERE attr3=123",
+        nullptr } },
+    { "UPDATE SET list, trailing comma", true, {
+        "UPDATE table SET attr1=Drama, WHERE attr3=5",
+        "UPDATE table SET attr1=Action, WHERE attr3=6",
+        "UPDATE table SET attr1=x, WHERE attr3=0",
+        nullptr } },
+    { "UPDATE of attr3", true, {
+        "UPDATE table SET attr3=10 WHERE attr1=Drama",
+        "UPDATE table SET attr3=0 WHERE attr1=Action",
+        "UPDATE table SET attr3=2020 WHERE attr1=zAz",
+        nullptr } },
+    { "DELETE", true, {
+        "DELETE FROM table WHERE attr1=Drama AND attr3=3",
+        "DELETE FROM table WHERE attr1=Alpha AND attr3=0",
+        "DELETE FROM table WHERE attr1=nA AND attr3=44",
+        nullptr } },
+    { "named table", true, {
+        "SELECT genre FROM movies WHERE year>1999 LIMIT 3",
+        "SELECT genre FROM movies WHERE year>0 LIMIT 0",
+        "SELECT genre FROM movies WHERE year>2010 LIMIT 25",
+        nullptr } },
+};
+
+// A PREPARE and the EXECUTE values to check it with
+struct NamedCase {
+    const char* prepare;
+    const char* values[4];  // Comma-separated, as written in EXECUTE name (...)
+};
+
+const NamedCase NAMED_CASES[] = {
+    { "SELECT * FROM table WHERE attr3<$1 LIMIT $2", { "2000, 5", "0, 0", "1, 100", nullptr } },
+    { "SELECT attr1 FROM table WHERE attr1=$1 AND attr3>$2", { "Drama, 5", "Action, 0", "xAy, 1999", nullptr } },
+    { "INSERT INTO table VALUES ($1, $2, $3)", { "Drama, Fox, 2001", "Action, Alpha, 0", nullptr } },
+    { "UPDATE table SET attr1=$1, WHERE attr3=$2", { "Drama, 5", "Action, 0", nullptr } },
+    { "UPDATE table SET attr2=$1 WHERE attr1=$2", { "Fox, Drama", "Alpha, Action", nullptr } },
+    { "DELETE FROM table WHERE attr2=$1", { "Fox", "Apex", nullptr } },
+};
+
+int failures = 0;
+bool verbose = false;
+
+void report(bool passed, const std::string& what, const char* statement) {
+    if (!passed) failures++;
+    if (!passed || verbose) std::cout << (passed ? "ok   " : "FAIL ") << what << ": " << statement << "\n";
+}
+
+// Whether the bound form is the parsed one
+bool sameParse(char kind, const SelectQuery& boundQuery, const WorkItem& boundItem, const SelectQuery& query,
+    const WorkItem& item) {
+    if (kind == 'S') return sameSelectQuery(boundQuery, query);
+    return boundItem.command == item.command && sameWorkItem(boundItem, item);
+}
+
+void checkShape(const ShapeCase& shape, StatementTemplates& templates, const Catalog& catalog) {
+    for (int s = 0; shape.statements[s] != nullptr; ++s) {
+        char resolved[MAX_COMMAND_LENGTH];
+        char parsed[MAX_COMMAND_LENGTH];
+        safeCopyString(resolved, shape.statements[s], MAX_COMMAND_LENGTH);
+        safeCopyString(parsed, shape.statements[s], MAX_COMMAND_LENGTH);
+
+        SelectQuery boundQuery;
+        WorkItem boundItem;
+        int prepared;
+        std::string values;
+        int boundTable = templates.resolve(resolved, catalog, boundQuery, boundItem, prepared, values);
+        SelectQuery query;
+        WorkItem item;
+        int table = parseStatement(parsed, catalog, query, item);
+
+        report(boundTable == table && sameParse(parsed[0], boundQuery, boundItem, query, item), shape.name, shape.statements[s]);
+        if (s > 0) report((prepared >= 0) == shape.binds, std::string(shape.name) + " (template use)", shape.statements[s]);
+    }
+}
+
+// The statement with each $n replaced by the n-th of the comma-separated values
+std::string substitute(const char* statement, const char* values) {
+    std::string list[MAX_PARAMETERS];
+    int count = 0;
+    std::string current;
+    for (int i = 0; ; ++i) {
+        if (values[i] == ',' || values[i] == '\0') {
+            size_t first = current.find_first_not_of(' ');
+            list[count++] = first == std::string::npos ? std::string() : current.substr(first);
+            current.clear();
+            if (values[i] == '\0') break;
+        }
+        else {
+            current += values[i];
+        }
+    }
+
+    std::string text;
+    for (int i = 0; statement[i] != '\0'; ++i) {
+        if (statement[i] == '$' && statement[i + 1] >= '1' && statement[i + 1] <= '9') {
+            text += list[statement[i + 1] - '1'];
+            i++;
+        }
+        else {
+            text += statement[i];
+        }
+    }
+    return text;
+}
+
+void checkNamed(const NamedCase& named, int number, StatementTemplates& templates, const Catalog& catalog) {
+    std::string name = "q" + std::to_string(number);
+    std::string prepare = "PREPARE " + name + " AS " + named.prepare;
+    if (templates.prepare(prepare.c_str(), catalog) < 0) {
+        report(false, "PREPARE", prepare.c_str());
+        return;
+    }
+
+    for (int v = 0; named.values[v] != nullptr; ++v) {
+        std::string execute = "EXECUTE " + name + " (" + named.values[v] + ")";
+        std::string values;
+        int id = templates.execute(execute.c_str(), values);
+        if (id < 0) {
+            report(false, "EXECUTE", execute.c_str());
+            continue;
+        }
+        SelectQuery boundQuery;
+        WorkItem boundItem;
+        bindParameters(templates.get(id), values.data(), boundQuery, boundItem);
+
+        std::string literal = substitute(named.prepare, named.values[v]);
+        char parsed[MAX_COMMAND_LENGTH];
+        safeCopyString(parsed, literal.c_str(), MAX_COMMAND_LENGTH);
+        SelectQuery query;
+        WorkItem item;
+        int table = parseStatement(parsed, catalog, query, item);
+
+        report(table == templates.get(id).table && sameParse(parsed[0], boundQuery, boundItem, query, item), execute,
+            literal.c_str());
+    }
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-v") verbose = true;
+    }
+
+    Catalog catalog;
+    TableSchema movies;
+    safeCopyString(movies.name, "movies", MAX_TABLE_NAME);
+    safeCopyString(movies.columns[0], "genre", MAX_COLUMN_NAME);
+    safeCopyString(movies.columns[1], "studio", MAX_COLUMN_NAME);
+    safeCopyString(movies.columns[2], "year", MAX_COLUMN_NAME);
+    catalog.createTable(movies);
+
+    StatementTemplates templates;
+    int checked = 0;
+    for (const ShapeCase& shape : SHAPE_CASES) {
+        checkShape(shape, templates, catalog);
+        checked++;
+    }
+    int number = 0;
+    for (const NamedCase& named : NAMED_CASES) {
+        checkNamed(named, number++, templates, catalog);
+    }
+
+    std::cout << checked << " shapes and " << number << " prepared statements checked, " << failures << " failures\n";
+    return failures > 0 ? 1 : 0;
+}
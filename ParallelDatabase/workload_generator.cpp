@@ -0,0 +1,295 @@
+// Workload generator: writes a statement stream for ParallelDatabase with a
+// configurable operation mix, key distribution, value cardinalities and
+// predicate shapes. The same options and seed always give the same stream.
+//
+// Usage: workload_generator [options]
+//   -n count        statements after the preload (default 10000)
+//   -l count        INSERTs written first to preload the table (default 0)
+//   -o file         output file (default workload.sql)
+//   -b              packed binary output instead of one statement per line
+//   -s seed         random seed (default 1)
+//   -m i,s,u,d      weights of INSERT, SELECT, UPDATE and DELETE (default 70,10,10,10)
+//   -p shapes       SELECT predicate weights, e.g. "attr1attr3=3,range=1" (default attr1attr3=1)
+//   -w shapes       UPDATE/DELETE predicate weights (default attr1=1)
+//   -k dist         uniform or zipf key distribution (default uniform)
+//   -z theta        Zipf exponent (default 0.99)
+//   -c1, -c2, -c3 n distinct attr1, attr2 and attr3 values (default 12, 10, 125)
+//   -r width        attr3 values covered by a range scan (default 10)
+//   -t k            LIMIT of top-k SELECTs (default 10)
+//
+// Predicate shapes:
+//   attr1       WHERE attr1=x
+//   attr2       WHERE attr2=x
+//   attr3       WHERE attr3=x
+//   attr1attr3  WHERE attr1=x AND attr3=y
+//   prefix      WHERE attr1=x*  (prefix wildcard)
+//   range       WHERE attr3>=x AND attr3<=y  (SELECT only)
+//   top         WHERE attr2=x ORDER BY attr3 DESC LIMIT k  (SELECT only)
+//
+// Values are lowercase names and plain numbers: the database's parser stops a
+// value at 'A' (for AND) and an UPDATE's SET clause at 'W' (for WHERE). With
+// the Zipf distribution value i is the i-th most frequent, so the hottest
+// attr3 keys are the smallest numbers.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+// Must match the packed workload format read by ParallelDatabase
+const char WORKLOAD_MAGIC[] = "PDBWORK1";
+const int WORKLOAD_MAGIC_LENGTH = 8;
+
+enum Shape { SHAPE_ATTR1, SHAPE_ATTR2, SHAPE_ATTR3, SHAPE_ATTR1_ATTR3, SHAPE_PREFIX, SHAPE_RANGE, SHAPE_TOP, SHAPE_COUNT };
+const char* const SHAPE_NAMES[SHAPE_COUNT] = { "attr1", "attr2", "attr3", "attr1attr3", "prefix", "range", "top" };
+
+// Draws value indices in [0, cardinality), uniformly or Zipf distributed
+class KeySampler {
+private:
+    int cardinality;
+    std::vector<double> cumulative;  // Zipf CDF, empty when uniform
+
+public:
+    KeySampler(int cardinality, bool zipf, double theta) : cardinality(std::max(1, cardinality)) {
+        if (!zipf) return;
+
+        cumulative.resize(this->cardinality);
+        double sum = 0.0;
+        for (int i = 0; i < this->cardinality; ++i) {
+            sum += 1.0 / std::pow(i + 1.0, theta);
+            cumulative[i] = sum;
+        }
+        for (double& value : cumulative) value /= sum;
+    }
+
+    int next(std::mt19937_64& random) const {
+        if (cumulative.empty()) {
+            return std::uniform_int_distribution<int>(0, cardinality - 1)(random);
+        }
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        int index = (int)(std::lower_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin());
+        return std::min(index, cardinality - 1);
+    }
+};
+
+// Picks an index with probability proportional to its weight
+int pickWeighted(const std::vector<double>& weights, std::mt19937_64& random) {
+    double total = 0.0;
+    for (double weight : weights) total += weight;
+    double u = std::uniform_real_distribution<double>(0.0, total)(random);
+    for (size_t i = 0; i < weights.size(); ++i) {
+        if (u < weights[i]) return (int)i;
+        u -= weights[i];
+    }
+    return (int)weights.size() - 1;
+}
+
+// Parse "70,10,10,10"
+bool parseMix(const std::string& text, std::vector<double>& weights) {
+    std::stringstream items(text);
+    std::string item;
+    weights.clear();
+    while (std::getline(items, item, ',')) weights.push_back(std::stod(item));
+    return weights.size() == 4;
+}
+
+// Parse "attr1=2,range=1" into per-shape weights
+bool parseShapes(const std::string& text, std::vector<double>& weights) {
+    weights.assign(SHAPE_COUNT, 0.0);
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t equals = item.find('=');
+        std::string name = item.substr(0, equals);
+        double weight = equals == std::string::npos ? 1.0 : std::stod(item.substr(equals + 1));
+
+        int shape = 0;
+        while (shape < SHAPE_COUNT && name != SHAPE_NAMES[shape]) shape++;
+        if (shape == SHAPE_COUNT) {
+            std::cerr << "Error: unknown predicate shape " << name << "\n";
+            return false;
+        }
+        weights[shape] = weight;
+    }
+    return true;
+}
+
+class WorkloadGenerator {
+private:
+    std::mt19937_64 random;
+    KeySampler attr1Keys;
+    KeySampler attr2Keys;
+    KeySampler attr3Keys;
+    int attr3Cardinality;
+    int rangeWidth;
+    int topK;
+
+    std::string attr1() { return "name" + std::to_string(attr1Keys.next(random)); }
+    std::string attr2() { return "group" + std::to_string(attr2Keys.next(random)); }
+    int attr3() { return attr3Keys.next(random); }
+
+    // All values sharing the key's text but its last digit
+    std::string attr1Prefix() {
+        std::string key = attr1();
+        return key.substr(0, std::max<size_t>(5, key.size() - 1)) + "*";
+    }
+
+    std::string whereClause(int shape) {
+        switch (shape) {
+        case SHAPE_ATTR1: return "WHERE attr1=" + attr1();
+        case SHAPE_ATTR2: return "WHERE attr2=" + attr2();
+        case SHAPE_ATTR3: return "WHERE attr3=" + std::to_string(attr3());
+        case SHAPE_PREFIX: return "WHERE attr1=" + attr1Prefix();
+        case SHAPE_RANGE: {
+            int low = std::min(attr3(), std::max(0, attr3Cardinality - rangeWidth));
+            return "WHERE attr3>=" + std::to_string(low) + " AND attr3<=" + std::to_string(low + rangeWidth - 1);
+        }
+        case SHAPE_TOP: return "WHERE attr2=" + attr2() + " ORDER BY attr3 DESC LIMIT " + std::to_string(topK);
+        default: {
+            std::string first = "WHERE attr1=" + attr1();
+            return first + " AND attr3=" + std::to_string(attr3());
+        }
+        }
+    }
+
+public:
+    WorkloadGenerator(unsigned long long seed, bool zipf, double theta, int attr1Cardinality,
+        int attr2Cardinality, int attr3Cardinality, int rangeWidth, int topK)
+        : random(seed), attr1Keys(attr1Cardinality, zipf, theta), attr2Keys(attr2Cardinality, zipf, theta),
+          attr3Keys(attr3Cardinality, zipf, theta), attr3Cardinality(attr3Cardinality),
+          rangeWidth(std::max(1, rangeWidth)), topK(topK) {}
+
+    std::string insert() {
+        std::string first = attr1();
+        std::string second = attr2();
+        return "INSERT INTO table VALUES (" + first + ", " + second + ", " + std::to_string(attr3()) + ")";
+    }
+
+    std::string select(const std::vector<double>& shapes) {
+        int shape = pickWeighted(shapes, random);
+        const char* columns = "attr1, attr2, attr3";
+        if (shape == SHAPE_ATTR1 || shape == SHAPE_ATTR1_ATTR3) columns = "attr2, attr3";
+        else if (shape == SHAPE_ATTR2) columns = "attr1, attr3";
+        else if (shape == SHAPE_ATTR3) columns = "attr1, attr2";
+        return std::string("SELECT ") + columns + " FROM table " + whereClause(shape);
+    }
+
+    std::string update(const std::vector<double>& shapes) {
+        std::string first = attr1();
+        std::string second = attr2();
+        return "UPDATE table SET attr1=" + first + ", attr2=" + second + " " + whereClause(pickWeighted(shapes, random));
+    }
+
+    std::string remove(const std::vector<double>& shapes) {
+        return "DELETE FROM table " + whereClause(pickWeighted(shapes, random));
+    }
+
+    std::string next(const std::vector<double>& mix, const std::vector<double>& selectShapes,
+        const std::vector<double>& writeShapes) {
+        switch (pickWeighted(mix, random)) {
+        case 0: return insert();
+        case 1: return select(selectShapes);
+        case 2: return update(writeShapes);
+        default: return remove(writeShapes);
+        }
+    }
+};
+
+void writeStatement(std::ofstream& output, const std::string& statement, bool packed) {
+    if (!packed) {
+        output << statement << "\n";
+        return;
+    }
+    unsigned int length = (unsigned int)statement.size();
+    unsigned char lengthBytes[4] = {
+        (unsigned char)(length & 0xff), (unsigned char)((length >> 8) & 0xff),
+        (unsigned char)((length >> 16) & 0xff), (unsigned char)((length >> 24) & 0xff)
+    };
+    output.write((const char*)lengthBytes, 4);
+    output.write(statement.data(), statement.size());
+}
+
+int main(int argc, char** argv) {
+    long long count = 10000;
+    long long preload = 0;
+    std::string outputFileName = "workload.sql";
+    bool packed = false;
+    unsigned long long seed = 1;
+    std::vector<double> mix = { 70, 10, 10, 10 };
+    std::vector<double> selectShapes;
+    std::vector<double> writeShapes;
+    parseShapes("attr1attr3", selectShapes);
+    parseShapes("attr1", writeShapes);
+    bool zipf = false;
+    double theta = 0.99;
+    int attr1Cardinality = 12;
+    int attr2Cardinality = 10;
+    int attr3Cardinality = 125;
+    int rangeWidth = 10;
+    int topK = 10;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-b") {
+            packed = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Error: missing value for " << arg << "\n";
+            return 1;
+        }
+        std::string value = argv[++i];
+
+        bool valid = true;
+        if (arg == "-n") count = std::stoll(value);
+        else if (arg == "-l") preload = std::stoll(value);
+        else if (arg == "-o") outputFileName = value;
+        else if (arg == "-s") seed = std::stoull(value);
+        else if (arg == "-m") valid = parseMix(value, mix);
+        else if (arg == "-p") valid = parseShapes(value, selectShapes);
+        else if (arg == "-w") valid = parseShapes(value, writeShapes);
+        else if (arg == "-k") {
+            valid = value == "uniform" || value == "zipf";
+            zipf = value == "zipf";
+        }
+        else if (arg == "-z") theta = std::stod(value);
+        else if (arg == "-c1") attr1Cardinality = std::stoi(value);
+        else if (arg == "-c2") attr2Cardinality = std::stoi(value);
+        else if (arg == "-c3") attr3Cardinality = std::stoi(value);
+        else if (arg == "-r") rangeWidth = std::stoi(value);
+        else if (arg == "-t") topK = std::stoi(value);
+        else valid = false;
+
+        if (!valid) {
+            std::cerr << "Error: invalid option " << arg << " " << value << "\n";
+            return 1;
+        }
+    }
+
+    // Range scans and top-k only make sense for SELECTs
+    writeShapes[SHAPE_RANGE] = 0.0;
+    writeShapes[SHAPE_TOP] = 0.0;
+
+    std::ofstream output(outputFileName, std::ios::out | std::ios::binary);
+    if (!output.is_open()) {
+        std::cerr << "Error: Could not open " << outputFileName << "\n";
+        return 1;
+    }
+    if (packed) {
+        output.write(WORKLOAD_MAGIC, WORKLOAD_MAGIC_LENGTH);
+    }
+
+    WorkloadGenerator generator(seed, zipf, theta, attr1Cardinality, attr2Cardinality, attr3Cardinality, rangeWidth, topK);
+    for (long long i = 0; i < preload; ++i) {
+        writeStatement(output, generator.insert(), packed);
+    }
+    for (long long i = 0; i < count; ++i) {
+        writeStatement(output, generator.next(mix, selectShapes, writeShapes), packed);
+    }
+
+    return 0;
+}